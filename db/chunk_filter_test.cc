@@ -0,0 +1,224 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/nvmtable.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+#include "leveldb/comparator.h"
+#include "util/arena.h"
+#include "util/coding.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static const size_t kChunkSize = 1 << 20;
+
+class ChunkFilterTest {
+ public:
+  ChunkFilterTest() : icmp_(BytewiseComparator()), arena_(NULL), cktbl_(NULL), seq_(0) {
+    fname_ = test::TmpDir() + "/chunk_filter_test";
+    unlink(fname_.c_str());
+    Open(false);
+  }
+
+  ~ChunkFilterTest() {
+    Close();
+    unlink(fname_.c_str());
+  }
+
+  void Open(bool recovery) {
+    arena_ = new ArenaNVM(&fname_, kChunkSize, recovery);
+    cktbl_ = new chunkTable(icmp_, arena_, recovery);
+    cktbl_->Ref();
+    cktbl_->SetChunkNumber(7);
+  }
+
+  // the chunk frees its arena, what is left in the file is what a
+  // reopen recovers
+  void Close() {
+    if (cktbl_ != NULL) cktbl_->Unref();
+    cktbl_ = NULL;
+    arena_ = NULL;
+  }
+
+  static std::string Key(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+  // entries [from, to) as one batch, placed in the chunk like a
+  // zero-copy move does
+  void AddKeys(int from, int to) {
+    std::vector<const char*> kvitems;
+    for (int i = from; i < to; i++) {
+      std::string key = Key(i);
+      const size_t len = VarintLength(key.size() + 8) + key.size() + 8 +
+                         VarintLength(key.size()) + key.size();
+      char* buf = cktbl_->AllocateEntry(len);
+      ASSERT_TRUE(buf != NULL);
+      char* p = EncodeVarint32(buf, key.size() + 8);
+      memcpy(p, key.data(), key.size());
+      p += key.size();
+      EncodeFixed64(p, (++seq_ << 8) | kTypeValue);
+      p += 8;
+      p = EncodeVarint32(p, key.size());
+      memcpy(p, key.data(), key.size());
+      kvitems.push_back(buf);
+    }
+    ASSERT_OK(cktbl_->AddBatch(kvitems));
+  }
+
+  // entries [from, to) built in DRAM, the chunk copies them like a move
+  // out of a memtable does
+  Status CopyKeys(int from, int to) {
+    std::vector<std::string> entries;
+    for (int i = from; i < to; i++) {
+      std::string key = Key(i);
+      std::string value(200, 'a' + i % 26);
+      std::string entry;
+      PutVarint32(&entry, key.size() + 8);
+      entry.append(key);
+      PutFixed64(&entry, (++seq_ << 8) | kTypeValue);
+      PutVarint32(&entry, value.size());
+      entry.append(value);
+      entries.push_back(entry);
+    }
+    std::vector<const char*> kvitems;
+    for (size_t i = 0; i < entries.size(); i++) {
+      kvitems.push_back(entries[i].data());
+    }
+    return cktbl_->AddBatch(kvitems);
+  }
+
+  void CheckKeys(int n) {
+    for (int i = 0; i < n; i++) {
+      std::string value;
+      Status s;
+      ASSERT_TRUE(cktbl_->Get(LookupKey(Key(i), seq_), &value, &s));
+      ASSERT_EQ(std::string(200, 'a' + i % 26), value);
+    }
+  }
+
+  // every key below n may be there, and the filter rules out most others
+  void CheckFilter(int n) {
+    ASSERT_TRUE(cktbl_->FilterReady());
+    for (int i = 0; i < n; i++) {
+      ASSERT_TRUE(cktbl_->MaybeContains(Key(i)));
+    }
+    int false_positives = 0;
+    for (int i = n; i < n + 10000; i++) {
+      if (cktbl_->MaybeContains(Key(i))) false_positives++;
+    }
+    ASSERT_LT(false_positives, 200);
+  }
+
+  std::string SaveFilter() {
+    std::string record(cktbl_->FilterRecordSize(), '\0');
+    cktbl_->SaveBloomFilter(&record[0]);
+    return record;
+  }
+
+  InternalKeyComparator icmp_;
+  std::string fname_;
+  ArenaNVM* arena_;
+  chunkTable* cktbl_;
+  SequenceNumber seq_;
+};
+
+TEST(ChunkFilterTest, FilterFollowsInserts) {
+  AddKeys(0, 1000);
+  CheckFilter(1000);
+  AddKeys(1000, 2000);
+  CheckFilter(2000);
+}
+
+TEST(ChunkFilterTest, SavedFilterIsRecovered) {
+  AddKeys(0, 2000);
+  std::string record = SaveFilter();
+  Close();
+  Open(true);
+  // readers are not misled before the filter is back
+  ASSERT_TRUE(!cktbl_->FilterReady());
+  ASSERT_TRUE(cktbl_->MaybeContains(Key(5000)));
+  ASSERT_TRUE(cktbl_->RecoverBloomFilter(record.data()));
+  CheckFilter(2000);
+}
+
+TEST(ChunkFilterTest, StaleFilterIsRebuilt) {
+  AddKeys(0, 1000);
+  std::string record = SaveFilter();
+  // written after the save, like a crash long after the last clean close
+  AddKeys(1000, 2000);
+  Close();
+  Open(true);
+  ASSERT_TRUE(!cktbl_->RecoverBloomFilter(record.data()));
+  ASSERT_TRUE(!cktbl_->FilterReady());
+  cktbl_->RebuildFilter();
+  CheckFilter(2000);
+
+  // and it is kept up to date from then on
+  AddKeys(2000, 2500);
+  CheckFilter(2500);
+}
+
+TEST(ChunkFilterTest, RecordOfAnotherChunkIsIgnored) {
+  AddKeys(0, 100);
+  std::string record = SaveFilter();
+  Close();
+  Open(true);
+  cktbl_->SetChunkNumber(8);
+  ASSERT_TRUE(!cktbl_->RecoverBloomFilter(record.data()));
+}
+
+TEST(ChunkFilterTest, ChunkGrowsPastCapacity) {
+  // a move may overrun the chunk, the file is mapped further instead
+  int n = 0;
+  while (arena_->AllocatedBytes() < 3 * kChunkSize) {
+    ASSERT_OK(CopyKeys(n, n + 1000));
+    n += 1000;
+  }
+  ASSERT_GE(arena_->MappedBytes(), arena_->AllocatedBytes());
+  CheckKeys(n);
+  Close();
+  Open(true);
+  ASSERT_GE(arena_->MappedBytes(), 3 * kChunkSize);
+  CheckKeys(n);
+  // and it keeps growing after a reopen
+  ASSERT_OK(CopyKeys(n, n + 1000));
+  CheckKeys(n + 1000);
+}
+
+TEST(ChunkFilterTest, ChunkThatCannotGrowReportsIt) {
+  // take the address range behind the reservation, so the arena can't
+  // extend it in place. Taken already if the hint is not honoured
+  char* end = reinterpret_cast<char*>(arena_->getMapStart()) +
+              arena_->ReservedBytes();
+  const size_t kBlocked = 64 << 20;
+  void* blocked = mmap(end, kBlocked, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  ASSERT_TRUE(blocked != MAP_FAILED);
+  int n = 0;
+  Status s;
+  for (int round = 0; round < 1000 && s.ok(); round++) {
+    s = CopyKeys(n, n + 1000);
+    if (s.ok()) n += 1000;
+  }
+  ASSERT_TRUE(s.IsIOError());
+  // the batch that did not fit left nothing behind, and the chunk stays
+  // readable
+  CheckKeys(n);
+  std::string value;
+  ASSERT_TRUE(!cktbl_->Get(LookupKey(Key(n), seq_), &value, &s));
+  munmap(blocked, kBlocked);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,173 @@
+/*************************************************************************
+	> File Name: chunk_pool.cc
+	> Author: Meggie
+	> Mail: 1224642332@qq.com
+	> Created Time: Sat 17 Oct 2026 10:12:43 PM CST
+ ************************************************************************/
+#include "db/chunk_pool.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+#include "db/filename.h"
+#include "leveldb/env.h"
+#include "util/arena.h"
+#include "util/debug.h"
+#include "util/mutexlock.h"
+
+namespace leveldb{
+ChunkFilePool::ChunkFilePool(Env* env, const std::string& dir,
+        size_t chunk_size, int target)
+    : env_(env),
+      dir_(dir),
+      chunk_size_(chunk_size),
+      target_(target),
+      cv_(&mutex_),
+      next_number_(1),
+      preparing_(false),
+      shutting_down_(false),
+      bg_exited_(false){
+    //spares of an earlier run may have been half zeroed when it stopped
+    std::vector<std::string> filenames;
+    env_->GetChildren(dir_, &filenames);
+    uint64_t number;
+    FileType type;
+    for(size_t i = 0; i < filenames.size(); i++){
+        if(!ParseFileName(filenames[i], &number, &type) ||
+                type != kSpareChunkFile)
+            continue;
+        if(number >= next_number_)
+            next_number_ = number + 1;
+        if(static_cast<int>(dirty_.size()) < target_)
+            dirty_.push_back(dir_ + "/" + filenames[i]);
+        else
+            env_->DeleteFile(dir_ + "/" + filenames[i]);
+    }
+    env_->StartThread(&ChunkFilePool::BGWork, this);
+}
+
+ChunkFilePool::~ChunkFilePool(){
+    MutexLock l(&mutex_);
+    shutting_down_ = true;
+    cv_.SignalAll();
+    while(!bg_exited_)
+        cv_.Wait();
+    //arenas still around are not to call back, their files stay
+    for(std::map<std::string, ArenaNVM*>::iterator it = open_.begin();
+            it != open_.end(); ++it)
+        it->second->SetReleaseHook(NULL, NULL);
+}
+
+bool ChunkFilePool::Take(const std::string& fname){
+    MutexLock l(&mutex_);
+    if(ready_.empty())
+        return false;
+    std::string spare = ready_.front();
+    ready_.pop_front();
+    cv_.SignalAll();
+    return env_->RenameFile(spare, fname).ok();
+}
+
+void ChunkFilePool::Register(ArenaNVM* arena){
+    MutexLock l(&mutex_);
+    open_[arena->mfile] = arena;
+    arena->SetReleaseHook(&ChunkFilePool::Released, this);
+}
+
+void ChunkFilePool::Retire(const std::string& fname){
+    MutexLock l(&mutex_);
+    if(open_.find(fname) != open_.end())
+        retiring_.insert(fname);
+    else
+        Recycle(fname);
+}
+
+void ChunkFilePool::Released(void* arg, const std::string& fname){
+    ChunkFilePool* pool = reinterpret_cast<ChunkFilePool*>(arg);
+    MutexLock l(&pool->mutex_);
+    pool->open_.erase(fname);
+    if(pool->retiring_.erase(fname) > 0)
+        pool->Recycle(fname);
+}
+
+void ChunkFilePool::Recycle(const std::string& fname){
+    mutex_.AssertHeld();
+    if(static_cast<int>(ready_.size() + dirty_.size()) >= target_){
+        env_->DeleteFile(fname);
+        return;
+    }
+    std::string spare = SpareFileName(next_number_++);
+    //gone already if an earlier retire got to it
+    if(!env_->RenameFile(fname, spare).ok())
+        return;
+    DEBUG_T("recycle %s as %s\n", fname.c_str(), spare.c_str());
+    dirty_.push_back(spare);
+    cv_.SignalAll();
+}
+
+int ChunkFilePool::NumReady(){
+    MutexLock l(&mutex_);
+    return ready_.size();
+}
+
+void ChunkFilePool::WaitForIdle(){
+    MutexLock l(&mutex_);
+    while(preparing_ || !dirty_.empty() ||
+            static_cast<int>(ready_.size()) < target_)
+        cv_.Wait();
+}
+
+std::string ChunkFilePool::SpareFileName(uint64_t number){
+    return chunkSpareFileName(dir_, number);
+}
+
+bool ChunkFilePool::Prepare(const std::string& fname){
+    int fd = open(fname.c_str(), O_RDWR | O_CREAT, 0664);
+    if(fd < 0)
+        return false;
+    //the blocks of a recycled chunk are dropped, new ones read as zeros
+    bool ok = ftruncate(fd, 0) == 0;
+    if(ok && fallocate(fd, 0, 0, chunk_size_) != 0)
+        ok = ftruncate(fd, chunk_size_) == 0;
+    close(fd);
+    return ok;
+}
+
+void ChunkFilePool::BGWork(void* arg){
+    reinterpret_cast<ChunkFilePool*>(arg)->BackgroundCall();
+}
+
+void ChunkFilePool::BackgroundCall(){
+    MutexLock l(&mutex_);
+    while(!shutting_down_){
+        std::string fname;
+        if(!dirty_.empty()){
+            fname = dirty_.front();
+            dirty_.pop_front();
+        } else if(static_cast<int>(ready_.size()) < target_){
+            fname = SpareFileName(next_number_++);
+        } else {
+            cv_.Wait();
+            continue;
+        }
+        preparing_ = true;
+        mutex_.Unlock();
+        const bool ok = Prepare(fname);
+        mutex_.Lock();
+        preparing_ = false;
+        if(ok){
+            ready_.push_back(fname);
+        } else {
+            DEBUG_T("cannot prepare spare chunk %s\n", fname.c_str());
+            env_->DeleteFile(fname);
+            //no retry until a spare is taken or a chunk retired
+            cv_.SignalAll();
+            cv_.Wait();
+        }
+        cv_.SignalAll();
+    }
+    bg_exited_ = true;
+    cv_.SignalAll();
+}
+}
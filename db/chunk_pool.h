@@ -0,0 +1,83 @@
+/*************************************************************************
+	> File Name: chunk_pool.h
+	> Author: Meggie
+	> Mail: 1224642332@qq.com
+	> Created Time: Sat 17 Oct 2026 10:12:43 PM CST
+ ************************************************************************/
+#ifndef STORAGE_LEVELDB_DB_CHUNK_POOL_H_
+#define STORAGE_LEVELDB_DB_CHUNK_POOL_H_
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include "port/port.h"
+
+namespace leveldb{
+class ArenaNVM;
+class Env;
+
+//spare chunk files, allocated to the chunk size and zeroed by a background
+//thread, so a new chunk takes one over with a rename instead of having its
+//blocks allocated on first touch. The page faults of the chunk's own
+//mapping are still taken as it fills.
+//
+//an obsolete chunk file is retired instead of deleted. It goes back to the
+//pool once its arena is unmapped, readers of an old version may still be
+//in it until then. Spares left over by an earlier run are zeroed again.
+class ChunkFilePool{
+    public:
+        //keeps up to target spare files of chunk_size bytes in dir
+        ChunkFilePool(Env* env, const std::string& dir, size_t chunk_size,
+                int target);
+        //waits for the background thread, the spares stay for the next run.
+        //Arenas that outlive the pool keep their files
+        ~ChunkFilePool();
+
+        //renames a spare to fname, false if none is ready
+        bool Take(const std::string& fname);
+        //the arena's file is retired once the arena is released
+        void Register(ArenaNVM* arena);
+        //fname is obsolete, it is recycled now if no arena maps it
+        void Retire(const std::string& fname);
+
+        //spares ready to be taken
+        int NumReady();
+        //blocks until the background thread has nothing left to do
+        void WaitForIdle();
+
+    private:
+        static void Released(void* arg, const std::string& fname);
+        static void BGWork(void* arg);
+        void BackgroundCall();
+        //moves fname into the pool, or deletes it if the pool is full
+        void Recycle(const std::string& fname);
+        std::string SpareFileName(uint64_t number);
+        //allocates the blocks of the spare file, zeroing what was there
+        bool Prepare(const std::string& fname);
+
+        Env* const env_;
+        const std::string dir_;
+        const size_t chunk_size_;
+        const int target_;
+
+        port::Mutex mutex_;
+        port::CondVar cv_;
+        //spares ready to be taken and ones still to be zeroed
+        std::deque<std::string> ready_;
+        std::deque<std::string> dirty_;
+        //chunk files some arena maps, and those of them already retired
+        std::map<std::string, ArenaNVM*> open_;
+        std::set<std::string> retiring_;
+        uint64_t next_number_;
+        bool preparing_;
+        bool shutting_down_;
+        bool bg_exited_;
+
+        ChunkFilePool(const ChunkFilePool&);
+        void operator=(const ChunkFilePool&);
+};
+}
+#endif
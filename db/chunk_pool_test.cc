@@ -0,0 +1,142 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/chunk_pool.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "leveldb/env.h"
+#include "util/arena.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static const size_t kChunkSize = 1 << 20;
+
+class ChunkFilePoolTest {
+ public:
+  ChunkFilePoolTest() : env_(Env::Default()), pool_(NULL) {
+    dir_ = test::TmpDir() + "/chunk_pool_test";
+    env_->CreateDir(dir_);
+    Clear();
+  }
+
+  ~ChunkFilePoolTest() {
+    delete pool_;
+    Clear();
+    env_->DeleteDir(dir_);
+  }
+
+  void Clear() {
+    std::vector<std::string> filenames;
+    env_->GetChildren(dir_, &filenames);
+    for (size_t i = 0; i < filenames.size(); i++) {
+      env_->DeleteFile(dir_ + "/" + filenames[i]);
+    }
+  }
+
+  void Open(int target) {
+    delete pool_;
+    pool_ = new ChunkFilePool(env_, dir_, kChunkSize, target);
+    pool_->WaitForIdle();
+  }
+
+  int NumSpares() {
+    std::vector<std::string> filenames;
+    env_->GetChildren(dir_, &filenames);
+    int n = 0;
+    for (size_t i = 0; i < filenames.size(); i++) {
+      if (filenames[i].find(".spr") != std::string::npos) n++;
+    }
+    return n;
+  }
+
+  std::string ChunkName(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/%06d.cnk", i);
+    return dir_ + buf;
+  }
+
+  // a file of the chunk size holding nothing but zeros
+  bool IsZeroed(const std::string& fname) {
+    std::string data;
+    ASSERT_OK(ReadFileToString(env_, fname, &data));
+    if (data.size() != kChunkSize) return false;
+    for (size_t i = 0; i < data.size(); i++) {
+      if (data[i] != 0) return false;
+    }
+    return true;
+  }
+
+  Env* env_;
+  std::string dir_;
+  ChunkFilePool* pool_;
+};
+
+TEST(ChunkFilePoolTest, FillsToTarget) {
+  Open(3);
+  ASSERT_EQ(3, pool_->NumReady());
+  ASSERT_EQ(3, NumSpares());
+}
+
+TEST(ChunkFilePoolTest, TakeRenamesASpare) {
+  Open(2);
+  ASSERT_TRUE(pool_->Take(ChunkName(5)));
+  ASSERT_TRUE(IsZeroed(ChunkName(5)));
+  pool_->WaitForIdle();
+  ASSERT_EQ(2, NumSpares());
+}
+
+TEST(ChunkFilePoolTest, RetiredChunkWaitsForItsArena) {
+  Open(1);
+  std::string fname = ChunkName(7);
+  ASSERT_TRUE(pool_->Take(fname));
+  ArenaNVM* arena = new ArenaNVM(&fname, kChunkSize, false);
+  pool_->Register(arena);
+  char* p = arena->AllocateAlignedNVM(4096);
+  memset(p, 'x', 4096);
+
+  // still mapped, the pool leaves it alone
+  pool_->Retire(fname);
+  ASSERT_TRUE(env_->FileExists(fname));
+  delete arena;
+  ASSERT_TRUE(!env_->FileExists(fname));
+
+  // and it is handed out zeroed
+  pool_->WaitForIdle();
+  ASSERT_EQ(1, NumSpares());
+  ASSERT_TRUE(pool_->Take(ChunkName(8)));
+  ASSERT_TRUE(IsZeroed(ChunkName(8)));
+}
+
+TEST(ChunkFilePoolTest, RetiredChunkBeyondTargetIsDeleted) {
+  Open(1);
+  ASSERT_OK(WriteStringToFile(env_, "stale", ChunkName(9)));
+  pool_->Retire(ChunkName(9));
+  ASSERT_TRUE(!env_->FileExists(ChunkName(9)));
+  ASSERT_EQ(1, NumSpares());
+}
+
+TEST(ChunkFilePoolTest, SparesOutliveThePool) {
+  Open(2);
+  ASSERT_TRUE(pool_->Take(ChunkName(3)));
+  ASSERT_OK(WriteStringToFile(env_, "stale", ChunkName(3)));
+  pool_->Retire(ChunkName(3));
+  delete pool_;
+  pool_ = NULL;
+
+  // the next run zeroes what it finds again, and keeps no more than its
+  // target
+  Open(1);
+  ASSERT_EQ(1, pool_->NumReady());
+  ASSERT_EQ(1, NumSpares());
+  ASSERT_TRUE(pool_->Take(ChunkName(4)));
+  ASSERT_TRUE(IsZeroed(ChunkName(4)));
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
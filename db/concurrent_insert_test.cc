@@ -0,0 +1,230 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/skiplist.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "db/dbformat.h"
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+#include "util/arena.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+struct StringComparator {
+  int operator()(const char* a, const char* b) const {
+    return strcmp(a, b);
+  }
+};
+
+typedef SkipList<const char*, StringComparator> List;
+
+static const int kThreads = 4;
+
+static std::string Key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%08d", i);
+  return buf;
+}
+
+static const char* NodeKey(const List::Iterator& iter) {
+  return reinterpret_cast<const char*>(
+      (intptr_t)iter.node_ - (intptr_t)iter.key_offset());
+}
+
+class ConcurrentInsertTest { };
+
+TEST(ConcurrentInsertTest, SkipList) {
+  const int kPerThread = 10000;
+  Arena arena;
+  List list(StringComparator(), &arena);
+  std::atomic<bool> done(false);
+  std::atomic<int> scans(0);
+
+  // what a reader sees while the writers run is always in order
+  std::thread reader([&]() {
+    while (!done.load()) {
+      List::Iterator iter(&list);
+      std::string last;
+      for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+        ASSERT_LT(last, std::string(NodeKey(iter)));
+        last = NodeKey(iter);
+      }
+      scans++;
+    }
+  });
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; t++) {
+    writers.push_back(std::thread([&, t]() {
+      std::vector<int> ids;
+      for (int i = 0; i < kPerThread; i++) ids.push_back(i * kThreads + t);
+      Random rnd(301 + t);
+      for (int i = kPerThread - 1; i > 0; i--) {
+        std::swap(ids[i], ids[rnd.Uniform(i + 1)]);
+      }
+      for (size_t i = 0; i < ids.size(); i++) {
+        std::string key = Key(ids[i]);
+        char* mem = arena.AllocateAlignedConcurrent(key.size() + 1);
+        memcpy(mem, key.c_str(), key.size() + 1);
+        list.InsertConcurrently(mem);
+      }
+    }));
+  }
+  for (int t = 0; t < kThreads; t++) writers[t].join();
+  done.store(true);
+  reader.join();
+  ASSERT_GT(scans.load(), 0);
+
+  List::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (int i = 0; i < kThreads * kPerThread; i++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(Key(i), std::string(NodeKey(iter)));
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+
+  // the upper levels lead to the same nodes
+  Random rnd(7);
+  for (int i = 0; i < 1000; i++) {
+    std::string key = Key(rnd.Uniform(kThreads * kPerThread));
+    ASSERT_TRUE(list.Contains(key.c_str()));
+  }
+}
+
+static Options WriterOptions() {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 256 << 10;
+  options.num_chunk_tables = 4;
+  options.chunk_size = 1 << 20;
+  return options;
+}
+
+static int NumTables(DB* db) {
+  int tables = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    std::string property;
+    char name[64];
+    snprintf(name, sizeof(name), "leveldb.num-files-at-level%d", level);
+    ASSERT_TRUE(db->GetProperty(name, &property));
+    tables += atoi(property.c_str());
+  }
+  return tables;
+}
+
+// kThreads writers, each writing its keys in order, and a reader that
+// checks a snapshot always sees a prefix of what every writer wrote
+static void CheckWriters(const Options& options, size_t value_size = 100) {
+  std::string dbname = test::TmpDir() + "/concurrent_insert_test";
+  std::string nvmname = test::TmpDir() + "/concurrent_insert_test_nvm";
+  DestroyDB(dbname, Options(), nvmname);
+  DB* db;
+  ASSERT_OK(DB::Open(options, dbname, &db, nvmname));
+
+  const int kPerThread = 3000;
+  std::atomic<int> finished(0);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; t++) {
+    writers.push_back(std::thread([&, t]() {
+      for (int i = 0; i < kPerThread; i += 3) {
+        WriteBatch batch;
+        for (int j = i; j < i + 3; j++) {
+          std::string key = Key(j * kThreads + t);
+          batch.Put(key, key + std::string(value_size, 'v'));
+        }
+        // one key of each batch is then deleted in a later one
+        if (i > 0) batch.Delete(Key((i - 2) * kThreads + t));
+        WriteOptions write_options;
+        write_options.sync = (i % 300 == 0);
+        ASSERT_OK(db->Write(write_options, &batch));
+      }
+      finished++;
+    }));
+  }
+  int scans = 0;
+  while (finished.load() < kThreads || scans == 0) {
+    ReadOptions read_options;
+    read_options.snapshot = db->GetSnapshot();
+    for (int t = 0; t < kThreads; t++) {
+      bool missing = false;
+      for (int j = 0; j < kPerThread; j++) {
+        if (j % 3 == 1) continue;
+        std::string value;
+        Status s = db->Get(read_options, Key(j * kThreads + t), &value);
+        if (missing) {
+          ASSERT_TRUE(s.IsNotFound());
+        } else if (s.IsNotFound()) {
+          missing = true;
+        } else {
+          ASSERT_OK(s);
+        }
+      }
+    }
+    db->ReleaseSnapshot(read_options.snapshot);
+    scans++;
+  }
+  for (int t = 0; t < kThreads; t++) writers[t].join();
+
+  for (int i = 0; i < kThreads * kPerThread; i++) {
+    std::string value;
+    Status s = db->Get(ReadOptions(), Key(i), &value);
+    const int j = i / kThreads;
+    if (j % 3 == 1 && j < kPerThread - 3) {
+      ASSERT_TRUE(s.IsNotFound());
+    } else {
+      ASSERT_OK(s);
+      ASSERT_EQ(Key(i) + std::string(value_size, 'v'), value);
+    }
+  }
+  // more than the chunks hold was moved into them, which takes full
+  // chunks switched out and drained to the SSTables
+  if (kThreads * kPerThread * value_size >
+      2 * options.num_chunk_tables * options.chunk_size) {
+    ASSERT_GT(NumTables(db), 0);
+  }
+  delete db;
+  DestroyDB(dbname, Options(), nvmname);
+}
+
+TEST(ConcurrentInsertTest, DB) {
+  Options options = WriterOptions();
+  options.concurrent_memtable_write = true;
+  CheckWriters(options);
+}
+
+TEST(ConcurrentInsertTest, PipelinedWrite) {
+  Options options = WriterOptions();
+  options.pipelined_write = true;
+  CheckWriters(options);
+  options.concurrent_memtable_write = true;
+  CheckWriters(options);
+}
+
+// a pipelined group places its entries in the chunks while the next one
+// logs, and the chunks are switched out many times under both
+TEST(ConcurrentInsertTest, PipelinedZeroCopy) {
+  Options options = WriterOptions();
+  options.pipelined_write = true;
+  options.zero_copy_nvm_move = true;
+  options.write_buffer_size = 64 << 10;
+  options.num_chunk_tables = 1;
+  CheckWriters(options, 400);
+  options.concurrent_memtable_write = true;
+  CheckWriters(options, 400);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
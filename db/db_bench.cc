@@ -97,6 +97,42 @@ static int FLAGS_write_buffer_size = 0;
 
 ////////////meggie
 static int FLAGS_nvm_chunk_size = 0;
+
+// Number of NVM chunk partitions for a newly created database
+static int FLAGS_num_chunk_tables = 0;
+
+// If true, a newly created database partitions NVM chunks by key range
+static bool FLAGS_nvm_range_partition = false;
+
+// Upper bound on NVM chunk partitions when splitting hot ones, 0 disables
+static int FLAGS_max_chunk_tables = 0;
+
+// If true, writes place entries in NVM so moving to a chunk only links them
+static bool FLAGS_zero_copy_nvm_move = false;
+
+// Bytes of hot keys kept in NVM when a chunk is flushed, 0 flushes them all
+static int FLAGS_hot_key_retention_bytes = 4 << 20;
+
+// If true, keys read often from SSTables are copied into NVM
+static bool FLAGS_promote_hot_reads = false;
+
+// If true, hot keys are picked by a Count-Min sketch instead of bloom filters
+static bool FLAGS_count_min_hotness = false;
+
+// If true, a Get prefetches its table block while probing NVM
+static bool FLAGS_parallel_lookup = false;
+
+// If true, the writers of a group insert into the memtable in parallel
+static bool FLAGS_concurrent_memtable_write = false;
+
+// If true, a write group's log append overlaps the previous group's insert
+static bool FLAGS_pipelined_write = false;
+
+// If true, the write-ahead log is written to the NVM directory
+static bool FLAGS_nvm_log = false;
+
+// If true, writes go to an NVM write buffer instead of a log
+static bool FLAGS_nvm_write_buffer = false;
 ////////////meggie
 
 // Number of bytes written to each file.
@@ -1006,6 +1042,20 @@ class Benchmark {
     options.write_buffer_size = FLAGS_write_buffer_size;
     /////////////////meggie
     options.chunk_size = FLAGS_nvm_chunk_size;
+    options.num_chunk_tables = FLAGS_num_chunk_tables;
+    options.chunk_partition_type = FLAGS_nvm_range_partition ?
+        kRangePartition : kHashPartition;
+    options.max_chunk_tables = FLAGS_max_chunk_tables;
+    options.zero_copy_nvm_move = FLAGS_zero_copy_nvm_move;
+    options.hot_key_retention_bytes = FLAGS_hot_key_retention_bytes;
+    options.promote_hot_reads = FLAGS_promote_hot_reads;
+    options.hotness_estimator = FLAGS_count_min_hotness ?
+        kCountMinHotness : kMultiBloomHotness;
+    options.parallel_lookup = FLAGS_parallel_lookup;
+    options.concurrent_memtable_write = FLAGS_concurrent_memtable_write;
+    options.pipelined_write = FLAGS_pipelined_write;
+    options.nvm_log = FLAGS_nvm_log;
+    options.nvm_write_buffer = FLAGS_nvm_write_buffer;
     /////////////////meggie
     options.max_file_size = FLAGS_max_file_size;
     options.block_size = FLAGS_block_size;
@@ -1482,6 +1532,8 @@ int main(int argc, char** argv) {
   FLAGS_write_buffer_size = leveldb::Options().write_buffer_size;
   ////////////meggie
   FLAGS_nvm_chunk_size = leveldb::Options().chunk_size;
+  FLAGS_num_chunk_tables = leveldb::Options().num_chunk_tables;
+  FLAGS_max_chunk_tables = leveldb::Options().max_chunk_tables;
   ////////////meggie
   FLAGS_max_file_size = leveldb::Options().max_file_size;
   FLAGS_block_size = leveldb::Options().block_size;
@@ -1518,6 +1570,40 @@ int main(int argc, char** argv) {
     /////////////////meggie
     } else if (sscanf(argv[i], "--nvm_chunk_size=%d%c", &n, &junk) == 1){
       FLAGS_nvm_chunk_size = n * 1024L * 1024L;
+    } else if (sscanf(argv[i], "--num_chunk_tables=%d%c", &n, &junk) == 1){
+      FLAGS_num_chunk_tables = n;
+    } else if (sscanf(argv[i], "--nvm_range_partition=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_nvm_range_partition = n;
+    } else if (sscanf(argv[i], "--max_chunk_tables=%d%c", &n, &junk) == 1){
+      FLAGS_max_chunk_tables = n;
+    } else if (sscanf(argv[i], "--zero_copy_nvm_move=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_zero_copy_nvm_move = n;
+    } else if (sscanf(argv[i], "--hot_key_retention_bytes=%d%c", 
+                      &n, &junk) == 1) {
+      FLAGS_hot_key_retention_bytes = n;
+    } else if (sscanf(argv[i], "--promote_hot_reads=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_promote_hot_reads = n;
+    } else if (sscanf(argv[i], "--count_min_hotness=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_count_min_hotness = n;
+    } else if (sscanf(argv[i], "--parallel_lookup=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_parallel_lookup = n;
+    } else if (sscanf(argv[i], "--concurrent_memtable_write=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_concurrent_memtable_write = n;
+    } else if (sscanf(argv[i], "--pipelined_write=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_pipelined_write = n;
+    } else if (sscanf(argv[i], "--nvm_log=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_nvm_log = n;
+    } else if (sscanf(argv[i], "--nvm_write_buffer=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_nvm_write_buffer = n;
     /////////////////meggie
     } else if (sscanf(argv[i], "--max_file_size=%d%c", &n, &junk) == 1) {
       FLAGS_max_file_size = n;
@@ -36,9 +36,13 @@
 #include "util/mutexlock.h"
 
 //////////////////meggie
-#include "util/multi_bloomfilter.h"
+#include "util/hotness_estimator.h"
+#include "util/thread_local.h"
 #include "util/threadpool.h"
+#include "db/chunk_pool.h"
 #include "db/nvmtable.h"
+#include "db/nvmlog.h"
+#include "db/nvmwrite_buffer.h"
 #include "util/debug.h"
 //////////////////meggie
 
@@ -62,6 +66,11 @@ struct DBImpl::Writer {
   WriteBatch* batch;
   bool sync;
   bool done;
+  //////////////meggie
+  // Set by the leader once the group is logged, the writer then inserts
+  // its own batch into the memtable
+  bool insert;
+  //////////////meggie
   port::CondVar cv;
 
   explicit Writer(port::Mutex* mu) : cv(mu) { }
@@ -102,18 +111,24 @@ struct DBImpl::CompactionState {
 
 /////////////meggie
 struct DBImpl::nvmcompact_struct{
-    int index;
+    //a draining chunk
     chunkTable* cktbl;
-    chunkTable* new_cktbl;
+    bool has_hash_range;
+    uint32_t hash_lo;
+    uint32_t hash_hi;
     DBImpl *db; 
     std::vector<uint64_t> reserved_file_numbers;
     std::vector<FileMetaData> result_meta_list;
+    //of writing the chunk to level-0, the chunk is only dropped if ok
+    Status status;
 };
 
 struct DBImpl::movetable_struct{
     int index;
+    chunkTable* cktbl;
     std::vector<const char*> batches;
     DBImpl* db;
+    Status status;
 };
 /////////////meggie
 
@@ -138,6 +153,14 @@ Options SanitizeOptions(const std::string& dbname,
   
   ////////////////meggie
   ClipToRange(&result.chunk_size,  1<<20,                       1<<30);
+  ClipToRange(&result.num_chunk_tables,  1,                       64);
+  ClipToRange(&result.max_chunk_tables,  0,                       64);
+  ClipToRange(&result.spare_chunk_files, 0,                       64);
+  //the leader places the entries of its group in the write buffer
+  if (result.nvm_write_buffer) {
+    result.concurrent_memtable_write = false;
+    result.pipelined_write = false;
+  }
   ////////////////meggie
   
   if (result.info_log == nullptr) {
@@ -186,23 +209,44 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname,
       imm_(nullptr),
       logfile_(nullptr),
       logfile_number_(0),
-      ////////////meggie
-      nvmtbl_(new NVMTable(internal_comparator_)),
-      chunk_been_allocated_(false),
-      hot_bf_(new MultiHotBloomFilter()),
-      ////////////meggie
       log_(nullptr),
       seed_(0),
       tmp_batch_(new WriteBatch),
+      pending_inserts_(0),
+      insert_leader_(nullptr),
+      mem_writers_drained_signal_(&mutex_),
+      logged_sequence_(0),
       background_compaction_scheduled_(false),
+      ////////////meggie
+      background_nvm_scheduled_(false),
+      background_nvm_thread_(false),
+      background_nvm_signal_(&mutex_),
+      background_chunk_flush_scheduled_(false),
+      background_chunk_flush_thread_(false),
+      background_chunk_flush_signal_(&mutex_),
+      manifest_writing_(false),
+      manifest_written_signal_(&mutex_),
+      ////////////meggie
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
-                               &internal_comparator_)) {
+                               &internal_comparator_)),
+      ////////////meggie
+      nvmtbl_(nullptr),
+      chunk_pool_(nullptr),
+      chunk_been_allocated_(false),
+      recovered_mem_(nullptr),
+      hot_bf_(NewWriteHotnessEstimator(raw_options.hotness_estimator)),
+      read_hot_bf_(NewReadHotnessEstimator(raw_options.hotness_estimator)),
+      read_hits_(0),
+      super_version_(nullptr),
+      local_sv_(new ThreadLocalPtr) {
   has_imm_.Release_Store(nullptr);
   ///////////meggie
-  nvmtbl_->Ref();
-  thpool_ = new ThreadPool(kNumChunkTable);
-  chunk_files_.resize(kNumChunkTable);
+  //nvmtbl_ and thpool_ are sized in RecoverChunkFile, once the partition
+  //count of an existing database is known
+  chunk_meta_file_ = 0;
+  thpool_ = nullptr;
+  flush_thpool_ = nullptr;
   timer = new Timer();
   //fprintf(stderr, "nvmbuffsize:%lu\n", nvmbuff_);
   ///////////meggie
@@ -212,9 +256,17 @@ DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-null value is ok
-  while (background_compaction_scheduled_) {
+  ////////////meggie
+  // the NVM threads see shutting_down_ once woken, and exit
+  background_nvm_signal_.Signal();
+  background_chunk_flush_signal_.Signal();
+  while (background_compaction_scheduled_ || background_nvm_scheduled_ ||
+         background_chunk_flush_scheduled_ || background_nvm_thread_ ||
+         background_chunk_flush_thread_) {
     background_work_finished_signal_.Wait();
   }
+  ReleaseSuperVersions();
+  ////////////meggie
   mutex_.Unlock();
 
   if (db_lock_ != nullptr) {
@@ -226,15 +278,22 @@ DBImpl::~DBImpl() {
   if (imm_ != nullptr) imm_->Unref();
   
   ////////////meggie
-  std::string metafilename = chunkMetaFileName(dbname_nvm_, chunk_meta_file_); 
-  nvmtbl_->SaveMetadata(metafilename);
   if (nvmtbl_ != nullptr){ 
+      if (chunk_meta_file_ != 0) {
+          std::string metafilename = chunkMetaFileName(dbname_nvm_, chunk_meta_file_); 
+          nvmtbl_->SaveMetadata(metafilename);
+      }
       DEBUG_T("before delete nvmtbl_\n");
       nvmtbl_->PrintInfo();
       nvmtbl_->Unref();
   }
+  //after the chunks, so the files of those retired go back to the pool
+  delete chunk_pool_;
   delete hot_bf_;
+  delete read_hot_bf_;
   delete thpool_;
+  delete flush_thpool_;
+  delete local_sv_;
   delete timer;
   ////////////meggie
   
@@ -331,7 +390,13 @@ void DBImpl::DeleteObsoleteFiles() {
         ////////////////meggie
         case kChunkFile:
           DEBUG_T("delete obsolete:kChunkFile number:%lu\n", number);
-          keep = (find(chunk_files_.begin(), chunk_files_.end(), number) != chunk_files_.end());
+          //chunks not installed yet are in pending_outputs_
+          keep = (find(chunk_files_.begin(), chunk_files_.end(), number) != chunk_files_.end()) ||
+              (live.find(number) != live.end());
+          break;
+        case kSpareChunkFile:
+          //chunk_pool_ looks after its spares
+          keep = true;
           break;
         ////////////////meggie
         case kDescriptorFile:
@@ -362,7 +427,10 @@ void DBImpl::DeleteObsoleteFiles() {
             static_cast<int>(type),
             static_cast<unsigned long long>(number));
         /////////////////meggie
-        if(find(filenames_nvm.begin(), filenames_nvm.end(), filenames[i]) != filenames_nvm.end()){
+        if(type == kChunkFile){
+            RemoveChunkFile(dbname_nvm_ + "/" + filenames[i]);
+        }
+        else if(find(filenames_nvm.begin(), filenames_nvm.end(), filenames[i]) != filenames_nvm.end()){
             DEBUG_T("have DeleteFile\n");
             env_->DeleteFile(dbname_nvm_ + "/" + filenames[i]);
         }
@@ -389,6 +457,13 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   if (!s.ok()) {
     return s;
   }
+  //////////////meggie
+  //spares are zeroed while the db recovers
+  if (options_.spare_chunk_files > 0) {
+    chunk_pool_ = new ChunkFilePool(env_, dbname_nvm_, options_.chunk_size,
+                                    options_.spare_chunk_files);
+  }
+  //////////////meggie
 
   if (!env_->FileExists(CurrentFileName(dbname_))) {
     if (options_.create_if_missing) {
@@ -432,7 +507,6 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   /////////////////meggie
   std::vector<uint64_t> chunk_files;
   uint64_t chunkmeta_file;
-  chunk_files.resize(kNumChunkTable);
   versions_->AddChunkFiles(&chunk_files, &chunkmeta_file);
   /////////////////meggie
   uint64_t number;
@@ -445,6 +519,18 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
         logs.push_back(number);
     }
   }
+  /////////////////meggie
+  //logs written with nvm_log
+  std::vector<std::string> filenames_nvm;
+  if (dbname_nvm_ != dbname_ &&
+      env_->GetChildren(dbname_nvm_, &filenames_nvm).ok()) {
+    for (size_t i = 0; i < filenames_nvm.size(); i++) {
+      if (ParseFileName(filenames_nvm[i], &number, &type) &&
+          type == kLogFile && ((number >= min_log) || (number == prev_log)))
+        logs.push_back(number);
+    }
+  }
+  /////////////////meggie
   if (!expected.empty()) {
     char buf[50];
     snprintf(buf, sizeof(buf), "%d missing files; e.g.",
@@ -502,7 +588,15 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   // Open the log file
   std::string fname = LogFileName(dbname_, log_number);
   SequentialFile* file;
-  Status status = env_->NewSequentialFile(fname, &file);
+  ////////////////meggie
+  if (dbname_nvm_ != dbname_ && !env_->FileExists(fname))
+    fname = LogFileName(dbname_nvm_, log_number);
+  if (IsNVMWriteBuffer(fname))
+    return RecoverWriteBuffer(fname, save_manifest, edit, max_sequence);
+  const bool nvm_log = IsNVMLogFile(fname);
+  Status status = nvm_log ? NewNVMLogSequentialFile(fname, &file)
+                          : env_->NewSequentialFile(fname, &file);
+  ////////////////meggie
   if (!status.ok()) {
     MaybeIgnoreError(&status);
     return status;
@@ -523,6 +617,10 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   Log(options_.info_log, "Recovering log #%llu",
       (unsigned long long) log_number);
 
+  ////////////////meggie
+  //records of earlier logs already kept in mem_
+  const bool earlier_records = chunk_been_allocated_ && mem_ != nullptr;
+  ////////////////meggie
   // Read all the records and add to a memtable
   std::string scratch;
   Slice record;
@@ -539,9 +637,19 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     WriteBatchInternal::SetContents(&batch, record);
 
     if (mem == nullptr) {
-      mem = new MemTable(internal_comparator_);
-      mem->isNVMMemtable = false;
-      mem->Ref();
+      ////////////////meggie
+      //once chunks exist, a table flush would put the log's records below
+      //the older data in the chunks, they are kept in mem_ instead and go
+      //to the chunks with the next memtable switch
+      if (chunk_been_allocated_ && mem_ != nullptr) {
+        mem = mem_;
+      } else {
+        mem = new MemTable(internal_comparator_);
+        mem->isNVMMemtable = false;
+        mem->Ref();
+        if (chunk_been_allocated_) mem_ = recovered_mem_ = mem;
+      }
+      ////////////////meggie
     }
     ////////////////meggie
     status = WriteBatchInternal::InsertInto(&batch, mem, hot_bf_);
@@ -557,7 +665,8 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
       *max_sequence = last_seq;
     }
 
-    if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+    if (!chunk_been_allocated_ &&
+        mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
       compactions++;
       *save_manifest = true;
       status = WriteLevel0Table(mem, edit, nullptr);
@@ -569,15 +678,30 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
         break;
       }
     }
+    ////////////////meggie
+    if (chunk_been_allocated_ &&
+        mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+      compactions++;
+      mem = nullptr;
+      status = MoveRecoveredMemTable();
+      if (!status.ok()) {
+        break;
+      }
+    }
+    ////////////////meggie
   }
 
   delete file;
 
   // See if we should keep reusing the last log file.
-  if (status.ok() && options_.reuse_logs && last_log && compactions == 0) {
+  ////////////////meggie
+  //an nvm log is not appended to again, a new one is started
+  if (status.ok() && options_.reuse_logs && last_log && compactions == 0 &&
+      !nvm_log && !earlier_records && !options_.nvm_write_buffer) {
+  ////////////////meggie
     assert(logfile_ == nullptr);
     assert(log_ == nullptr);
-    assert(mem_ == nullptr);
+    assert(mem_ == nullptr || mem_ == mem);
     uint64_t lfile_size;
     if (env_->GetFileSize(fname, &lfile_size).ok() &&
         env_->NewAppendableFile(fname, &logfile_).ok()) {
@@ -596,6 +720,11 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     }
   }
 
+  ////////////////meggie
+  if (mem != nullptr && mem == mem_) {
+    mem = nullptr;
+  }
+  ////////////////meggie
   if (mem != nullptr) {
     // mem did not get reused; compact it.
     if (status.ok()) {
@@ -608,6 +737,81 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
+////////////////meggie
+Status DBImpl::RecoverWriteBuffer(const std::string& fname,
+                                  bool* save_manifest, VersionEdit* edit,
+                                  SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  NVMWriteBuffer* buffer;
+  std::vector<const char*> entries;
+  Status status = NVMWriteBuffer::Recover(fname, &buffer, &entries);
+  if (!status.ok()) {
+    MaybeIgnoreError(&status);
+    return status;
+  }
+  Log(options_.info_log, "Recovering write buffer %s, %llu entries",
+      fname.c_str(), (unsigned long long) entries.size());
+
+  // the entries are indexed where they are, and kept in mem_ once chunks
+  // exist like the records of a log
+  MemTable* mem = mem_;
+  if (!chunk_been_allocated_ || mem == nullptr) {
+    mem = new MemTable(internal_comparator_);
+    mem->isNVMMemtable = false;
+    mem->Ref();
+    if (chunk_been_allocated_) mem_ = recovered_mem_ = mem;
+  }
+  mem->SetWriteBuffer(buffer);
+  std::vector<Slice> keys;
+  for (size_t i = 0; i < entries.size(); i++) {
+    uint32_t key_length;
+    size_t kv_length;
+    const char* key_ptr = GetKVLength(entries[i], &key_length, &kv_length);
+    const SequenceNumber seq = DecodeFixed64(key_ptr + key_length - 8) >> 8;
+    if (seq > *max_sequence) {
+      *max_sequence = seq;
+    }
+    mem->Add(entries[i]);
+    if (hot_bf_ != nullptr) keys.push_back(Slice(key_ptr, key_length - 8));
+  }
+  if (!keys.empty()) hot_bf_->AddKeys(&keys[0], keys.size());
+
+  if (mem != mem_) {
+    *save_manifest = true;
+    status = WriteLevel0Table(mem, edit, nullptr);
+    mem->Unref();
+  }
+  return status;
+}
+
+// The background threads don't run yet, so the steps of
+// BackgroundNVMFlush are taken here, draining a full chunk first where the
+// NVM thread would wait for the chunk flush thread.  The logs all stay
+// until Open: entries moved before a crash are skipped by the next move of
+// a recovered memtable, or found again in level-0 if their chunk was
+// drained, under the same sequence numbers.
+Status DBImpl::MoveRecoveredMemTable() {
+  mutex_.AssertHeld();
+  assert(imm_ == nullptr);
+  assert(mem_ != nullptr && mem_ == recovered_mem_);
+  imm_ = mem_;
+  has_imm_.Release_Store(imm_);
+  mem_ = nullptr;
+  Status s = SwitchFullChunkTables();
+  if (s.ok() && nvmtbl_->FullChunkDraining(options_.chunk_size)) {
+    s = MakeRoomForImmu();
+    if (s.ok()) {
+      s = SwitchFullChunkTables();
+    }
+  }
+  if (s.ok()) {
+    MovetoNVMTable();
+    s = bg_error_;
+  }
+  return s;
+}
+////////////////meggie
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
                                 Version* base) {
   mutex_.AssertHeld();
@@ -673,14 +877,18 @@ void DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
 
   if (s.ok()) {
     // Commit to the new state
+    ////////////////meggie
+    if (imm_ == recovered_mem_) recovered_mem_ = nullptr;
+    ////////////////meggie
     imm_->Unref();
     imm_ = nullptr;
     has_imm_.Release_Store(imm_);
+    InstallSuperVersion();
     DeleteObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -768,18 +976,18 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
+  ////////////meggie
+  MaybeScheduleNVMFlush();
+  MaybeScheduleChunkFlush();
+  ////////////meggie
   if (background_compaction_scheduled_) {
     // Already scheduled
   } else if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == nullptr &&
-             manual_compaction_ == nullptr &&
-             !versions_->NeedsCompaction() &&
-             ////////////meggie
-             (nvmtbl_ && !nvmtbl_->NeedsCompaction(options_.chunk_size))) {
-             ////////////meggie
+  } else if (manual_compaction_ == nullptr &&
+             !versions_->NeedsCompaction()) {
     //fprintf(stderr, "Nothing to do\n");
     // No work to be done
   } else {
@@ -812,23 +1020,358 @@ void DBImpl::BackgroundCall() {
   background_work_finished_signal_.SignalAll();
 }
 
-void DBImpl::BackgroundCompaction() {
+/////////////meggie
+//record the chunk files of nvmtbl and where its partitions begin
+static void AddChunkPartitionsToEdit(NVMTable* nvmtbl, VersionEdit* edit){
+    std::vector<uint64_t> chunk_files;
+    nvmtbl->GetChunkFiles(&chunk_files);
+    edit->update_chunkfiles(chunk_files);
+    nvmtbl->GetDrainingChunkFiles(&chunk_files);
+    edit->SetDrainingChunkFiles(chunk_files);
+    if(nvmtbl->IsRangePartitioned()){
+        if(nvmtbl->HasRangeBoundaries()){
+            std::vector<std::string> boundaries;
+            nvmtbl->GetRangeBoundaries(&boundaries);
+            edit->SetChunkBoundaries(boundaries);
+        }
+    } else if(nvmtbl->HasHashBoundaries()){
+        std::vector<uint32_t> hash_boundaries;
+        nvmtbl->GetHashBoundaries(&hash_boundaries);
+        edit->SetChunkHashBoundaries(hash_boundaries);
+    }
+}
+
+void DBImpl::MaybeScheduleNVMFlush() {
   mutex_.AssertHeld();
+  if (background_nvm_scheduled_) {
+    // Already scheduled
+  } else if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background flushes
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (nvmtbl_ == nullptr ||
+             (imm_ == nullptr && 
+              !nvmtbl_->NeedsCompaction(options_.chunk_size) &&
+              !nvmtbl_->NeedsFilterRebuild() &&
+              pending_promotions_.empty())) {
+    // No work to be done
+  } else if (nvmtbl_->FullChunkDraining(options_.chunk_size) &&
+             !nvmtbl_->NeedsFilterRebuild() &&
+             pending_promotions_.empty()) {
+    // A full chunk must wait for its partition to finish draining,
+    // the chunk flush thread reschedules us
+  } else {
+    background_nvm_scheduled_ = true;
+    if (!background_nvm_thread_) {
+      background_nvm_thread_ = true;
+      env_->StartThread(&DBImpl::BGNVMWork, this);
+    } else {
+      background_nvm_signal_.Signal();
+    }
+  }
+}
 
-  /////////////meggie
-  if (imm_ != nullptr) {
+void DBImpl::BGNVMWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundNVMThread();
+}
+
+void DBImpl::BackgroundNVMThread() {
+  MutexLock l(&mutex_);
+  while (true) {
+    while (!background_nvm_scheduled_ && !shutting_down_.Acquire_Load()) {
+      background_nvm_signal_.Wait();
+    }
+    if (!background_nvm_scheduled_) {
+      break;
+    }
+    BackgroundNVMCall();
+  }
+  background_nvm_thread_ = false;
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::BackgroundNVMCall() {
+  mutex_.AssertHeld();
+  assert(background_nvm_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else {
+    BackgroundNVMFlush();
+  }
+
+  background_nvm_scheduled_ = false;
+
+  // A move may have filled a chunk and a flush adds level-0 files,
+  // so reschedule both kinds of work if needed.
+  MaybeScheduleCompaction();
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::BackgroundNVMFlush() {
+  mutex_.AssertHeld();
+  RebuildChunkFilters();
+  // Full chunks are switched out before imm_ is moved, so the move
+  // never lands in a chunk that is being flushed.
+  Status s = SwitchFullChunkTables();
+  if (s.ok() && imm_ != nullptr &&
+      !nvmtbl_->FullChunkDraining(options_.chunk_size)) {
     //fprintf(stderr, "start MovetoNVMTable\n");
     MovetoNVMTable();
+    s = MaybeMergeChunkTables();
+  }
+  if (s.ok()) {
+    s = PromoteHotReads();
+  }
+  if (!s.ok()) {
+    RecordBackgroundError(s);
+  }
+}
+
+// Only one in kReadHeatSampleInterval SSTable hits feeds read_hot_bf_
+static const uint64_t kReadHeatSampleInterval = 4;
+static const size_t kMaxPendingPromotions = 1024;
+
+bool DBImpl::SampleReadHit(const Slice& user_key) {
+  if (read_hits_.fetch_add(1, std::memory_order_relaxed) %
+          kReadHeatSampleInterval != 0) {
+    return false;
+  }
+  read_hot_bf_->AddKey(user_key);
+  return read_hot_bf_->CheckHot(user_key);
+}
+
+void DBImpl::QueueReadPromotion(const Slice& user_key,
+                                SequenceNumber sequence) {
+  mutex_.AssertHeld();
+  if (pending_promotions_.size() >= kMaxPendingPromotions) {
     return;
   }
-  
-  if(nvmtbl_ && nvmtbl_->NeedsCompaction(options_.chunk_size)){
+  PromotedRead read;
+  read.user_key = user_key.ToString();
+  read.sequence = sequence;
+  pending_promotions_.push_back(read);
+  MaybeScheduleNVMFlush();
+}
+
+// A promoted entry keeps the sequence number it has in the SSTables, so
+// reads at any snapshot get what the SSTables would give them.  It must
+// not land below a newer entry of its key, which Get could otherwise find
+// after it: a key with any entry in mem_, imm_ or NVM is skipped, and so
+// is one rewritten in the SSTables since it was read.  Newer entries only
+// reach level-0 through chunks this thread switches out, so none can get
+// past the copy while it is made unlocked.
+Status DBImpl::PromoteHotReads() {
+  mutex_.AssertHeld();
+  if (pending_promotions_.empty()) {
+    return Status::OK();
+  }
+  std::vector<PromotedRead> reads(pending_promotions_.begin(),
+                                  pending_promotions_.end());
+  pending_promotions_.clear();
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  NVMTable* nvmtbl = nvmtbl_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != nullptr) imm->Ref();
+  nvmtbl->Ref();
+  current->Ref();
+  mutex_.Unlock();
+
+  std::set<std::string> seen;
+  std::deque<std::string> entries;
+  std::vector<std::vector<const char*> > kvitems(nvmtbl->NumChunkTables());
+  std::vector<size_t> bytes(nvmtbl->NumChunkTables(), 0);
+  for (size_t i = 0; i < reads.size(); i++) {
+    const Slice user_key(reads[i].user_key);
+    if (!seen.insert(reads[i].user_key).second) {
+      continue;
+    }
+    LookupKey lkey(user_key, kMaxSequenceNumber);
+    std::string value;
+    Status s;
+    if (mem->Get(lkey, &value, &s) ||
+        (imm != nullptr && imm->Get(lkey, &value, &s)) ||
+        nvmtbl->Get(lkey, &value, &s)) {
+      continue;
+    }
+    Version::GetStats stats;
+    s = current->Get(ReadOptions(), lkey, &value, &stats);
+    if (!s.ok() || stats.found_sequence != reads[i].sequence) {
+      continue;
+    }
+    const int index = nvmtbl->GetChunkTableIndex(user_key);
+    const size_t internal_key_size = user_key.size() + 8;
+    const size_t encoded_len = VarintLength(internal_key_size) +
+        internal_key_size + VarintLength(value.size()) + value.size();
+    if (nvmtbl->cktables_[index]->ApproximateNVMUsage() + bytes[index] +
+        encoded_len > options_.chunk_size) {
+      continue;
+    }
+    std::string entry;
+    PutVarint32(&entry, internal_key_size);
+    entry.append(user_key.data(), user_key.size());
+    PutFixed64(&entry, (reads[i].sequence << 8) | kTypeValue);
+    PutVarint32(&entry, value.size());
+    entry.append(value);
+    entries.push_back(entry);
+    kvitems[index].push_back(entries.back().data());
+    bytes[index] += encoded_len;
+  }
+  Status status;
+  for (int i = 0; i < nvmtbl->NumChunkTables() && status.ok(); i++) {
+    if (!kvitems[i].empty()) {
+      DEBUG_T("promote %zu hot reads to chunk %d\n", kvitems[i].size(), i);
+      status = nvmtbl->cktables_[i]->AddBatch(kvitems[i]);
+    }
+  }
+
+  mutex_.Lock();
+  mem->Unref();
+  if (imm != nullptr) imm->Unref();
+  nvmtbl->Unref();
+  current->Unref();
+  return status;
+}
+
+// Chunks recovered without a usable saved filter are read without one
+// until it has been rebuilt here.  This thread is the only one adding to
+// chunks, so the rebuild runs unlocked.
+void DBImpl::RebuildChunkFilters() {
+  mutex_.AssertHeld();
+  std::vector<chunkTable*> chunks;
+  nvmtbl_->GetChunksWithoutFilter(&chunks);
+  if (chunks.empty()) {
+    return;
+  }
+  for (size_t i = 0; i < chunks.size(); i++) {
+    chunks[i]->Ref();
+  }
+  mutex_.Unlock();
+  for (size_t i = 0; i < chunks.size(); i++) {
+    DEBUG_T("rebuild filter of chunk %llu\n",
+            (unsigned long long)chunks[i]->GetChunkNumber());
+    chunks[i]->RebuildFilter();
+  }
+  mutex_.Lock();
+  for (size_t i = 0; i < chunks.size(); i++) {
+    chunks[i]->Unref();
+  }
+}
+
+void DBImpl::MaybeScheduleChunkFlush() {
+  mutex_.AssertHeld();
+  if (background_chunk_flush_scheduled_) {
+    // Already scheduled
+  } else if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background flushes
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (nvmtbl_ == nullptr || !nvmtbl_->HasDrainingChunkTables()) {
+    // No work to be done
+  } else {
+    background_chunk_flush_scheduled_ = true;
+    if (!background_chunk_flush_thread_) {
+      background_chunk_flush_thread_ = true;
+      env_->StartThread(&DBImpl::BGChunkFlushWork, this);
+    } else {
+      background_chunk_flush_signal_.Signal();
+    }
+  }
+}
+
+void DBImpl::BGChunkFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundChunkFlushThread();
+}
+
+void DBImpl::BackgroundChunkFlushThread() {
+  MutexLock l(&mutex_);
+  while (true) {
+    while (!background_chunk_flush_scheduled_ &&
+           !shutting_down_.Acquire_Load()) {
+      background_chunk_flush_signal_.Wait();
+    }
+    if (!background_chunk_flush_scheduled_) {
+      break;
+    }
+    BackgroundChunkFlushCall();
+  }
+  background_chunk_flush_thread_ = false;
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::BackgroundChunkFlushCall() {
+  mutex_.AssertHeld();
+  assert(background_chunk_flush_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else {
     start_timer(MAKE_ROOM_FOR_IMMUTABLE);
-    MakeRoomForImmu();
+    Status s = MakeRoomForImmu();
     record_timer(MAKE_ROOM_FOR_IMMUTABLE);
-    return;
+    if (s.ok() || shutting_down_.Acquire_Load()) {
+      // A flush cut short by shutting down leaves its chunks draining,
+      // they are flushed again when the db is opened
+    } else {
+      RecordBackgroundError(s);
+    }
   }
-  /////////////meggie
+
+  background_chunk_flush_scheduled_ = false;
+
+  // A partition that stopped draining may have a full chunk waiting to be
+  // switched out, and the flush added level-0 files.
+  MaybeScheduleCompaction();
+  background_work_finished_signal_.SignalAll();
+}
+
+Status DBImpl::ApplyNVMTableChange(VersionEdit* edit,
+        const std::function<void(NVMTable*)>& change) {
+  mutex_.AssertHeld();
+  while (manifest_writing_) {
+    manifest_written_signal_.Wait();
+  }
+  // Clone only once we are the MANIFEST writer, so a change made by the
+  // other NVM thread in the meantime is not lost.
+  manifest_writing_ = true;
+  NVMTable* nvmtbl = nvmtbl_->Clone();
+  nvmtbl->Ref();
+  change(nvmtbl);
+  AddChunkPartitionsToEdit(nvmtbl, edit);
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  if (s.ok()) {
+    InstallNVMTable(nvmtbl);
+  } else {
+    nvmtbl->Unref();
+  }
+  manifest_writing_ = false;
+  manifest_written_signal_.SignalAll();
+  return s;
+}
+
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (manifest_writing_) {
+    manifest_written_signal_.Wait();
+  }
+  manifest_writing_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  if (s.ok()) {
+    InstallSuperVersion();
+  }
+  manifest_writing_ = false;
+  manifest_written_signal_.SignalAll();
+  return s;
+}
+/////////////meggie
+
+void DBImpl::BackgroundCompaction() {
+  mutex_.AssertHeld();
+
   Compaction* c;
   bool is_manual = (manual_compaction_ != nullptr);
   InternalKey manual_end;
@@ -859,7 +1402,7 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
                        f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+    status = LogAndApply(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
@@ -1019,7 +1562,7 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
         level + 1,
         out.number, out.file_size, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return LogAndApply(compact->compaction->edit());
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -1052,21 +1595,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
-    // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != nullptr) {
-      const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != nullptr) {
-        /////////////meggie
-        //CompactMemTable();
-        MovetoNVMTable();
-        /////////////meggie
-        // Wake up MakeRoomForWrite() if necessary.
-        background_work_finished_signal_.SignalAll();
-      }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
-    }
+    /////////////meggie
+    // imm_ is moved to NVM by the NVM flush thread, see BackgroundNVMFlush()
+    /////////////meggie
     Slice key = input->key();
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != nullptr) {
@@ -1200,9 +1731,13 @@ struct IterState {
   Version* const version GUARDED_BY(mu);
   MemTable* const mem GUARDED_BY(mu);
   MemTable* const imm GUARDED_BY(mu);
+  ///////////meggie
+  NVMTable* const nvmtbl GUARDED_BY(mu);
+  ///////////meggie
 
-  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
-      : mu(mutex), version(version), mem(mem), imm(imm) { }
+  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, 
+            NVMTable* nvmtbl, Version* version)
+      : mu(mutex), version(version), mem(mem), imm(imm), nvmtbl(nvmtbl) { }
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
@@ -1210,6 +1745,9 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
   state->mu->Lock();
   state->mem->Unref();
   if (state->imm != nullptr) state->imm->Unref();
+  ///////////meggie
+  if (state->nvmtbl != nullptr) state->nvmtbl->Unref();
+  ///////////meggie
   state->version->Unref();
   state->mu->Unlock();
   delete state;
@@ -1231,12 +1769,20 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
     list.push_back(imm_->NewIterator());
     imm_->Ref();
   }
+  ///////////meggie
+  // the chunks, draining ones included, stay mapped while nvmtbl_ is held
+  if (nvmtbl_ != nullptr) {
+    list.push_back(nvmtbl_->NewIterator());
+    nvmtbl_->Ref();
+  }
+  ///////////meggie
   versions_->current()->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
   versions_->current()->Ref();
 
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
+  IterState* cleanup = new IterState(&mutex_, mem_, imm_, nvmtbl_,
+                                     versions_->current());
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
 
   *seed = ++seed_;
@@ -1255,66 +1801,284 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
-Status DBImpl::Get(const ReadOptions& options,
-                   const Slice& key,
-                   std::string* value) {
-  Status s;
+int DBImpl::TEST_NumChunkTables() {
   MutexLock l(&mutex_);
-  SequenceNumber snapshot;
-  if (options.snapshot != nullptr) {
-    snapshot =
-        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
-  } else {
-    snapshot = versions_->LastSequence();
-  }
+  return nvmtbl_->NumChunkTables();
+}
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
+Status DBImpl::TEST_WaitForNVMWork() {
+  MutexLock l(&mutex_);
+  while ((background_nvm_scheduled_ || background_chunk_flush_scheduled_) &&
+         bg_error_.ok()) {
+    background_work_finished_signal_.Wait();
+  }
+  return bg_error_;
+}
+
+Status DBImpl::TEST_NVMGet(const Slice& key, std::string* value) {
+  MutexLock l(&mutex_);
+  LookupKey lkey(key, versions_->LastSequence());
+  Status s;
+  if (!nvmtbl_->Get(lkey, value, &s)) {
+    s = Status::NotFound(Slice());
+  }
+  return s;
+}
+
+/////////meggie
+// what a thread's slot in local_sv_ holds while it reads with the super
+// version it cached
+static char sv_in_use;
+static void* const kSVInUse = &sv_in_use;
+
+void DBImpl::InstallSuperVersion() {
+  mutex_.AssertHeld();
+  if (mem_ == nullptr) {
+    // still opening, Open() installs the first one
+    return;
+  }
+  SuperVersion* sv = new SuperVersion;
+  sv->mem = mem_;
+  sv->imm = imm_;
+  sv->nvmtbl = nvmtbl_;
+  sv->current = versions_->current();
+  sv->mem->Ref();
+  if (sv->imm != nullptr) sv->imm->Ref();
+  if (sv->nvmtbl != nullptr) sv->nvmtbl->Ref();
+  sv->current->Ref();
+  sv->refs.store(1, std::memory_order_relaxed);
+  ReleaseSuperVersions();
+  super_version_ = sv;
+}
+
+// Drops the installed super version and every reference the threads
+// cache.  A thread that is reading with its cached one finds kSVInUse
+// gone when it is done, and drops its reference then.
+void DBImpl::ReleaseSuperVersions() {
+  mutex_.AssertHeld();
+  std::vector<void*> cached;
+  local_sv_->Scrape(&cached, nullptr);
+  for (size_t i = 0; i < cached.size(); i++) {
+    if (cached[i] != kSVInUse) {
+      UnrefSuperVersion(reinterpret_cast<SuperVersion*>(cached[i]));
+    }
+  }
+  if (super_version_ != nullptr) {
+    UnrefSuperVersion(super_version_);
+    super_version_ = nullptr;
+  }
+}
+
+DBImpl::SuperVersion* DBImpl::GetAndRefSuperVersion() {
+  // a cached one is the installed one, older ones are scraped
+  SuperVersion* sv =
+      reinterpret_cast<SuperVersion*>(local_sv_->Swap(kSVInUse));
+  if (sv != nullptr) {
+    return sv;
+  }
+  MutexLock l(&mutex_);
+  sv = super_version_;
+  assert(sv->mem == mem_ && sv->imm == imm_ && sv->nvmtbl == nvmtbl_ &&
+         sv->current == versions_->current());
+  sv->refs.fetch_add(1, std::memory_order_relaxed);
+  return sv;
+}
+
+void DBImpl::ReturnSuperVersion(SuperVersion* sv) {
+  void* expected = kSVInUse;
+  if (local_sv_->CompareAndSwap(sv, expected)) {
+    // kept for the next read of this thread
+    return;
+  }
+  // replaced while it was read, or this thread has no slot
+  if (sv->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    MutexLock l(&mutex_);
+    FreeSuperVersion(sv);
+  }
+}
+
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  if (sv->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    FreeSuperVersion(sv);
+  }
+}
+
+void DBImpl::FreeSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  sv->mem->Unref();
+  if (sv->imm != nullptr) sv->imm->Unref();
+  if (sv->nvmtbl != nullptr) sv->nvmtbl->Unref();
+  sv->current->Unref();
+  delete sv;
+}
+/////////meggie
+
+Status DBImpl::Get(const ReadOptions& options,
+                   const Slice& key,
+                   std::string* value) {
+  Status s;
   /////////meggie
-  if(nvmtbl_ != nullptr)
-      nvmtbl_->Ref();
+  // mutex_ is only taken when the read has to pick a file to compact or
+  // promote the key into NVM, or after the super version changed
+  SuperVersion* sv = GetAndRefSuperVersion();
   /////////meggie
-  if (imm != nullptr) imm->Ref();
-  current->Ref();
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = sv->mem;
+  MemTable* imm = sv->imm;
+  NVMTable* nvmtbl = sv->nvmtbl;
+  Version* current = sv->current;
 
   bool have_stat_update = false;
   Version::GetStats stats;
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
-      // Done
-    ///////////////////meggie
-    }else if(nvmtbl_->Get(lkey, value, &s)){
+  // First look in the memtable, then in the immutable memtable (if any).
+  LookupKey lkey(key, snapshot);
+  if (mem->Get(lkey, value, &s)) {
     // Done
-    ///////////////////meggie
-    } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
-    }
-    mutex_.Lock();
+  } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
+    // Done
+  ///////////////////meggie
+  }else if(NVMGet(options, nvmtbl, current, lkey, value, &s)){
+  // Done
+  ///////////////////meggie
+  } else {
+    s = current->Get(options, lkey, value, &stats);
+    have_stat_update = true;
   }
 
-  if (have_stat_update && current->UpdateStats(stats)) {
-    MaybeScheduleCompaction();
-  }
-  mem->Unref();
-  if (imm != nullptr) imm->Unref();
   /////////meggie
-  if(nvmtbl_ != nullptr)
-    nvmtbl_->Unref();
+  if (have_stat_update) {
+    const bool pick = current->ChargeSeek(stats);
+    const bool promote = s.ok() && options_.promote_hot_reads &&
+                         nvmtbl != nullptr && SampleReadHit(key);
+    if (pick || promote) {
+      MutexLock l(&mutex_);
+      if (pick && current->PickSeekCompaction(stats)) {
+        MaybeScheduleCompaction();
+      }
+      if (promote) {
+        QueueReadPromotion(key, stats.found_sequence);
+      }
+    }
+  }
+  ReturnSuperVersion(sv);
   /////////meggie
-  current->Unref();
   return s;
 }
 
+/////////meggie
+namespace {
+struct KeyIndexLess {
+  const Comparator* ucmp;
+  const std::vector<Slice>* keys;
+  bool operator()(size_t a, size_t b) const {
+    return ucmp->Compare((*keys)[a], (*keys)[b]) < 0;
+  }
+};
+}  // namespace
+
+std::vector<Status> DBImpl::MultiGet(const ReadOptions& options,
+                                     const std::vector<Slice>& keys,
+                                     std::vector<std::string>* values) {
+  const size_t n = keys.size();
+  values->resize(n);
+  std::vector<Status> statuses(n);
+  if (n == 0) {
+    return statuses;
+  }
+
+  SuperVersion* sv = GetAndRefSuperVersion();
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = sv->mem;
+  MemTable* imm = sv->imm;
+  NVMTable* nvmtbl = sv->nvmtbl;
+  Version* current = sv->current;
+
+  // every tier is searched in key order, so each walk picks up where
+  // the previous key left it and each table block is read once
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = i;
+  KeyIndexLess less;
+  less.ucmp = user_comparator();
+  less.keys = &keys;
+  std::sort(order.begin(), order.end(), less);
+
+  std::deque<LookupKey> lkeys;
+  std::vector<Version::GetRequest> reqs(n);
+  MemTable::Finger mem_finger;
+  MemTable::Finger imm_finger;
+  NVMTable::Finger nvm_finger;
+  for (size_t j = 0; j < n; j++) {
+    const size_t i = order[j];
+    lkeys.emplace_back(keys[i], snapshot);
+    Version::GetRequest* req = &reqs[j];
+    req->key = &lkeys.back();
+    req->value = &(*values)[i];
+    req->done =
+        mem->Get(*req->key, req->value, &req->status, &mem_finger) ||
+        (imm != nullptr &&
+         imm->Get(*req->key, req->value, &req->status, &imm_finger)) ||
+        (nvmtbl != nullptr &&
+         nvmtbl->Get(*req->key, req->value, &req->status, &nvm_finger));
+  }
+  std::vector<bool> searched(n);
+  for (size_t j = 0; j < n; j++) searched[j] = !reqs[j].done;
+  current->MultiGet(options, &reqs[0], n);
+
+  // the lock is taken once, if any key needs it
+  std::vector<bool> pick(n), promote(n);
+  bool need_lock = false;
+  for (size_t j = 0; j < n; j++) {
+    statuses[order[j]] = reqs[j].status;
+    if (!searched[j]) continue;
+    pick[j] = current->ChargeSeek(reqs[j].stats);
+    promote[j] = reqs[j].status.ok() && options_.promote_hot_reads &&
+                 nvmtbl != nullptr && SampleReadHit(keys[order[j]]);
+    need_lock = need_lock || pick[j] || promote[j];
+  }
+  if (need_lock) {
+    MutexLock l(&mutex_);
+    for (size_t j = 0; j < n; j++) {
+      if (pick[j] && current->PickSeekCompaction(reqs[j].stats)) {
+        MaybeScheduleCompaction();
+      }
+      if (promote[j]) {
+        QueueReadPromotion(keys[order[j]], reqs[j].stats.found_sequence);
+      }
+    }
+  }
+  ReturnSuperVersion(sv);
+  return statuses;
+}
+
+bool DBImpl::NVMGet(const ReadOptions& options, NVMTable* nvmtbl,
+                    Version* current, const LookupKey& lkey,
+                    std::string* value, Status* s) {
+  // the chunk is walked while the table block is on its way. A hit wins
+  // whatever the tables hold, chunk entries are never older than theirs.
+  // Where the chunk filters rule the key out there is nothing to overlap
+  if (options_.parallel_lookup && nvmtbl->MaybeContains(lkey.user_key())) {
+    current->PrefetchForGet(options, lkey);
+  }
+  return nvmtbl->Get(lkey, value, s);
+}
+/////////meggie
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1358,23 +2122,59 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   w.batch = my_batch;
   w.sync = options.sync;
   w.done = false;
+  w.insert = false;
 
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  ////////////////meggie
+  // a pipelined group leaves writers_ before its writers are done
+  while (!w.done && !w.insert &&
+         (writers_.empty() || &w != writers_.front())) {
     w.cv.Wait();
   }
+  if (w.insert) {
+    // mem_ stays put until all of the group has inserted
+    MemTable* mem = mem_;
+    mutex_.Unlock();
+    w.status = WriteBatchInternal::InsertInto(my_batch, mem, hot_bf_, true);
+    mutex_.Lock();
+    w.insert = false;
+    if (--pending_inserts_ == 0) {
+      insert_leader_->cv.Signal();
+    }
+    while (!w.done) {
+      w.cv.Wait();
+    }
+  }
+  ////////////////meggie
   if (w.done) {
     return w.status;
   }
 
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(my_batch == nullptr);
-  uint64_t last_sequence = versions_->LastSequence();
+  ////////////////meggie
+  uint64_t last_sequence =
+      std::max(versions_->LastSequence(), logged_sequence_);
+  const bool pipelined = options_.pipelined_write;
+  std::vector<Writer*> group;
+  ////////////////meggie
   Writer* last_writer = &w;
   if (status.ok() && my_batch != nullptr) {  // nullptr batch is for compactions
     WriteBatch* updates = BuildBatchGroup(&last_writer);
     WriteBatchInternal::SetSequence(updates, last_sequence + 1);
+    ////////////////meggie
+    for (std::deque<Writer*>::iterator iter = writers_.begin(); ; ++iter) {
+      group.push_back(*iter);
+      if (*iter == last_writer) break;
+    }
+    //the writers insert their own batches rather than the group's, which
+    //a pipelined group gives back to the next one
+    const bool concurrent =
+        options_.concurrent_memtable_write && updates == tmp_batch_;
+    if ((concurrent || pipelined) && updates == tmp_batch_)
+      SetGroupSequences(last_writer, last_sequence + 1);
+    ////////////////meggie
     last_sequence += WriteBatchInternal::Count(updates);
 
     // Add to log and apply to memtable.  We can release the lock
@@ -1382,20 +2182,39 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     // and protects against concurrent loggers and concurrent writes
     // into mem_.
     {
+      ////////////////meggie
+      //pin the partition layout the entries are placed by. A pipelined
+      //group pins it in InsertPipelinedGroup(), once the groups before it
+      //no longer place entries by the pinned layouts
+      if(options_.zero_copy_nvm_move && !pipelined)
+        mem_->SetNVMTable(nvmtbl_);
+      ////////////////meggie
       mutex_.Unlock();
-      status = log_->AddRecord(WriteBatchInternal::Contents(updates));
+      ////////////////meggie
       bool sync_error = false;
-      if (status.ok() && options.sync) {
-        status = logfile_->Sync();
-        if (!status.ok()) {
-          sync_error = true;
+      if (options_.nvm_write_buffer) {
+        // the entries are the log, the group is durable once committed
+        NVMWriteBuffer* buffer = mem_->GetWriteBuffer();
+        buffer->BeginGroup();
+        status = WriteBatchInternal::InsertInto(updates, mem_, hot_bf_);
+        Status commit = buffer->Commit(options.sync);
+        if (status.ok()) status = commit;
+      } else {
+        status = log_->AddRecord(WriteBatchInternal::Contents(updates));
+        if (status.ok() && options.sync) {
+          status = logfile_->Sync();
+          if (!status.ok()) {
+            sync_error = true;
+          }
         }
       }
-      if (status.ok()) {
-        ////////////////meggie
-        status = WriteBatchInternal::InsertInto(updates, mem_, hot_bf_);
-        ////////////////meggie
+      if (status.ok() && !pipelined && !options_.nvm_write_buffer) {
+        if (concurrent)
+          status = InsertGroupConcurrently(group);
+        else
+          status = WriteBatchInternal::InsertInto(updates, mem_, hot_bf_);
       }
+      ////////////////meggie
       mutex_.Lock();
       if (sync_error) {
         // The state of the log file is indeterminate: the log record we
@@ -1406,6 +2225,25 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     }
     if (updates == tmp_batch_) tmp_batch_->Clear();
 
+    ////////////////meggie
+    if (pipelined) {
+      logged_sequence_ = last_sequence;
+      // the next group may log while this one inserts
+      writers_.erase(writers_.begin(), writers_.begin() + group.size());
+      if (!writers_.empty()) {
+        writers_.front()->cv.Signal();
+      }
+      if (status.ok()) {
+        status = InsertPipelinedGroup(group, last_sequence);
+      }
+      for (size_t i = 1; i < group.size(); i++) {
+        group[i]->status = status;
+        group[i]->done = true;
+        group[i]->cv.Signal();
+      }
+      return status;
+    }
+    ////////////////meggie
     versions_->SetLastSequence(last_sequence);
   }
 
@@ -1428,6 +2266,123 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   return status;
 }
 
+//////////////////meggie
+Status DBImpl::NewLogFile(uint64_t number, WritableFile** file) {
+  if (!options_.nvm_log)
+    return env_->NewWritableFile(LogFileName(dbname_, number), file);
+  // a log holds about a memtable of records, it grows if it needs more
+  return NVMLogFile::Open(LogFileName(dbname_nvm_, number),
+                         options_.write_buffer_size + (1 << 20), file);
+}
+
+// An upper bound of the bytes the memtable entries of batch take, an
+// entry's key length and tag take at most 8 bytes more than its record
+static size_t WriteBufferBytes(const WriteBatch* batch) {
+  return WriteBatchInternal::ByteSize(batch) +
+         8 * WriteBatchInternal::Count(batch);
+}
+
+Status DBImpl::NewWriteBuffer(uint64_t number, NVMWriteBuffer** buffer) {
+  mutex_.AssertHeld();
+  // a buffer doesn't grow, the memtable is switched before it fills
+  size_t capacity = options_.write_buffer_size + (1 << 20);
+  if (!writers_.empty() && writers_.front()->batch != nullptr) {
+    capacity += WriteBufferBytes(writers_.front()->batch);
+  }
+  return NVMWriteBuffer::Create(LogFileName(dbname_nvm_, number), capacity,
+                                buffer);
+}
+
+bool DBImpl::WriteBufferHasRoom() {
+  mutex_.AssertHeld();
+  if (!options_.nvm_write_buffer) return true;
+  const WriteBatch* batch = writers_.front()->batch;
+  return batch == nullptr ||
+         mem_->GetWriteBuffer()->Room() >= WriteBufferBytes(batch);
+}
+
+void DBImpl::SetGroupSequences(Writer* last_writer, SequenceNumber seq) {
+  mutex_.AssertHeld();
+  for (std::deque<Writer*>::iterator iter = writers_.begin(); ; ++iter) {
+    Writer* w = *iter;
+    if (w->batch != nullptr) {
+      WriteBatchInternal::SetSequence(w->batch, seq);
+      seq += WriteBatchInternal::Count(w->batch);
+    }
+    if (w == last_writer) break;
+  }
+}
+
+Status DBImpl::InsertGroupConcurrently(const std::vector<Writer*>& group) {
+  mutex_.Lock();
+  assert(pending_inserts_ == 0);
+  Writer* leader = group[0];
+  insert_leader_ = leader;
+  for (size_t i = 1; i < group.size(); i++) {
+    if (group[i]->batch != nullptr) {
+      group[i]->insert = true;
+      pending_inserts_++;
+      group[i]->cv.Signal();
+    }
+  }
+  MemTable* mem = mem_;
+  mutex_.Unlock();
+
+  Status status = WriteBatchInternal::InsertInto(leader->batch, mem,
+                                                 hot_bf_, true);
+
+  mutex_.Lock();
+  while (pending_inserts_ > 0) {
+    leader->cv.Wait();
+  }
+  insert_leader_ = nullptr;
+  for (size_t i = 1; i < group.size() && status.ok(); i++) {
+    status = group[i]->status;
+  }
+  mutex_.Unlock();
+  return status;
+}
+
+Status DBImpl::InsertPipelinedGroup(const std::vector<Writer*>& group,
+                                    SequenceNumber last_sequence) {
+  mutex_.AssertHeld();
+  Writer* leader = group[0];
+  mem_writers_.push_back(leader);
+  while (leader != mem_writers_.front()) {
+    leader->cv.Wait();
+  }
+
+  // mem_ is not switched while groups wait here, see MakeRoomForWrite()
+  if (options_.zero_copy_nvm_move) {
+    mem_->SetNVMTable(nvmtbl_);
+  }
+  Status status;
+  if (options_.concurrent_memtable_write && group.size() > 1) {
+    mutex_.Unlock();
+    status = InsertGroupConcurrently(group);
+    mutex_.Lock();
+  } else {
+    MemTable* mem = mem_;
+    mutex_.Unlock();
+    for (size_t i = 0; i < group.size() && status.ok(); i++) {
+      if (group[i]->batch != nullptr)
+        status = WriteBatchInternal::InsertInto(group[i]->batch, mem,
+                                                hot_bf_);
+    }
+    mutex_.Lock();
+  }
+
+  versions_->SetLastSequence(last_sequence);
+  mem_writers_.pop_front();
+  if (!mem_writers_.empty()) {
+    mem_writers_.front()->cv.Signal();
+  } else {
+    mem_writers_drained_signal_.SignalAll();
+  }
+  return status;
+}
+//////////////////meggie
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-null batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1447,6 +2402,15 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
     max_size = size + (128<<10);
   }
 
+  ////////////////meggie
+  // the group's entries must fit in the write buffer
+  size_t buffer_bytes = 0, buffer_room = 0;
+  if (options_.nvm_write_buffer) {
+    buffer_bytes = WriteBufferBytes(first->batch);
+    buffer_room = mem_->GetWriteBuffer()->Room();
+  }
+  ////////////////meggie
+
   *last_writer = first;
   std::deque<Writer*>::iterator iter = writers_.begin();
   ++iter;  // Advance past "first"
@@ -1463,6 +2427,12 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
         // Do not make batch too big
         break;
       }
+      ////////////////meggie
+      if (options_.nvm_write_buffer) {
+        buffer_bytes += WriteBufferBytes(w->batch);
+        if (buffer_bytes > buffer_room) break;
+      }
+      ////////////////meggie
 
       // Append to *result
       if (result == first->batch) {
@@ -1497,42 +2467,100 @@ void DBImpl::printChunkFileNumbers(){
 
 Status DBImpl::UpdateNVMTable(std::map<int, chunkTable*>& update_chunks,
         bool recovery){
-    if(!recovery){
-        std::map<int, chunkTable*>::iterator iter;
-        for(iter = update_chunks.begin(); iter != update_chunks.end(); iter++){
-            chunk_files_[iter->first] = iter->second->GetChunkNumber();
-        }
+    //nobody else sees nvmtbl_ during recovery, update it in place
+    if(recovery){
+        nvmtbl_->UpdateChunkTables(update_chunks);
+        return Status::OK();
     }
-    nvmtbl_->UpdateChunkTables(update_chunks);
+    NVMTable* nvmtbl = nvmtbl_->Clone();
+    nvmtbl->Ref();
+    nvmtbl->UpdateChunkTables(update_chunks);
+    InstallNVMTable(nvmtbl);
     return Status::OK();
 }
 
-chunkTable* DBImpl::CreateNewchunkTable(){
+//takes over the caller's reference to nvmtbl
+void DBImpl::InstallNVMTable(NVMTable* nvmtbl){
+    mutex_.AssertHeld();
+    nvmtbl_->Unref();
+    nvmtbl_ = nvmtbl;
+    //the live chunk files, draining ones included
+    std::vector<uint64_t> draining_chunk_files;
+    nvmtbl_->GetChunkFiles(&chunk_files_);
+    nvmtbl_->GetDrainingChunkFiles(&draining_chunk_files);
+    for(size_t i = 0; i < draining_chunk_files.size(); i++){
+        if(draining_chunk_files[i] != 0)
+            chunk_files_.push_back(draining_chunk_files[i]);
+    }
+    InstallSuperVersion();
+}
+
+std::string DBImpl::NewChunkFile(uint64_t number){
+    std::string fname = chunkFileName(dbname_nvm_, number);
+    //without a spare the arena creates the file on its first allocation
+    if(chunk_pool_ != nullptr && !chunk_pool_->Take(fname))
+        DEBUG_T("no spare chunk file for %s\n", fname.c_str());
+    return fname;
+}
+
+void DBImpl::RemoveChunkFile(const std::string& fname){
+    if(chunk_pool_ != nullptr)
+        chunk_pool_->Retire(fname);
+    else
+        env_->DeleteFile(fname);
+}
+
+void DBImpl::RegisterChunkArena(ArenaNVM* arena){
+    if(chunk_pool_ != nullptr)
+        chunk_pool_->Register(arena);
+}
+
+Status DBImpl::CreateNewchunkTable(chunkTable** cktbl){
     uint64_t new_chunk_number = versions_->NewFileNumber();
-    std::string chunkfilename = chunkFileName(dbname_nvm_, new_chunk_number);
+    //kept until the chunk is installed or dropped
+    pending_outputs_.insert(new_chunk_number);
+    std::string chunkfilename = NewChunkFile(new_chunk_number);
     ArenaNVM* arena = new ArenaNVM(&chunkfilename, options_.chunk_size, false);
-    chunkTable* cktbl = nvmtbl_->GetNewChunkTable(arena, false);
-    cktbl->SetChunkNumber(new_chunk_number);
-    return cktbl;
+    //mapped before the chunk puts its skiplist head there
+    if(!arena->MakeRoom(0)){
+        delete arena;
+        pending_outputs_.erase(new_chunk_number);
+        RemoveChunkFile(chunkfilename);
+        return Status::IOError("cannot map chunk file", chunkfilename);
+    }
+    RegisterChunkArena(arena);
+    *cktbl = nvmtbl_->GetNewChunkTable(arena, false);
+    (*cktbl)->SetChunkNumber(new_chunk_number);
+    return Status::OK();
+}
+
+//drops the reference taken on a chunk made for an NVMTable change. A
+//chunk the change failed to install is freed with its file
+void DBImpl::ReleaseNewChunkTable(chunkTable* cktbl, bool installed){
+    mutex_.AssertHeld();
+    const uint64_t number = cktbl->GetChunkNumber();
+    pending_outputs_.erase(number);
+    cktbl->Unref();
+    if(!installed)
+        RemoveChunkFile(chunkFileName(dbname_nvm_, number));
 }
 
 void DBImpl::AddToNVMTable(void* args){
     movetable_struct* movetable = reinterpret_cast<movetable_struct*>(args);
     DBImpl* db = movetable->db;
     
-    db->AddToEachChunkTable(movetable->index, movetable->batches);
+    movetable->status = 
+        db->AddToEachChunkTable(movetable->cktbl, movetable->batches);
 }
 
-void DBImpl::AddToEachChunkTable(int index, 
+Status DBImpl::AddToEachChunkTable(chunkTable* cktbl, 
         std::vector<const char*>& batches){
-    chunkTable* cktbl = nvmtbl_->cktables_[index]; 
-    for(int i = 0; i < batches.size(); i++){     
-        cktbl->Add(batches[i]);
-    }
+    return cktbl->AddBatch(batches);
 }
 
 void DBImpl::MovetoNVMTable(){
     //Log(options_.info_log, "Meggie, MovetoNVMTable, start"); 
+    mutex_.AssertHeld();
     assert(nvmtbl_ != nullptr);
     start_timer(TOTAL_MOVE_TO_NVMTABLE);
     //Log(options_.info_log, "Meggie, MovetoNVMTable, start"); 
@@ -1542,10 +2570,53 @@ void DBImpl::MovetoNVMTable(){
     int drop_count = 0;
     std::string current_user_key;
     SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
-    movetable_struct movetable[kNumChunkTable];
+    //imm_ is only replaced by this thread. The chunk-flush thread installs
+    //nvmtbl_ too, but its changes only drop draining chunks: the active
+    //chunks are switched, split, merged and bounded only here, and
+    //ApplyNVMTableChange clones nvmtbl_ only once it is the MANIFEST
+    //writer, so its clone starts from those same chunks. The chunks of the
+    //snapshot taken below therefore stay the live ones while the entries
+    //are copied into them without mutex_
+    MemTable* imm = imm_;
+
+    if(nvmtbl_->IsRangePartitioned() && !nvmtbl_->HasRangeBoundaries()){
+        //persist the boundaries before routing anything by them
+        std::vector<std::string> boundaries;
+        const int num_chunk_tables = nvmtbl_->NumChunkTables();
+        mutex_.Unlock();
+        Iterator* sample_iter = imm->NewIterator();
+        NVMTable::LearnRangeBoundaries(sample_iter, user_comparator(),
+                num_chunk_tables, &boundaries);
+        delete sample_iter;
+        mutex_.Lock();
+        //chunks beyond the learned boundaries are dropped
+        VersionEdit boundary_edit;
+        Status s = ApplyNVMTableChange(&boundary_edit, [&](NVMTable* nvmtbl){
+            nvmtbl->SetRangeBoundaries(boundaries);
+        });
+        if(!s.ok()){
+            RecordBackgroundError(s);
+            record_timer(TOTAL_MOVE_TO_NVMTABLE);
+            return;
+        }
+    }
+    NVMTable* nvmtbl = nvmtbl_;
+    nvmtbl->Ref();
+    const int num_chunk_tables = nvmtbl->NumChunkTables();
+    std::vector<movetable_struct> movetable(num_chunk_tables);
+    for(int i = 0; i < num_chunk_tables; i++){
+        movetable[i].index = i; 
+        movetable[i].cktbl = nvmtbl->cktables_[i];
+        movetable[i].db = this;
+    }
+    mutex_.Unlock();
     
-    Iterator* iter = imm_->NewIterator();
+    Iterator* iter = imm->NewIterator();
     iter->SeekToFirst();
+    //entries moved before a crash are in the chunks already, a chunk
+    //can't link one twice
+    Iterator* moved_iter = (imm == recovered_mem_) ? 
+        nvmtbl->NewIterator() : nullptr;
     
     start_timer(GET_IMMUTABLE_BATCHES);
     int index;
@@ -1553,7 +2624,7 @@ void DBImpl::MovetoNVMTable(){
       Slice key = iter->key();
       bool drop = false;
       Slice user_key(key.data(), key.size() - 8);
-      index = nvmtbl_->GetChunkTableIndex(user_key);
+      index = nvmtbl->GetChunkTableIndex(user_key);
       if(!has_current_user_key ||
               user_comparator()->Compare(user_key, 
                   Slice(current_user_key)) != 0){
@@ -1567,6 +2638,13 @@ void DBImpl::MovetoNVMTable(){
       }
       
       last_sequence_for_key =  DecodeFixed64(key.data() + key.size() - 8) >> 8;
+      if(!drop && moved_iter != nullptr){
+          moved_iter->Seek(key);
+          if(moved_iter->Valid() && moved_iter->key() == key){
+              drop = true;
+              drop_count++;
+          }
+      }
       
       if(!drop){
          DEBUG_T("add to each chunktable,nodekey:%p\n",
@@ -1577,61 +2655,214 @@ void DBImpl::MovetoNVMTable(){
       }
     }
     delete iter;
+    delete moved_iter;
     record_timer(GET_IMMUTABLE_BATCHES);
-    for(int i = 0; i < kNumChunkTable; i++){
-        movetable[i].index = i; 
-        movetable[i].db = this;
+    std::vector<size_t> inserts(num_chunk_tables);
+    for(int i = 0; i < num_chunk_tables; i++){
+        inserts[i] = movetable[i].batches.size();
         thpool_->AddJob(AddToNVMTable, &movetable[i]);
     }
     thpool_->WaitAll();
-    VersionEdit edit;
-    edit.SetPrevLogNumber(0);
-    edit.SetLogNumber(logfile_number_);
-    //edit.update_chunkfiles(chunk_index_files_, chunk_log_files_);
-    //edit.SetMetaNumber(chunk_meta_file_);
-    
-    Status s = versions_->LogAndApply(&edit, &mutex_);
+    mutex_.Lock();
+    assert(nvmtbl_->NumChunkTables() == num_chunk_tables);
+    for(int i = 0; i < num_chunk_tables; i++){
+        assert(nvmtbl_->cktables_[i] == nvmtbl->cktables_[i]);
+    }
+    nvmtbl->RecordInserts(inserts);
+    nvmtbl->Unref();
+    //a chunk whose file could not grow took none of its batch. imm_ and
+    //its log stay, the next open moves it again and skips what the other
+    //chunks took
+    Status s;
+    for(int i = 0; i < num_chunk_tables && s.ok(); i++){
+        s = movetable[i].status;
+    }
+    if(s.ok()){
+        VersionEdit edit;
+        //a move made while the logs are replayed keeps them all, Open
+        //drops them once the last records are in the chunks
+        if(logfile_number_ != 0){
+            edit.SetPrevLogNumber(0);
+            edit.SetLogNumber(logfile_number_);
+        }
+        //edit.update_chunkfiles(chunk_index_files_, chunk_log_files_);
+        //edit.SetMetaNumber(chunk_meta_file_);
+        s = LogAndApply(&edit);
+    }
     if(s.ok()){
+        if(imm_ == recovered_mem_)
+            recovered_mem_ = nullptr;
         imm_->Unref();
         imm_ = nullptr;
         has_imm_.Release_Store(nullptr);
+        InstallSuperVersion();
         DeleteObsoleteFiles();
+    } else {
+        RecordBackgroundError(s);
     }
     record_timer(TOTAL_MOVE_TO_NVMTABLE);
 }
 
+Status DBImpl::SwitchFullChunkTables(){
+    mutex_.AssertHeld();
+    //a full chunk taking more than twice its share of the inserts is
+    //split in two as it is switched out
+    std::vector<int> indexes;
+    std::vector<chunkTable*> new_cktbls, split_cktbls;
+    std::vector<std::string> split_boundaries;
+    int num_chunk_tables = nvmtbl_->NumChunkTables();
+    const double avg_insert_rate = nvmtbl_->AverageInsertRate();
+    Status s;
+    for(int i = 0; i < nvmtbl_->NumChunkTables(); i++){
+        chunkTable* cktbl = nvmtbl_->cktables_[i];
+        if(cktbl->ApproximateNVMUsage() < options_.chunk_size || 
+                nvmtbl_->IsDraining(i))
+            continue;
+        std::string split_boundary;
+        chunkTable* split_cktbl = nullptr;
+        if(num_chunk_tables < options_.max_chunk_tables &&
+                avg_insert_rate > 0 &&
+                cktbl->InsertRate() >= 2 * avg_insert_rate &&
+                nvmtbl_->FindSplitBoundary(i, &split_boundary)){
+            DEBUG_T("split chunk %d\n", i);
+            s = CreateNewchunkTable(&split_cktbl);
+            if(!s.ok())
+                break;
+            split_cktbl->Ref();
+            num_chunk_tables++;
+        }
+        chunkTable* new_cktbl;
+        s = CreateNewchunkTable(&new_cktbl);
+        if(!s.ok()){
+            if(split_cktbl != nullptr)
+                ReleaseNewChunkTable(split_cktbl, false);
+            break;
+        }
+        new_cktbl->Ref();
+        indexes.push_back(i);
+        new_cktbls.push_back(new_cktbl);
+        split_cktbls.push_back(split_cktbl);
+        split_boundaries.push_back(split_boundary);
+    }
+    if(indexes.empty())
+        return s;
+
+    //nothing adds to the full chunks or sees the new ones but this thread
+    if(s.ok() && options_.hot_key_retention_bytes > 0){
+        NVMTable* nvmtbl = nvmtbl_;
+        nvmtbl->Ref();
+        mutex_.Unlock();
+        for(size_t i = 0; i < indexes.size() && s.ok(); i++){
+            s = RetainHotKeys(nvmtbl, nvmtbl->cktables_[indexes[i]], 
+                    new_cktbls[i], split_cktbls[i], split_boundaries[i]);
+        }
+        mutex_.Lock();
+        nvmtbl->Unref();
+    }
+
+    //a split shifts the indexes of the chunks after it, so go from the
+    //last chunk back
+    VersionEdit edit;
+    if(s.ok()){
+        s = ApplyNVMTableChange(&edit, [&](NVMTable* nvmtbl){
+            for(int i = static_cast<int>(indexes.size()) - 1; i >= 0; i--){
+                nvmtbl->SwitchChunkTable(indexes[i], new_cktbls[i]);
+                if(split_cktbls[i] != nullptr)
+                    nvmtbl->SplitChunkTable(indexes[i], split_boundaries[i], 
+                            split_cktbls[i]);
+            }
+        });
+    }
+    for(size_t i = 0; i < indexes.size(); i++){
+        ReleaseNewChunkTable(new_cktbls[i], s.ok());
+        if(split_cktbls[i] != nullptr)
+            ReleaseNewChunkTable(split_cktbls[i], s.ok());
+    }
+    return s;
+}
+
+//copy the newest entries of the hot keys of a full chunk into the chunk
+//switching in for it, or into right for the keys a split gives to it
+Status DBImpl::RetainHotKeys(NVMTable* nvmtbl, chunkTable* full, 
+        chunkTable* left, chunkTable* right, 
+        const std::string& split_boundary){
+    const size_t limit = std::min(options_.hot_key_retention_bytes,
+            options_.chunk_size / 4);
+    std::vector<const char*> retained, to_left, to_right;
+    size_t retained_bytes = 0;
+    bool has_current_user_key = false;
+    std::string current_user_key;
+    Iterator* iter = full->NewIterator();
+    for(iter->SeekToFirst(); iter->Valid(); iter->Next()){
+        Slice key = iter->key();
+        Slice user_key = ExtractUserKey(key);
+        //older entries of a key are dropped by the flush anyway
+        if(has_current_user_key &&
+                user_comparator()->Compare(user_key, 
+                    Slice(current_user_key)) == 0)
+            continue;
+        current_user_key.assign(user_key.data(), user_key.size());
+        has_current_user_key = true;
+        if(!hot_bf_->CheckHot(user_key))
+            continue;
+        const size_t bytes = key.size() + iter->value().size();
+        if(retained_bytes + bytes > limit)
+            break;
+        retained_bytes += bytes;
+        const char* kvitem = iter->GetNodeKey();
+        retained.push_back(kvitem);
+        if(right != nullptr && nvmtbl->RightOfSplit(user_key, split_boundary))
+            to_right.push_back(kvitem);
+        else
+            to_left.push_back(kvitem);
+    }
+    delete iter;
+    DEBUG_T("retain %zu hot keys, %zu bytes\n", 
+            retained.size(), retained_bytes);
+    //durable in the new chunks before the full one can be flushed
+    Status s = left->AddBatch(to_left);
+    if(s.ok() && right != nullptr)
+        s = right->AddBatch(to_right);
+    if(s.ok())
+        full->SetRetained(retained);
+    return s;
+}
+
 Status DBImpl::MakeRoomForImmu(){
     mutex_.AssertHeld();
     Status s;
     DEBUG_T("in MakeRoomForImmu, check\n");
     start_timer(CHECK_ADD_COMPACTION_LIST);
-    nvmtbl_->CheckAndAddToCompactionList(
-                to_compaction_list_,
-                options_.chunk_size);
+    std::vector<chunkTable*> draining;
+    nvmtbl_->GetDrainingChunkTables(&draining);
     record_timer(CHECK_ADD_COMPACTION_LIST);
     start_timer(TOTAL_NVMTABLE_COMPACTION);
-    int sz = to_compaction_list_.size();
-    DEBUG_T("to_compaction_list_, size:%d\n", sz);
+    int sz = draining.size();
+    DEBUG_T("draining chunks, size:%d\n", sz);
     nvmcompact_struct nvmcompact[sz];
     start_timer(INIT_NVM_COMPACT);
-    InitNVMCompact(to_compaction_list_, nvmcompact);
+    InitNVMCompact(draining, nvmcompact);
     record_timer(INIT_NVM_COMPACT);
     
     DEBUG_T("before add all job, sz:%d\n", sz);
     start_timer(THPOOL_HANDLE_JOB);
+    //the draining chunks stay readable in nvmtbl_ until
+    //FinishNVMTableCompaction drops them
+    mutex_.Unlock();
     for(int i = 0; i < sz; i++){
-        thpool_->AddJob(CompactNVMTable, &nvmcompact[i]);
+        flush_thpool_->AddJob(CompactNVMTable, &nvmcompact[i]);
         DEBUG_T("have add job\n");
     }
     DEBUG_T("before wait\n");
-    thpool_->WaitAll();
+    flush_thpool_->WaitAll();
     DEBUG_T("after wait\n");
+    mutex_.Lock();
     record_timer(THPOOL_HANDLE_JOB);
    
     start_timer(FINISH_NVMTABLE_COMPACTION);
     Version* base = versions_->current();
     base->Ref();
-    FinishNVMTableCompaction(nvmcompact, sz, base);
+    s = FinishNVMTableCompaction(nvmcompact, sz, base);
     base->Unref();
     record_timer(FINISH_NVMTABLE_COMPACTION);
     
@@ -1639,23 +2870,23 @@ Status DBImpl::MakeRoomForImmu(){
     return s;
 }
 
-void DBImpl::InitNVMCompact(std::map<int, chunkTable*>& to_compaction_list, 
+void DBImpl::InitNVMCompact(std::vector<chunkTable*>& draining, 
         nvmcompact_struct* nvmcompact){
-    std::map<int, chunkTable*>::iterator iter = to_compaction_list.begin();
-    int i = 0;
     int sstnum_of_chunk = 
         options_.chunk_size / options_.write_buffer_size;
     DEBUG_T("sstnum_of_chunk:%d\n", sstnum_of_chunk);
-    for(; iter != to_compaction_list.end(); iter++, i++){
-        DEBUG_T("INIT_NVM_COMPACT:%d\n", i);
-        nvmcompact[i].index = iter->first;
-        nvmcompact[i].cktbl = iter->second;
-        DEBUG_T("CreateNewchunkTable, start\n");
-        nvmcompact[i].new_cktbl = CreateNewchunkTable();
-        DEBUG_T("CreateNewchunkTable, end\n");
+    for(size_t i = 0; i < draining.size(); i++){
+        DEBUG_T("INIT_NVM_COMPACT:%zu\n", i);
+        nvmcompact[i].cktbl = draining[i];
+        //range partitioned files are already told apart by their
+        //smallest/largest keys
+        nvmcompact[i].has_hash_range = !nvmtbl_->IsRangePartitioned();
+        if(nvmcompact[i].has_hash_range){
+            nvmtbl_->GetDrainingHashRange(draining[i], 
+                    &nvmcompact[i].hash_lo, &nvmcompact[i].hash_hi);
+        }
         nvmcompact[i].db = this;
         for(int j =0; j < sstnum_of_chunk; j++){
-            int number = versions_->NewFileNumber();
             nvmcompact[i].reserved_file_numbers.push_back(
                 versions_->NewFileNumber());
             pending_outputs_.insert(nvmcompact[i].reserved_file_numbers[j]);
@@ -1667,9 +2898,13 @@ Status DBImpl::FinishNVMTableCompaction(nvmcompact_struct* nvmcompact,
                                     int size,
                                     Version* base){
     Status s;
+    //a chunk whose tables were not all written is the only copy of its
+    //entries, so nothing is dropped and the caller records the error
+    for(int i = 0; i < size && s.ok(); i++){
+        s = nvmcompact[i].status;
+    }
     VersionEdit edit;
-    std::map<int, chunkTable*> update_chunks;
-    for(int i = 0; i < size; i++){
+    for(int i = 0; i < size && s.ok(); i++){
        for(int j = 0; j < nvmcompact[i].result_meta_list.size(); j++){
            FileMetaData meta = nvmcompact[i].result_meta_list[j];
            if(meta.file_size > 0){
@@ -1679,24 +2914,84 @@ Status DBImpl::FinishNVMTableCompaction(nvmcompact_struct* nvmcompact,
               /*if(base != nullptr)
                  level = base->PickLevelForMemTableOutput(min_user_key,
                          max_user_key);*/
-              meta.hash = nvmcompact[i].index;
-              edit.AddFile(level, meta.number, meta.file_size, 
-                      meta.smallest, meta.largest, meta.hash);
+              meta.has_hash_range = nvmcompact[i].has_hash_range;
+              meta.hash_lo = nvmcompact[i].hash_lo;
+              meta.hash_hi = nvmcompact[i].hash_hi;
+              edit.AddFile(level, meta);
             }
-            pending_outputs_.erase(meta.number);
-       }
-       for(int j = nvmcompact[i].result_meta_list.size(); 
-               j < nvmcompact[i].reserved_file_numbers.size(); j++){
-           pending_outputs_.erase(nvmcompact[i].reserved_file_numbers[j]);
        }
-       update_chunks.insert(std::make_pair(nvmcompact[i].index, nvmcompact[i].new_cktbl));
     }
-    UpdateNVMTable(update_chunks, false);
-    edit.update_chunkfiles(chunk_files_);
-    s = versions_->LogAndApply(&edit, &mutex_);
+    if(s.ok()){
+        s = ApplyNVMTableChange(&edit, [&](NVMTable* nvmtbl){
+            for(int i = 0; i < size; i++){
+                nvmtbl->RemoveDrainingChunkTable(nvmcompact[i].cktbl);
+            }
+        });
+    }
+    //the outputs are live files now, or garbage if the edit failed. The
+    //other background threads may delete obsolete files while mutex_ is
+    //dropped in LogAndApply, so they are protected until here
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < nvmcompact[i].reserved_file_numbers.size(); j++){
+            pending_outputs_.erase(nvmcompact[i].reserved_file_numbers[j]);
+        }
+    }
+    if(s.ok()){
+        DeleteObsoleteFiles();
+    }
+    return s;
+}
+
+Status DBImpl::MaybeMergeChunkTables(){
+    mutex_.AssertHeld();
+    if(options_.max_chunk_tables == 0)
+        return Status::OK();
+    //merge the first pair of neighbours that together take less than half
+    //the average inserts and fit in half a chunk
+    const double avg_insert_rate = nvmtbl_->AverageInsertRate();
+    int index = -1;
+    for(int i = 0; i + 1 < nvmtbl_->NumChunkTables(); i++){
+        chunkTable* left = nvmtbl_->cktables_[i];
+        chunkTable* right = nvmtbl_->cktables_[i + 1];
+        if(avg_insert_rate > 0 && 
+                !nvmtbl_->IsDraining(i) && !nvmtbl_->IsDraining(i + 1) &&
+                left->InsertRate() + right->InsertRate() <= avg_insert_rate / 2 &&
+                left->ApproximateNVMUsage() + right->ApproximateNVMUsage() <= 
+                options_.chunk_size / 2){
+            index = i;
+            break;
+        }
+    }
+    if(index < 0)
+        return Status::OK();
+    DEBUG_T("merge chunk %d and %d\n", index, index + 1);
+    chunkTable* merged;
+    Status s = CreateNewchunkTable(&merged);
+    if(!s.ok())
+        return s;
+    merged->Ref();
+    chunkTable* sources[2] = {nvmtbl_->cktables_[index], 
+                              nvmtbl_->cktables_[index + 1]};
+    mutex_.Unlock();
+    for(int i = 0; i < 2 && s.ok(); i++){
+        std::vector<const char*> batch;
+        Iterator* iter = sources[i]->NewIterator();
+        for(iter->SeekToFirst(); iter->Valid(); iter->Next()){
+            batch.push_back(iter->GetNodeKey());
+        }
+        delete iter;
+        s = merged->AddBatch(batch);
+    }
+    mutex_.Lock();
+    VersionEdit edit;
+    if(s.ok()){
+        s = ApplyNVMTableChange(&edit, [&](NVMTable* nvmtbl){
+            nvmtbl->MergeChunkTables(index, merged);
+        });
+    }
+    ReleaseNewChunkTable(merged, s.ok());
     if(s.ok()){
         DeleteObsoleteFiles();
-        std::map<int, chunkTable*>().swap(to_compaction_list_);
     }
     return s;
 }
@@ -1704,7 +2999,6 @@ Status DBImpl::FinishNVMTableCompaction(nvmcompact_struct* nvmcompact,
 static const int kLevel0FileSize = (2 << 10) << 10;
 
 Status DBImpl::WriteNVMTableToLevel0(chunkTable* cktbl, 
-                        chunkTable* new_cktbl, 
                         std::vector<uint64_t>& reserved_file_numbers,
                         std::vector<FileMetaData>& result_meta_list){
     const uint64_t start_micros = env_->NowMicros();
@@ -1750,14 +3044,18 @@ Status DBImpl::WriteNVMTableToLevel0(chunkTable* cktbl,
             last_sequence_for_key =  DecodeFixed64(key.data() + key.size() - 8) >> 8;
             if(drop)
                 continue;
+            //kept in NVM by the switch, see RetainHotKeys()
+            if(cktbl->IsRetained(iter->GetNodeKey())){
+                hot_num++;
+                continue;
+            }
             if(!builder){
                 meta.number = 
                     reserved_file_numbers[file_number_index++];
                 std::string fname = TableFileName(dbname_, meta.number); 
                 s = env_->NewWritableFile(fname, &file);               
-                if(!s.ok()){
-                    return s;
-                }
+                if(!s.ok())
+                    break;
                 builder = new TableBuilder(options_, file);
                 first_entry = true;
             }
@@ -1782,24 +3080,34 @@ Status DBImpl::WriteNVMTableToLevel0(chunkTable* cktbl,
                builder = nullptr;
                delete file;
                file = nullptr;
+               if(!s.ok())
+                   break;
                result_meta_list.push_back(meta); 
             }
         }
 
+        if(builder && !s.ok()){
+            builder->Abandon();
+            delete builder;
+            builder = NULL;
+            delete file;
+            file = NULL;
+        }
         if(builder){
             s = builder->Finish();
             meta.file_size = builder->FileSize();
             if(s.ok())
-                file->Sync();
+                s = file->Sync();
             if(s.ok())
-                file->Close();
+                s = file->Close();
             if(s.ok())
                 DEBUG_T("NVMTable compaction Generated table #%lu, %lu bytes\n",meta.number, meta.file_size);
             delete builder;
             builder = NULL;
             delete file;
             file = NULL;
-            result_meta_list.push_back(meta); 
+            if(s.ok())
+                result_meta_list.push_back(meta); 
         }
     }
     DEBUG_T("sst_num:%d, hot_num:%d\n", sst_num, hot_num);
@@ -1817,8 +3125,7 @@ void DBImpl::CompactNVMTable(void* args){
     nvmcompact_struct* nvmcompact = reinterpret_cast<nvmcompact_struct*>(args);
     DBImpl* db = nvmcompact->db;
     DEBUG_T("before WriteNVMTableToLevel0\n");
-    db->WriteNVMTableToLevel0(nvmcompact->cktbl, 
-            nvmcompact->new_cktbl, 
+    nvmcompact->status = db->WriteNVMTableToLevel0(nvmcompact->cktbl, 
             nvmcompact->reserved_file_numbers,
             nvmcompact->result_meta_list);
     DEBUG_T("finish WriteNVMTableToLevel0\n");
@@ -1827,7 +3134,34 @@ void DBImpl::CompactNVMTable(void* args){
 Status DBImpl::RecoverChunkFile(std::vector<uint64_t>& chunk_files, 
                                 uint64_t chunkmeta_file){
     std::map<int, chunkTable*> update_chunks;
-    for(int i = 0; i < kNumChunkTable; i++){
+    //an existing database keeps the partition count it was created with
+    const int num_chunk_tables = chunk_files.empty() ? 
+        options_.num_chunk_tables : static_cast<int>(chunk_files.size());
+    //likewise its partitioning mode, a fresh database takes it from options_
+    const bool range_partitioned = chunk_files.empty() ?
+        (options_.chunk_partition_type == kRangePartition) :
+        (versions_->ChunkPartitionType() == kRangePartition);
+    if(nvmtbl_ == nullptr){
+        nvmtbl_ = new NVMTable(internal_comparator_, num_chunk_tables,
+                range_partitioned);
+        nvmtbl_->Ref();
+        std::vector<std::string> boundaries;
+        std::vector<uint32_t> hash_boundaries;
+        if(range_partitioned && versions_->GetChunkBoundaries(&boundaries))
+            nvmtbl_->SetRangeBoundaries(boundaries);
+        if(!range_partitioned && 
+                versions_->GetChunkHashBoundaries(&hash_boundaries))
+            nvmtbl_->SetHashBoundaries(hash_boundaries);
+        //splits can take the partition count up to max_chunk_tables, a
+        //worker per partition keeps the moves and flushes in parallel
+        const int num_workers = std::max(num_chunk_tables,
+                                         options_.max_chunk_tables);
+        thpool_ = new ThreadPool(num_workers);
+        flush_thpool_ = new ThreadPool(num_workers);
+        chunk_files_.resize(num_chunk_tables);
+    }
+    assert(nvmtbl_->NumChunkTables() == num_chunk_tables);
+    for(int i = 0; i < chunk_files.size(); i++){
         if(chunk_files[i] != 0){
             chunk_been_allocated_ = true;
             versions_->MarkFileNumberUsed(chunk_files[i]);
@@ -1836,21 +3170,56 @@ Status DBImpl::RecoverChunkFile(std::vector<uint64_t>& chunk_files,
             
             std::string chunkfilename = chunkFileName(dbname_nvm_, chunk_files[i]);
             ArenaNVM* arena = new ArenaNVM(&chunkfilename, options_.chunk_size, true);
+            if(arena->getMapStart() == NULL){
+                //the chunks recovered so far are freed with nvmtbl_
+                delete arena;
+                UpdateNVMTable(update_chunks, true);
+                return Status::IOError("cannot map chunk file", chunkfilename);
+            }
+            RegisterChunkArena(arena);
             chunkTable* cktbl = nvmtbl_->GetNewChunkTable(arena, true);
             cktbl->SetChunkNumber(chunk_files[i]);
             update_chunks.insert(std::make_pair(i, cktbl));
         }
     } 
+    //chunks that were still draining are flushed again once the db is
+    //open, partitions split while draining share theirs
+    std::vector<uint64_t> draining_chunk_files;
+    std::map<uint64_t, chunkTable*> draining_chunks;
+    versions_->GetDrainingChunkFiles(&draining_chunk_files);
+    for(int i = 0; i < draining_chunk_files.size(); i++){
+        const uint64_t number = draining_chunk_files[i];
+        if(number == 0)
+            continue;
+        if(draining_chunks.find(number) == draining_chunks.end()){
+            versions_->MarkFileNumberUsed(number);
+            chunk_files_.push_back(number);
+            std::string chunkfilename = chunkFileName(dbname_nvm_, number);
+            ArenaNVM* arena = new ArenaNVM(&chunkfilename, options_.chunk_size, true);
+            if(arena->getMapStart() == NULL){
+                delete arena;
+                UpdateNVMTable(update_chunks, true);
+                return Status::IOError("cannot map chunk file", chunkfilename);
+            }
+            RegisterChunkArena(arena);
+            chunkTable* cktbl = nvmtbl_->GetNewChunkTable(arena, true);
+            cktbl->SetChunkNumber(number);
+            draining_chunks[number] = cktbl;
+        }
+        nvmtbl_->SetDrainingChunkTable(i, draining_chunks[number]);
+    }
+    UpdateNVMTable(update_chunks, true);
+
+    //the filters of chunks written since they were saved are rebuilt by
+    //the nvm thread
     DEBUG_T("after recovery, chunkmetafile:%lu\n", chunkmeta_file);
     if(chunkmeta_file){
         std::string metafilename = chunkMetaFileName(dbname_nvm_, chunkmeta_file);
         chunk_meta_file_ = chunkmeta_file;
-        nvmtbl_->RecoverMetadata(update_chunks, metafilename);
+        nvmtbl_->RecoverMetadata(metafilename);
     }
     
     DEBUG_T("after recover metadata\n");
-    
-    UpdateNVMTable(update_chunks, true);
 
     printChunkFileNumbers();
 
@@ -1886,7 +3255,8 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       allow_delay = false;  // Do not delay a single write more than once
       mutex_.Lock();
     } else if (!force &&
-               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
+               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size) &&
+               WriteBufferHasRoom()) {
       // There is room in current memtable
       break;
     }else if(imm_){
@@ -1896,37 +3266,57 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       background_work_finished_signal_.Wait();
     }
     ///////////meggie
-    //else if(nvmtbl_ && nvmtbl_->NeedsCompaction(options_.chunk_size)){
-    else if(nvmtbl_ && !to_compaction_list_.empty()){
-      Log(options_.info_log, "Current nvmtable need compaction; waiting...\n");
-      background_work_finished_signal_.Wait();
-    }
+    //full chunks are switched out and drain in the background, writers
+    //only wait for imm_ like above
     ///////////meggie
     else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
       background_work_finished_signal_.Wait();
-    } else {
+    }
+    ///////////meggie
+    else if (!mem_writers_.empty()) {
+      // pipelined groups logged to the current log are still inserting
+      // into mem_
+      mem_writers_drained_signal_.Wait();
+    }
+    ///////////meggie
+    else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
       uint64_t new_log_number = versions_->NewFileNumber();
       WritableFile* lfile = nullptr;
-      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
+      ////////////////meggie
+      NVMWriteBuffer* buffer = nullptr;
+      if (options_.nvm_write_buffer) {
+        s = NewWriteBuffer(new_log_number, &buffer);
+      } else {
+        s = NewLogFile(new_log_number, &lfile);
+      }
+      ////////////////meggie
       if (!s.ok()) {
         // Avoid chewing through file number space in a tight loop.
         versions_->ReuseFileNumber(new_log_number);
         break;
       }
-      delete log_;
-      delete logfile_;
-      logfile_ = lfile;
+      ////////////////meggie
+      if (lfile != nullptr) {
+        delete log_;
+        delete logfile_;
+        logfile_ = lfile;
+        log_ = new log::Writer(lfile);
+      }
+      ////////////////meggie
       logfile_number_ = new_log_number;
-      log_ = new log::Writer(lfile);
       imm_ = mem_;
       has_imm_.Release_Store(imm_);
       mem_ = new MemTable(internal_comparator_);
       mem_->isNVMMemtable = false;
       mem_->Ref();
+      ////////////////meggie
+      if (buffer != nullptr) mem_->SetWriteBuffer(buffer);
+      ////////////////meggie
+      InstallSuperVersion();
       //fprintf(stderr, "after convert memtable to immutable\n");
       force = false;   // Do not force another compaction if have room
       MaybeScheduleCompaction();
@@ -2042,6 +3432,26 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+std::vector<Status> DB::MultiGet(const ReadOptions& options,
+                                 const std::vector<Slice>& keys,
+                                 std::vector<std::string>* values) {
+  ReadOptions opt = options;
+  const Snapshot* snapshot = nullptr;
+  if (opt.snapshot == nullptr) {
+    snapshot = GetSnapshot();
+    opt.snapshot = snapshot;
+  }
+  values->resize(keys.size());
+  std::vector<Status> statuses(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    statuses[i] = Get(opt, keys[i], &(*values)[i]);
+  }
+  if (snapshot != nullptr) {
+    ReleaseSnapshot(snapshot);
+  }
+  return statuses;
+}
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -2054,47 +3464,88 @@ Status DB::Open(const Options& options, const std::string& dbname,
   // Recover handles create_if_missing, error_if_exists
   bool save_manifest = false;
   Status s = impl->Recover(&edit, &save_manifest);
-  if (s.ok() && impl->mem_ == nullptr) {
+  ////////////////meggie
+  //mem_ holding the records of the old logs without a log of its own,
+  //those logs stay until it has been moved to the chunks
+  const bool keep_logs = impl->mem_ != nullptr && impl->log_ == nullptr;
+  if (s.ok() && impl->log_ == nullptr) {
+  ////////////////meggie
     // Create new log and a corresponding memtable.
     uint64_t new_log_number = impl->versions_->NewFileNumber();
-    WritableFile* lfile;
-    s = options.env->NewWritableFile(LogFileName(dbname, new_log_number),
-                                     &lfile);
+    WritableFile* lfile = nullptr;
+    ////////////////meggie
+    NVMWriteBuffer* buffer = nullptr;
+    if (impl->options_.nvm_write_buffer) {
+      s = impl->NewWriteBuffer(new_log_number, &buffer);
+    } else {
+      s = impl->NewLogFile(new_log_number, &lfile);
+    }
+    ////////////////meggie
     if (s.ok()) {
-      edit.SetLogNumber(new_log_number);
-      impl->logfile_ = lfile;
+      ////////////////meggie
+      if (lfile != nullptr) {
+        impl->logfile_ = lfile;
+        impl->log_ = new log::Writer(lfile);
+      }
       impl->logfile_number_ = new_log_number;
-      impl->log_ = new log::Writer(lfile);
-      impl->mem_ = new MemTable(impl->internal_comparator_);
-      impl->mem_->isNVMMemtable = false;
-      impl->mem_->Ref();
+      if (!keep_logs) {
+        edit.SetLogNumber(new_log_number);
+        impl->mem_ = new MemTable(impl->internal_comparator_);
+        impl->mem_->isNVMMemtable = false;
+        impl->mem_->Ref();
+      }
+      if (buffer != nullptr) impl->mem_->SetWriteBuffer(buffer);
+      ////////////////meggie
     }
   }
   /////////////meggie
   if(s.ok() && !impl->chunk_been_allocated_) {
       std::map<int, chunkTable*> update_chunks;
-      for(int i = 0; i < kNumChunkTable; i++){
-          chunkTable* cktbl = impl->CreateNewchunkTable();
-          update_chunks.insert(std::make_pair(i, cktbl));
+      for(int i = 0; i < impl->nvmtbl_->NumChunkTables() && s.ok(); i++){
+          chunkTable* cktbl;
+          s = impl->CreateNewchunkTable(&cktbl);
+          if(s.ok())
+              update_chunks.insert(std::make_pair(i, cktbl));
+      }
+      if(!s.ok()){
+          //the chunks made so far go with their files
+          std::map<int, chunkTable*>::iterator it;
+          for(it = update_chunks.begin(); it != update_chunks.end(); ++it){
+              it->second->Ref();
+              impl->ReleaseNewChunkTable(it->second, false);
+          }
+      } else {
+          impl->UpdateNVMTable(update_chunks, false);
+          for(int i = 0; i < impl->nvmtbl_->NumChunkTables(); i++){
+              impl->pending_outputs_.erase(impl->chunk_files_[i]);
+          }
+          edit.update_chunkfiles(impl->chunk_files_);
+          //range boundaries are learned from the first data moved to NVM
+          edit.SetChunkPartitionType(impl->nvmtbl_->IsRangePartitioned() ?
+                  kRangePartition : kHashPartition);
+
+          uint64_t new_meta_number = impl->versions_->NewFileNumber();
+          std::string metafilename = chunkMetaFileName(impl->dbname_nvm_, new_meta_number);
+          impl->chunk_meta_file_ = new_meta_number;
+          edit.SetMetaNumber(new_meta_number);
+          //a reused MANIFEST must still learn of the new chunks
+          save_manifest = true;
       }
-      impl->UpdateNVMTable(update_chunks, false);
-      edit.update_chunkfiles(impl->chunk_files_);
-
-      uint64_t new_meta_number = impl->versions_->NewFileNumber();
-      std::string metafilename = chunkMetaFileName(impl->dbname_nvm_, new_meta_number);
-      impl->chunk_meta_file_ = new_meta_number;
-      edit.SetMetaNumber(new_meta_number);
-
-      if(!s.ok())
-          return s;
   }
   /////////////meggie
   if (s.ok() && save_manifest) {
-    edit.SetPrevLogNumber(0);  // No older logs needed after recovery.
-    edit.SetLogNumber(impl->logfile_number_);
+    ////////////////meggie
+    if (!keep_logs) {
+      edit.SetPrevLogNumber(0);  // No older logs needed after recovery.
+      edit.SetLogNumber(impl->logfile_number_);
+    }
+    ////////////////meggie
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
+    /////////////meggie
+    impl->InstallSuperVersion();
+    /////////////meggie
     impl->DeleteObsoleteFiles();
     impl->MaybeScheduleCompaction();
   }
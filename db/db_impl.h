@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_DB_DB_IMPL_H_
 
 #include <deque>
+#include <functional>
 #include <vector>
 #include <set>
 #include "db/dbformat.h"
@@ -16,6 +17,7 @@
 #include "port/port.h"
 #include "port/thread_annotations.h"
 //////////////////meggie
+#include <atomic>
 #include <map>
 #include "util/timer.h"
 //////////////////meggie
@@ -24,13 +26,17 @@ namespace leveldb {
 
 class MemTable;
 class TableCache;
+class ThreadLocalPtr;
 class Version;
 class VersionEdit;
 class VersionSet;
 ///////////////meggie
 class NVMTable;
 class chunkTable;
-class MultiHotBloomFilter;
+class HotnessEstimator;
+class NVMWriteBuffer;
+class ChunkFilePool;
+class ArenaNVM;
 struct FileMetaData;
 class ThreadPool;
 ///////////////meggie
@@ -49,6 +55,9 @@ class DBImpl : public DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -73,6 +82,16 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Number of chunkTables the NVM tier is currently partitioned into.
+  int TEST_NumChunkTables();
+
+  // Wait until the NVM thread and the chunk flush thread have no work
+  // scheduled.
+  Status TEST_WaitForNVMWork();
+
+  // Look key up in the NVM chunks only, NotFound if none of them has it.
+  Status TEST_NVMGet(const Slice& key, std::string* value);
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
@@ -113,12 +132,44 @@ class DBImpl : public DB {
   Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //////////////meggie
+  // RecoverLogFile() of a log written as an NVM write buffer
+  Status RecoverWriteBuffer(const std::string& fname, bool* save_manifest,
+                            VersionEdit* edit, SequenceNumber* max_sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Moves the records replayed into mem_ to the chunks once they fill it,
+  // so a long replay doesn't hold them all in DRAM
+  Status MoveRecoveredMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //////////////meggie
 
   Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //////////////meggie
+  // Create log number, in NVM if options_.nvm_log is set
+  Status NewLogFile(uint64_t number, WritableFile** file);
+  // With options_.nvm_write_buffer, the buffer that is log number of a
+  // new memtable. It has room for the batch of the first writer
+  Status NewWriteBuffer(uint64_t number, NVMWriteBuffer** buffer)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // true unless mem_'s write buffer lacks room for the first writer
+  bool WriteBufferHasRoom() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Give every batch of the group its own sequence numbers, from seq on
+  void SetGroupSequences(Writer* last_writer, SequenceNumber seq)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Have the writers of a logged group insert their own batches into
+  // mem_ while the leader, group[0], inserts its batch, and wait for all
+  // of them
+  Status InsertGroupConcurrently(const std::vector<Writer*>& group)
+      LOCKS_EXCLUDED(mutex_);
+  // The memtable stage of a pipelined write: wait for the groups logged
+  // before group to be inserted, insert it and publish last_sequence
+  Status InsertPipelinedGroup(const std::vector<Writer*>& group,
+                              SequenceNumber last_sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //////////////meggie
   WriteBatch* BuildBatchGroup(Writer** last_writer)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
@@ -128,6 +179,31 @@ class DBImpl : public DB {
   static void BGWork(void* db);
   void BackgroundCall();
   void BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //////////////meggie
+  // imm->NVM moves and chunk->L0 flushes run on their own thread, so they
+  // are not queued behind level compactions. The thread is started by the
+  // first flush and waits for the next one until the DB is deleted
+  void MaybeScheduleNVMFlush() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGNVMWork(void* db);
+  void BackgroundNVMThread();
+  void BackgroundNVMCall() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void BackgroundNVMFlush() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void RebuildChunkFilters() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // draining chunks are flushed to level-0 on a third thread, so moves
+  // into the switched in chunks go on meanwhile
+  void MaybeScheduleChunkFlush() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGChunkFlushWork(void* db);
+  void BackgroundChunkFlushThread();
+  void BackgroundChunkFlushCall() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // VersionSet::LogAndApply() drops mutex_ while writing the MANIFEST and
+  // must not be called concurrently, both background threads go through here
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Applies edit along with the chunk layout change() gives a clone of
+  // nvmtbl_, and installs the clone
+  Status ApplyNVMTableChange(VersionEdit* edit,
+                             const std::function<void(NVMTable*)>& change)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //////////////meggie
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
@@ -173,6 +249,19 @@ class DBImpl : public DB {
   // Queue of writers.
   std::deque<Writer*> writers_ GUARDED_BY(mutex_);
   WriteBatch* tmp_batch_ GUARDED_BY(mutex_);
+  //////////////meggie
+  // Writers of the current group still inserting their batches, and the
+  // leader waiting for them
+  int pending_inserts_ GUARDED_BY(mutex_);
+  Writer* insert_leader_ GUARDED_BY(mutex_);
+  // Leaders of logged groups waiting to insert into mem_, in log order,
+  // with pipelined_write
+  std::deque<Writer*> mem_writers_ GUARDED_BY(mutex_);
+  port::CondVar mem_writers_drained_signal_ GUARDED_BY(mutex_);
+  // Last sequence number given to a logged group, ahead of LastSequence()
+  // while groups wait to be inserted
+  SequenceNumber logged_sequence_ GUARDED_BY(mutex_);
+  //////////////meggie
 
   SnapshotList snapshots_ GUARDED_BY(mutex_);
 
@@ -183,6 +272,23 @@ class DBImpl : public DB {
   // Has a background compaction been scheduled or is running?
   bool background_compaction_scheduled_ GUARDED_BY(mutex_);
 
+  //////////////meggie
+  // Has a background NVM flush been scheduled or is running?
+  bool background_nvm_scheduled_ GUARDED_BY(mutex_);
+  // Is the NVM flush thread alive? It waits on background_nvm_signal_
+  bool background_nvm_thread_ GUARDED_BY(mutex_);
+  port::CondVar background_nvm_signal_ GUARDED_BY(mutex_);
+
+  // Has a background flush of draining chunks been scheduled or is running?
+  bool background_chunk_flush_scheduled_ GUARDED_BY(mutex_);
+  bool background_chunk_flush_thread_ GUARDED_BY(mutex_);
+  port::CondVar background_chunk_flush_signal_ GUARDED_BY(mutex_);
+
+  // Is a thread inside VersionSet::LogAndApply()?
+  bool manifest_writing_ GUARDED_BY(mutex_);
+  port::CondVar manifest_written_signal_ GUARDED_BY(mutex_);
+  //////////////meggie
+
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
@@ -219,7 +325,6 @@ class DBImpl : public DB {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status WriteNVMTableToLevel0(chunkTable* cktbl, 
-          chunkTable* new_cktbl, 
           std::vector<uint64_t>& reserved_file_numbers,
           std::vector<FileMetaData>& result_meta_list);
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
@@ -230,7 +335,6 @@ class DBImpl : public DB {
   
   NVMTable* nvmtbl_;
 
-  std::map<int, chunkTable*> to_compaction_list_;
 
   //port::CondVar bg_nvmtable_cv_ GUARDED_BY(mutex_);
   //port::CondVar bg_fg_cv_ GUARDED_BY(mutex_);
@@ -241,27 +345,91 @@ class DBImpl : public DB {
 
   uint64_t chunk_meta_file_;
 
+  //spare chunk files, see Options::spare_chunk_files. Null if there are
+  //none, made once the db is locked
+  ChunkFilePool* chunk_pool_;
+  //new chunks take a spare if one is ready and obsolete ones are retired
+  //to the pool
+  std::string NewChunkFile(uint64_t number);
+  void RemoveChunkFile(const std::string& fname);
+  void RegisterChunkArena(ArenaNVM* arena);
+
   bool chunk_been_allocated_;
+  //the memtable rebuilt from the logs while chunks exist. A crash in the
+  //middle of its move may have left some of its entries in the chunks,
+  //its move skips those
+  MemTable* recovered_mem_;
   
-  MultiHotBloomFilter *hot_bf_;
+  HotnessEstimator *hot_bf_;
+  //keys found in the SSTables by Get, sampled
+  HotnessEstimator* read_hot_bf_;
+  std::atomic<uint64_t> read_hits_;
+  //hot reads waiting to be copied into NVM, with the sequence number of
+  //the entry Get found
+  struct PromotedRead {
+    std::string user_key;
+    SequenceNumber sequence;
+  };
+  std::deque<PromotedRead> pending_promotions_ GUARDED_BY(mutex_);
+  //samples a key Get found in the SSTables, true if it is hot and
+  //should be queued with QueueReadPromotion()
+  bool SampleReadHit(const Slice& user_key);
+  void QueueReadPromotion(const Slice& user_key, SequenceNumber sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status PromoteHotReads() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //mem_, imm_, nvmtbl_ and the current version as readers see them,
+  //each referenced for as long as the super version is. Readers get it
+  //without mutex_: every thread caches a reference in local_sv_, and
+  //InstallSuperVersion() takes those back when it replaces the one
+  //installed. A thread finding its cache emptied gets a new reference
+  //under mutex_
+  struct SuperVersion {
+    MemTable* mem;
+    MemTable* imm;
+    NVMTable* nvmtbl;
+    Version* current;
+    std::atomic<int> refs;
+  };
+  SuperVersion* super_version_ GUARDED_BY(mutex_);
+  ThreadLocalPtr* local_sv_;
+  //called whenever one of the four changes
+  void InstallSuperVersion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void ReleaseSuperVersions() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  SuperVersion* GetAndRefSuperVersion() LOCKS_EXCLUDED(mutex_);
+  void ReturnSuperVersion(SuperVersion* sv) LOCKS_EXCLUDED(mutex_);
+  void UnrefSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void FreeSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //Get's probe of the NVM chunks, see Options::parallel_lookup
+  bool NVMGet(const ReadOptions& options, NVMTable* nvmtbl, Version* current,
+              const LookupKey& lkey, std::string* value, Status* s);
   Status FinishNVMTableCompaction(nvmcompact_struct* nvmcompact, 
                                 int size,
                                 Version* base);
   
   Status TEST_CompactNVMTable();
 
+  // moves imm_ entries into the chunks
   ThreadPool* thpool_;
+  // flushes draining chunks to level-0
+  ThreadPool* flush_thpool_;
 
   Status UpdateNVMTable(std::map<int, chunkTable*>& update_chunks, bool recovery);
-  chunkTable* CreateNewchunkTable();
-  void InitNVMCompact(std::map<int, chunkTable*>& need_updates, nvmcompact_struct* nvmcompact);
+  void InstallNVMTable(NVMTable* nvmtbl) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status MaybeMergeChunkTables() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status CreateNewchunkTable(chunkTable** cktbl);
+  void ReleaseNewChunkTable(chunkTable* cktbl, bool installed)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void InitNVMCompact(std::vector<chunkTable*>& draining, nvmcompact_struct* nvmcompact);
+  Status SwitchFullChunkTables() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status RetainHotKeys(NVMTable* nvmtbl, chunkTable* full, chunkTable* left,
+                     chunkTable* right, const std::string& split_boundary);
 
   static void CompactNVMTable(void* args);
   void printChunkFileNumbers();
   virtual void PrintTimerAudit();
   void MovetoNVMTable();
   static void AddToNVMTable(void* args);
-  void AddToEachChunkTable(int index, std::vector<const char*>& batches);
+  Status AddToEachChunkTable(chunkTable* cktbl, std::vector<const char*>& batches);
   ////////////////////////meggie
 
   // No copying allowed
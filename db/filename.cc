@@ -39,6 +39,11 @@ std::string chunkMetaFileName(const std::string& dbname, uint64_t number){
   assert(number > 0);
   return MakeFileName(dbname, number, "met");
 }
+
+std::string chunkSpareFileName(const std::string& dbname, uint64_t number){
+  assert(number > 0);
+  return MakeFileName(dbname, number, "spr");
+}
 ///////////////////////meggie
 
 std::string TableFileName(const std::string& dbname, uint64_t number) {
@@ -132,6 +137,9 @@ bool ParseFileName(const std::string& filename,
     else if(suffix == Slice(".cnk")){
       *type = kChunkFile;
     }
+    else if(suffix == Slice(".spr")){
+      *type = kSpareChunkFile;
+    }
     //////////////////meggie
     else {
       return false;
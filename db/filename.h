@@ -28,6 +28,7 @@ enum FileType {
   ///////////////////meggie
   kChunkFile,
   kMetaFile,
+  kSpareChunkFile,
   ///////////////////meggie
 };
 
@@ -39,6 +40,8 @@ std::string LogFileName(const std::string& dbname, uint64_t number);
 ///////////////////////meggie
 std::string chunkFileName(const std::string& name, uint64_t number);
 std::string chunkMetaFileName(const std::string& name, uint64_t number);
+//a zeroed chunk file kept by ChunkFilePool, not yet used by any chunk
+std::string chunkSpareFileName(const std::string& name, uint64_t number);
 ///////////////////////meggie
 // Return the name of the sstable with the specified number
 // in the db named by "dbname".  The result will be prefixed with
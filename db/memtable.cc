@@ -16,6 +16,8 @@
 #include <unordered_set>
 ///////////////meggie
 #include "util/debug.h"
+#include "db/nvmtable.h"
+#include "db/nvmwrite_buffer.h"
 ///////////////meggie
 
 namespace leveldb {
@@ -57,25 +59,29 @@ void MemTable::operator delete(void* ptr)
 }
 
 MemTable::MemTable(const InternalKeyComparator& cmp)
-: comparator_(cmp),
-  refs_(0),
-  logfile_number(0),
-  numkeys_(0),
-  bloom_(BLOOMSIZE, BLOOMHASH),
+: logfile_number(0),
   ////////////meggie
   arena_nvm_(nullptr),
   ////////////meggie
+  bloom_(BLOOMSIZE, BLOOMHASH),
+  comparator_(cmp),
+  refs_(0),
+  ////////////meggie
+  nvm_usage_(0),
+  ////////////meggie
+  numkeys_(0),
   table_(comparator_, &arena_) {
       DEBUG_T("in new  MemTable\n");
 }
 
 MemTable::MemTable(const InternalKeyComparator& cmp, ArenaNVM& arena, bool recovery)
-: comparator_(cmp),
-  refs_(0),
-  logfile_number(0),
+: logfile_number(0),
   arena_nvm_(&arena),
-  numkeys_(0),
   bloom_(BLOOMSIZE, BLOOMHASH),
+  comparator_(cmp),
+  refs_(0),
+  nvm_usage_(0),
+  numkeys_(0),
   table_(comparator_, arena_nvm_, recovery){
       DEBUG_T("in new nvm MemTable\n");
 }
@@ -89,9 +95,26 @@ MemTable::~MemTable() {
         DEBUG_T("delete nvm MemTable\n");
         delete arena_nvm_;
     }
+    for(size_t i = 0; i < nvm_tables_.size(); i++)
+        nvm_tables_[i]->Unref();
+    for(size_t i = 0; i < write_buffers_.size(); i++)
+        delete write_buffers_[i];
     //////////meggie
 }
 
+//////////////meggie
+void MemTable::SetNVMTable(NVMTable* nvmtbl){
+    if(!nvm_tables_.empty() && nvm_tables_.back() == nvmtbl)
+        return;
+    nvmtbl->Ref();
+    nvm_tables_.push_back(nvmtbl);
+}
+
+void MemTable::SetWriteBuffer(NVMWriteBuffer* buffer){
+    write_buffers_.push_back(buffer);
+}
+//////////////meggie
+
 
 size_t MemTable::ApproximateMemoryUsage() 
 {
@@ -99,7 +122,7 @@ size_t MemTable::ApproximateMemoryUsage()
         ArenaNVM* nvm_arena =(ArenaNVM*)arena_nvm_;
         return nvm_arena->MemoryUsage();
     }
-    return arena_.MemoryUsage();
+    return arena_.MemoryUsage() + nvm_usage_;
 }
 
 //size_t MemTable::ApproximateArenaMemoryUsage() { return arena_.MemoryUsage(); }
@@ -192,7 +215,8 @@ void* MemTable::GeTableoffset(){
 
 void MemTable::Add(SequenceNumber s, ValueType type,
         const Slice& key,
-        const Slice& value) {
+        const Slice& value,
+        bool concurrent) {
     // Format of an entry is concatenation of:
     //  key_size     : varint32 of internal_key.size()
     //  key bytes    : char[internal_key.size()]
@@ -205,12 +229,34 @@ void MemTable::Add(SequenceNumber s, ValueType type,
             VarintLength(internal_key_size) + internal_key_size +
             VarintLength(val_size) + val_size;
     char* buf = NULL;
+    //////////////meggie
+    bool placed_in_nvm = false;
+    assert(!concurrent || !arena_nvm_);
+    //////////////meggie
 
     if(arena_nvm_) {
         ArenaNVM* nvm_arena =(ArenaNVM*) arena_nvm_;
         buf = nvm_arena->AllocateAlignedNVM(encoded_len);
     }else {
-        buf = arena_.AllocateAligned(encoded_len);
+        //////////////meggie
+        //the writer made room for the batch, and commits the buffer's
+        //group once the batch is in
+        if(!write_buffers_.empty()){
+            buf = write_buffers_.back()->Allocate(encoded_len);
+            nvm_usage_ += encoded_len;
+        }else{
+            if(!nvm_tables_.empty())
+                buf = nvm_tables_.back()->AllocateEntry(key, encoded_len);
+            if(buf){
+                placed_in_nvm = true;
+                nvm_usage_ += encoded_len;
+            }
+            else if(concurrent)
+                buf = arena_.AllocateAlignedConcurrent(encoded_len);
+            else
+                buf = arena_.AllocateAligned(encoded_len);
+        }
+        //////////////meggie
     }
     if(!buf){
         perror("Memory allocation failed");
@@ -246,7 +292,17 @@ void MemTable::Add(SequenceNumber s, ValueType type,
           memcpy(p, value.data(), val_size);
     }
     assert((p + val_size) - buf == encoded_len);
+    //////////////meggie
+    //must be durable before the chunk links it
+    if(placed_in_nvm)
+        flush_cache(buf, encoded_len);
+    //////////////meggie
     
+    //////////////meggie
+    if(concurrent)
+        table_.InsertConcurrently(buf);
+    else
+    //////////////meggie
 #ifdef ENABLE_RECOVERY
     table_.Insert(buf, s);
 #else
@@ -266,6 +322,19 @@ void MemTable::Add(const char* kvitem){
     GetKVLength(kvitem, &key_length, &kvlength);
     char* buf = NULL;
 
+    if(arena_nvm_ && static_cast<ArenaNVM*>(arena_nvm_)->Contains(kvitem)) {
+        //placed here by the writer, nothing to copy
+        table_.Insert(kvitem);
+        return;
+    }
+    for(size_t i = 0; i < write_buffers_.size(); i++){
+        if(write_buffers_[i]->Contains(kvitem)){
+            nvm_usage_ += kvlength;
+            table_.Insert(kvitem);
+            this->IncrKeys();
+            return;
+        }
+    }
     if(arena_nvm_) {
         ArenaNVM* nvm_arena =(ArenaNVM*) arena_nvm_;
         //fprintf(stderr, "kvlength:%lu\n", kvlength);
@@ -292,6 +361,45 @@ void MemTable::Add(const char* kvitem){
 #endif
     DEBUG_T("nvm immutable add, end, buf:%p\n", buf); 
 }
+
+void MemTable::AddBatch(const std::vector<const char*>& kvitems){
+    ArenaNVM* nvm_arena = static_cast<ArenaNVM*>(arena_nvm_);
+    std::vector<const char*> bufs(kvitems.size());
+    for(size_t i = 0; i < kvitems.size(); i++){
+        if(nvm_arena && nvm_arena->Contains(kvitems[i])){
+            bufs[i] = kvitems[i];
+            continue;
+        }
+        size_t kvlength;
+        uint32_t key_length;
+        GetKVLength(kvitems[i], &key_length, &kvlength);
+        char* buf = nvm_arena ? nvm_arena->AllocateAlignedNVM(kvlength) :
+            arena_.AllocateAligned(kvlength);
+        if(!buf){
+            perror("Memory allocation failed");
+            exit(-1);
+        }
+        //flushed with the rest of the batch
+        memcpy(buf, kvitems[i], kvlength);
+        bufs[i] = buf;
+    }
+    if(!bufs.empty())
+        table_.InsertBatch(&bufs[0], bufs.size());
+}
+
+size_t MemTable::MaxBatchBytes(const std::vector<const char*>& kvitems){
+    ArenaNVM* nvm_arena = static_cast<ArenaNVM*>(arena_nvm_);
+    size_t bytes = Table::MaxBatchBytes(kvitems.size());
+    for(size_t i = 0; i < kvitems.size(); i++){
+        if(nvm_arena && nvm_arena->Contains(kvitems[i]))
+            continue;
+        size_t kvlength;
+        uint32_t key_length;
+        GetKVLength(kvitems[i], &key_length, &kvlength);
+        bytes += kvlength + 8;
+    }
+    return bytes;
+}
 //////////////meggie
 
 bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
@@ -299,6 +407,21 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     Slice memkey = key.memtable_key();
     Table::Iterator iter(&table_);
     iter.Seek(memkey.data());
+    return GetAt(iter, key, value, s);
+}
+
+////////////////meggie
+bool MemTable::Get(const LookupKey& key, std::string* value, Status* s,
+        Finger* finger) {
+    Slice memkey = key.memtable_key();
+    Table::Iterator iter(&table_);
+    iter.Seek(memkey.data(), &finger->finger_);
+    return GetAt(iter, key, value, s);
+}
+
+bool MemTable::GetAt(const Table::Iterator& iter, const LookupKey& key,
+        std::string* value, Status* s) {
+////////////////meggie
     if (iter.Valid()) {
         // entry format is:
         //    klength  varint32
@@ -12,8 +12,10 @@
 #include "util/arena.h"
 #include "util/BloomFilter.h"
 
+#include <atomic>
 #include <string>
 #include <unordered_set>
+#include <vector>
 #include "util/debug.h"
 
 namespace leveldb {
@@ -21,6 +23,10 @@ namespace leveldb {
 class InternalKeyComparator;
 class Mutex;
 class MemTableIterator;
+////////////meggie
+class NVMTable;
+class NVMWriteBuffer;
+////////////meggie
 
 class MemTable {
 public:
@@ -80,11 +86,33 @@ public:
 	// Add an entry into memtable that maps key to value at the
 	// specified sequence number and with the specified type.
 	// Typically value will be empty if type==kTypeDeletion.
+	////////////////meggie
+	// With concurrent set, other threads may be adding to this DRAM
+	// memtable at the same time, see SkipList::InsertConcurrently().
 	void Add(SequenceNumber seq, ValueType type,
 			const Slice& key,
-			const Slice& value);
-	////////////////meggie
+			const Slice& value,
+			bool concurrent = false);
+    //link kvitem if it already lives in this table's NVM arena, copy it
+    //there otherwise
     void Add(const char* kvitem);
+    //like Add() for each of kvitems, persisted as one group commit of the
+    //NVM skiplist. Sorted kvitems keep its undo log short
+    void AddBatch(const std::vector<const char*>& kvitems);
+    //the NVM arena bytes AddBatch(kvitems) takes at most
+    size_t MaxBatchBytes(const std::vector<const char*>& kvitems);
+    //place the entries of later Add() calls in the chunk of nvmtbl that
+    //their key maps to, so moving this table to NVM only has to link them.
+    //nvmtbl is kept referenced until this table is deleted.
+    //REQUIRES: external synchronization, like the NVMTable refs
+    void SetNVMTable(NVMTable* nvmtbl);
+    //place the entries of later Add() calls in buffer, ahead of any
+    //NVMTable. The table owns buffer, earlier ones stay mapped for the
+    //entries already indexed. Add(kvitem) links an entry of one of them
+    void SetWriteBuffer(NVMWriteBuffer* buffer);
+    NVMWriteBuffer* GetWriteBuffer() const {
+        return write_buffers_.empty() ? NULL : write_buffers_.back();
+    }
 	////////////////meggie
 
 	//NoveLSM:TODO: To purge
@@ -95,6 +123,13 @@ public:
 	// in *status and return true.
 	// Else, return false.
 	bool Get(const LookupKey& key, std::string* value, Status* s);
+	////////////////meggie
+	// Get() for lookups in ascending key order, each one picks up where
+	// the previous one with the same finger stopped
+	class Finger;
+	bool Get(const LookupKey& key, std::string* value, Status* s,
+			Finger* finger);
+	////////////////meggie
 
 	void SetMemTableHead(void *ptr);
 
@@ -135,19 +170,42 @@ private:
 	KeyComparator comparator_;
 	int refs_;
 
+    ////////////meggie
+    //tables entries were placed in, the last one is used for new entries
+    std::vector<NVMTable*> nvm_tables_;
+    std::vector<NVMWriteBuffer*> write_buffers_;
+    //bytes of entries placed in NVM rather than in arena_
+    std::atomic<size_t> nvm_usage_;
+    ////////////meggie
+
 	//NoveLSM: Num memtable enteries
-	unsigned int numkeys_;
+	std::atomic<unsigned int> numkeys_;
 
 	//NoveLSM: Making them public for easier debugging
 	//TODO: Revert back to private mode
 	//Arena arena_;
 	Table table_;
 
+	////////////////meggie
+	bool GetAt(const Table::Iterator& iter, const LookupKey& key,
+			std::string* value, Status* s);
+	////////////////meggie
+
 	// No copying allowed
 	MemTable(const MemTable&);
 	void operator=(const MemTable&);
 };
 
+////////////////meggie
+class MemTable::Finger {
+public:
+	Finger() { }
+private:
+	friend class MemTable;
+	Table::Finger finger_;
+};
+////////////////meggie
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_DB_MEMTABLE_H_
@@ -0,0 +1,183 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "db/db_impl.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/logging.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class MultiGetTest {
+ public:
+  MultiGetTest() : db_(nullptr), rnd_(301) {
+    dbname_ = test::TmpDir() + "/multiget_test";
+    nvmname_ = test::TmpDir() + "/multiget_test_nvm";
+    DestroyDB(dbname_, Options(), nvmname_);
+    Options options;
+    options.create_if_missing = true;
+    options.write_buffer_size = 64 << 10;
+    options.num_chunk_tables = 4;
+    options.chunk_size = 1 << 20;
+    ASSERT_OK(DB::Open(options, dbname_, &db_, nvmname_));
+  }
+
+  ~MultiGetTest() {
+    delete db_;
+    DestroyDB(dbname_, Options(), nvmname_);
+  }
+
+  DBImpl* dbfull() const { return reinterpret_cast<DBImpl*>(db_); }
+
+  static std::string Key(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+  void Put(int i) {
+    std::string v = Key(i) + "_" + std::string(rnd_.Uniform(200), 'v') +
+                    NumberToString(rnd_.Next());
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), v));
+    model_[Key(i)] = v;
+  }
+
+  // enough other data to push what came before out of the NVM chunks
+  // into the tables
+  void Fill() {
+    for (int i = 0; i < 8000; i++) {
+      char key[32];
+      snprintf(key, sizeof(key), "fill%06d", i);
+      ASSERT_OK(db_->Put(WriteOptions(), key, std::string(1000, 'f')));
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  }
+
+  int NumTableFiles() {
+    int files = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      std::string property;
+      ASSERT_TRUE(db_->GetProperty(
+          "leveldb.num-files-at-level" + NumberToString(level), &property));
+      files += atoi(property.c_str());
+    }
+    return files;
+  }
+
+  void Delete(int i) {
+    ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+    model_.erase(Key(i));
+  }
+
+  // MultiGet() of ids answers what model holds for each of them
+  void Check(const std::vector<int>& ids,
+             const std::map<std::string, std::string>& model,
+             const Snapshot* snapshot = nullptr) {
+    std::vector<std::string> strings;
+    for (size_t i = 0; i < ids.size(); i++) strings.push_back(Key(ids[i]));
+    std::vector<Slice> keys(strings.begin(), strings.end());
+    std::vector<std::string> values;
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::vector<Status> statuses = db_->MultiGet(options, keys, &values);
+    ASSERT_EQ(keys.size(), statuses.size());
+    ASSERT_EQ(keys.size(), values.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      std::map<std::string, std::string>::const_iterator it =
+          model.find(strings[i]);
+      if (it == model.end()) {
+        ASSERT_TRUE(statuses[i].IsNotFound());
+      } else {
+        ASSERT_OK(statuses[i]);
+        ASSERT_EQ(it->second, values[i]);
+      }
+    }
+  }
+
+  std::string dbname_;
+  std::string nvmname_;
+  DB* db_;
+  Random rnd_;
+  std::map<std::string, std::string> model_;
+};
+
+TEST(MultiGetTest, Empty) {
+  std::vector<Slice> keys;
+  std::vector<std::string> values;
+  ASSERT_TRUE(db_->MultiGet(ReadOptions(), keys, &values).empty());
+  std::vector<int> ids;
+  ids.push_back(1);
+  Check(ids, model_);
+}
+
+TEST(MultiGetTest, AllTiers) {
+  // the oldest versions end up in tables, later ones in the NVM chunks
+  // and the memtable
+  for (int i = 0; i < 5000; i++) Put(i);
+  Fill();
+  ASSERT_GT(NumTableFiles(), 0);
+  for (int i = 0; i < 5000; i += 3) Put(i);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  for (int i = 0; i < 5000; i += 7) Delete(i);
+  for (int i = 0; i < 5000; i += 11) Put(i);
+
+  std::vector<int> ids;
+  for (int i = 0; i < 6000; i++) ids.push_back(i);
+  Check(ids, model_);
+
+  // unsorted, with duplicates and keys that were never written
+  ids.clear();
+  for (int i = 0; i < 3000; i++) ids.push_back(rnd_.Uniform(6000));
+  ids.push_back(ids[0]);
+  ids.push_back(ids[0]);
+  Check(ids, model_);
+}
+
+TEST(MultiGetTest, Snapshot) {
+  for (int i = 0; i < 3000; i++) Put(i);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  std::map<std::string, std::string> before = model_;
+  const Snapshot* snapshot = db_->GetSnapshot();
+  for (int i = 0; i < 3000; i += 2) Put(i);
+  for (int i = 1; i < 3000; i += 4) Delete(i);
+  // a chunk flush keeps only the newest version of a key, the snapshot is
+  // read from the memtable and the chunks
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+
+  std::vector<int> ids;
+  for (int i = 0; i < 3000; i++) ids.push_back(rnd_.Uniform(3500));
+  Check(ids, before, snapshot);
+  Check(ids, model_);
+  db_->ReleaseSnapshot(snapshot);
+}
+
+TEST(MultiGetTest, MatchesGet) {
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 2000; i++) Put(rnd_.Uniform(4000));
+    if (round % 2 == 1) Fill();
+  }
+  std::vector<std::string> strings;
+  for (int i = 0; i < 1000; i++) strings.push_back(Key(rnd_.Uniform(4000)));
+  std::vector<Slice> keys(strings.begin(), strings.end());
+  std::vector<std::string> values;
+  std::vector<Status> statuses = db_->MultiGet(ReadOptions(), keys, &values);
+  for (size_t i = 0; i < keys.size(); i++) {
+    std::string value;
+    Status s = db_->Get(ReadOptions(), keys[i], &value);
+    ASSERT_EQ(s.ToString(), statuses[i].ToString());
+    if (s.ok()) ASSERT_EQ(value, values[i]);
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
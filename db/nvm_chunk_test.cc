@@ -0,0 +1,438 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "db/db_impl.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/logging.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+// Holds back the table files a chunk flush starts while blocked, so a test
+// can act while the flush is in flight
+class BlockingTableEnv : public EnvWrapper {
+ public:
+  explicit BlockingTableEnv(Env* base)
+      : EnvWrapper(base), cv_(&mu_), blocked_(false), waiting_(0) { }
+
+  virtual Status NewWritableFile(const std::string& fname,
+                                 WritableFile** result) {
+    if (fname.size() > 4 && fname.compare(fname.size() - 4, 4, ".ldb") == 0) {
+      MutexLock l(&mu_);
+      waiting_++;
+      cv_.SignalAll();
+      while (blocked_) {
+        cv_.Wait();
+      }
+      waiting_--;
+    }
+    return target()->NewWritableFile(fname, result);
+  }
+
+  void Block() {
+    MutexLock l(&mu_);
+    blocked_ = true;
+  }
+
+  void Release() {
+    MutexLock l(&mu_);
+    blocked_ = false;
+    cv_.SignalAll();
+  }
+
+  // until a table file is held back
+  void WaitForBlockedWriter() {
+    MutexLock l(&mu_);
+    while (waiting_ == 0) {
+      cv_.Wait();
+    }
+  }
+
+ private:
+  port::Mutex mu_;
+  port::CondVar cv_;
+  bool blocked_;
+  int waiting_;
+};
+
+class NVMChunkTest {
+ public:
+  NVMChunkTest()
+      : env_(new BlockingTableEnv(Env::Default())), db_(nullptr), rnd_(301) {
+    dbname_ = test::TmpDir() + "/nvm_chunk_test";
+    nvmname_ = test::TmpDir() + "/nvm_chunk_test_nvm";
+    DestroyDB(dbname_, Options(), nvmname_);
+  }
+
+  ~NVMChunkTest() {
+    Close();
+    DestroyDB(dbname_, Options(), nvmname_);
+    delete env_;
+  }
+
+  DBImpl* dbfull() const { return reinterpret_cast<DBImpl*>(db_); }
+
+  // small memtables and chunks, so a few thousand writes fill them
+  Options CurrentOptions() {
+    Options options;
+    options.env = env_;
+    options.create_if_missing = true;
+    options.write_buffer_size = 64 << 10;
+    options.chunk_size = 1 << 20;
+    options.num_chunk_tables = 4;
+    return options;
+  }
+
+  void Reopen(const Options& options) {
+    Close();
+    ASSERT_OK(DB::Open(options, dbname_, &db_, nvmname_));
+  }
+
+  void Close() {
+    delete db_;
+    db_ = nullptr;
+  }
+
+  static std::string Key(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+  void Put(int i, int value_size) {
+    std::string v = Key(i) + "_" + NumberToString(rnd_.Next());
+    v.resize(value_size, 'v');
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), v));
+    model_[Key(i)] = v;
+  }
+
+  void Delete(int i) {
+    ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+    model_.erase(Key(i));
+  }
+
+  std::string Get(const std::string& k, const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::string result;
+    Status s = db_->Get(options, k, &result);
+    if (s.IsNotFound()) {
+      result = "NOT_FOUND";
+    } else if (!s.ok()) {
+      result = s.ToString();
+    }
+    return result;
+  }
+
+  int NumTableFiles() {
+    int files = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      std::string property;
+      ASSERT_TRUE(db_->GetProperty(
+          "leveldb.num-files-at-level" + NumberToString(level), &property));
+      files += atoi(property.c_str());
+    }
+    return files;
+  }
+
+  // Get and an iterator at snapshot find the keys below n that model
+  // holds, and only those
+  void Check(int n, const std::map<std::string, std::string>& model,
+             const Snapshot* snapshot = nullptr) {
+    for (int i = 0; i < n; i++) {
+      std::map<std::string, std::string>::const_iterator it =
+          model.find(Key(i));
+      ASSERT_EQ(it == model.end() ? "NOT_FOUND" : it->second,
+                Get(Key(i), snapshot));
+    }
+    ReadOptions options;
+    options.snapshot = snapshot;
+    Iterator* iter = db_->NewIterator(options);
+    std::map<std::string, std::string>::const_iterator it = model.begin();
+    for (iter->Seek(Key(0)); iter->Valid() && iter->key().compare(Key(n)) < 0;
+         iter->Next(), ++it) {
+      ASSERT_TRUE(it != model.end());
+      ASSERT_EQ(it->first, iter->key().ToString());
+      ASSERT_EQ(it->second, iter->value().ToString());
+    }
+    ASSERT_OK(iter->status());
+    delete iter;
+    ASSERT_TRUE(it == model.end() || it->first >= Key(n));
+  }
+
+  // every key written reads back its newest value
+  void CheckModel() {
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = model_.begin(); it != model_.end(); ++it) {
+      ASSERT_EQ(it->second, Get(it->first));
+    }
+  }
+
+  BlockingTableEnv* env_;
+  std::string dbname_;
+  std::string nvmname_;
+  DB* db_;
+  Random rnd_;
+  std::map<std::string, std::string> model_;
+};
+
+TEST(NVMChunkTest, SplitAndMerge) {
+  Options options = CurrentOptions();
+  options.chunk_partition_type = kRangePartition;
+  options.max_chunk_tables = 8;
+  Reopen(options);
+
+  // the range boundaries are learned from the first move, the keys are
+  // written out of order so that it spans all of them
+  for (int i = 0; i < 4000; i++) Put(i * 7919 % 4000, 20);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(4, dbfull()->TEST_NumChunkTables());
+
+  // the writes then all go to the first quarter of the keys. The cold
+  // chunks are merged, and the chunk taking every insert is split when
+  // it fills
+  int last = 4, splits = 0, merges = 0;
+  for (int round = 0; round < 60; round++) {
+    for (int i = 0; i < 60; i++) Put(rnd_.Uniform(1000), 1000);
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    const int num_chunk_tables = dbfull()->TEST_NumChunkTables();
+    ASSERT_LE(num_chunk_tables, options.max_chunk_tables);
+    if (num_chunk_tables > last) splits++;
+    if (num_chunk_tables < last) merges++;
+    last = num_chunk_tables;
+    if (round % 10 == 0) CheckModel();
+  }
+  ASSERT_GT(splits, 0);
+  ASSERT_GT(merges, 0);
+  CheckModel();
+
+  // the MANIFEST has the partitions the chunks were left in
+  const int num_chunk_tables = dbfull()->TEST_NumChunkTables();
+  Reopen(options);
+  ASSERT_EQ(num_chunk_tables, dbfull()->TEST_NumChunkTables());
+  CheckModel();
+}
+
+TEST(NVMChunkTest, MoveWhileChunkFlushes) {
+  Options options = CurrentOptions();
+  options.num_chunk_tables = 1;
+  Reopen(options);
+
+  // a chunk and then some, the full chunk is switched out and its flush
+  // held back
+  env_->Block();
+  for (int i = 0; i < 1200; i++) Put(i, 1000);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  env_->WaitForBlockedWriter();
+
+  // the memtables still go to NVM meanwhile, and the draining chunk is
+  // read with the new one
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 100; i++) Put(rnd_.Uniform(2000), 1000);
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ(0, NumTableFiles());
+  CheckModel();
+
+  env_->Release();
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  ASSERT_GT(NumTableFiles(), 0);
+  CheckModel();
+}
+
+TEST(NVMChunkTest, ReadsDuringMoves) {
+  Options options = CurrentOptions();
+  options.num_chunk_tables = 2;
+  // every key is hot, none would be flushed otherwise
+  options.hot_key_retention_bytes = 0;
+  Reopen(options);
+
+  // every round rewrites all the keys with its number, the moves and
+  // chunk flushes it causes copy entries without mutex_ while the reader
+  // runs. A key never reads back older than it did before
+  const int kKeys = 500;
+  const int kRounds = 8;
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(1000, '0')));
+  }
+  std::atomic<bool> done(false);
+  std::atomic<int> reads(0);
+  std::thread reader([&]() {
+    Random rnd(302);
+    std::vector<char> newest(kKeys, '0');
+    while (!done.load()) {
+      const int i = rnd.Uniform(kKeys);
+      const std::string value = Get(Key(i));
+      ASSERT_EQ(1000, value.size()) << value;
+      ASSERT_EQ(std::string(1000, value[0]), value);
+      ASSERT_GE(value[0], newest[i]);
+      newest[i] = value[0];
+      reads++;
+    }
+  });
+  for (int round = 1; round <= kRounds; round++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_OK(db_->Put(WriteOptions(), Key(i),
+                         std::string(1000, '0' + round)));
+    }
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  done.store(true);
+  reader.join();
+  ASSERT_GT(reads.load(), 0);
+  ASSERT_GT(NumTableFiles(), 0);
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_EQ(std::string(1000, '0' + kRounds), Get(Key(i)));
+  }
+}
+
+TEST(NVMChunkTest, ReadsAcrossSwitchDuringDrain) {
+  Options options = CurrentOptions();
+  options.num_chunk_tables = 1;
+  Reopen(options);
+
+  env_->Block();
+  for (int i = 0; i < 1200; i++) Put(i, 1000);
+  const Snapshot* snapshot = db_->GetSnapshot();
+  std::map<std::string, std::string> before = model_;
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  env_->WaitForBlockedWriter();
+
+  // the new chunk has newer versions and deletions of keys the draining
+  // one still has
+  for (int i = 0; i < 1200; i += 3) Put(i, 100);
+  for (int i = 1; i < 1200; i += 3) Delete(i);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  Check(1200, model_);
+  Check(1200, before, snapshot);
+
+  // and once the drained chunk is in level-0
+  env_->Release();
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  ASSERT_GT(NumTableFiles(), 0);
+  Check(1200, model_);
+  Check(1200, before, snapshot);
+  db_->ReleaseSnapshot(snapshot);
+}
+
+TEST(NVMChunkTest, ZeroCopyAcrossSwitchAndReopen) {
+  Options options = CurrentOptions();
+  options.num_chunk_tables = 2;
+  options.zero_copy_nvm_move = true;
+  Reopen(options);
+
+  // three chunks of writes, the entries placed in a chunk that is then
+  // switched out are copied to the new one by the move
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 1000; i++) Put(rnd_.Uniform(2000), 1000);
+    for (int i = 0; i < 50; i++) Delete(rnd_.Uniform(2000));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  ASSERT_GT(NumTableFiles(), 0);
+  Check(2000, model_);
+
+  // the last writes are in the chunks and the log, but only the
+  // memtable indexes them
+  for (int i = 0; i < 200; i++) Put(rnd_.Uniform(2000), 1000);
+  Check(2000, model_);
+  Reopen(options);
+  Check(2000, model_);
+  for (int i = 0; i < 200; i++) Put(rnd_.Uniform(2000), 1000);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  Check(2000, model_);
+}
+
+TEST(NVMChunkTest, HotKeysRetained) {
+  Options options = CurrentOptions();
+  options.num_chunk_tables = 1;
+  options.hotness_estimator = kCountMinHotness;
+  Reopen(options);
+
+  // the first 50 keys are written every round and turn hot, the others
+  // once. A chunk's worth of rounds switches the chunk out
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 50; i++) Put(i, 100);
+    for (int i = 0; i < 300; i++) Put(1000 + round * 300 + i, 1000);
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  ASSERT_GT(NumTableFiles(), 0);
+
+  // the newest versions of the hot keys stayed in NVM, most cold keys
+  // went to level-0
+  std::string value;
+  for (int i = 0; i < 50; i++) {
+    ASSERT_OK(dbfull()->TEST_NVMGet(Key(i), &value));
+    ASSERT_EQ(model_[Key(i)], value);
+  }
+  int cold_in_nvm = 0;
+  for (int i = 1000; i < 2200; i++) {
+    if (dbfull()->TEST_NVMGet(Key(i), &value).ok()) cold_in_nvm++;
+  }
+  ASSERT_LT(cold_in_nvm, 600);
+  CheckModel();
+
+  // newer writes of hot keys win over the retained copies
+  for (int i = 0; i < 50; i += 2) Put(i, 100);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  CheckModel();
+  Reopen(options);
+  CheckModel();
+}
+
+TEST(NVMChunkTest, PromotedReadsNeverStale) {
+  Options options = CurrentOptions();
+  options.num_chunk_tables = 1;
+  options.promote_hot_reads = true;
+  options.hotness_estimator = kCountMinHotness;
+  options.hot_key_retention_bytes = 0;
+  Reopen(options);
+
+  // a chunk and then some, the first keys end up in level-0
+  for (int i = 0; i < 1200; i++) Put(i, 1000);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  ASSERT_GT(NumTableFiles(), 0);
+  std::string value;
+  ASSERT_TRUE(dbfull()->TEST_NVMGet(Key(5), &value).IsNotFound());
+
+  // reading it over and over copies it into its chunk
+  for (int i = 0; i < 200; i++) ASSERT_EQ(model_[Key(5)], Get(Key(5)));
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  ASSERT_OK(dbfull()->TEST_NVMGet(Key(5), &value));
+  ASSERT_EQ(model_[Key(5)], value);
+
+  // a newer version is read instead of the copy, in the memtable and once
+  // both have been flushed to level-0, and is what gets copied next
+  Put(5, 1000);
+  for (int i = 0; i < 200; i++) ASSERT_EQ(model_[Key(5)], Get(Key(5)));
+  for (int i = 2000; i < 3200; i++) Put(i, 1000);
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  for (int i = 0; i < 200; i++) ASSERT_EQ(model_[Key(5)], Get(Key(5)));
+  ASSERT_OK(dbfull()->TEST_WaitForNVMWork());
+  ASSERT_OK(dbfull()->TEST_NVMGet(Key(5), &value));
+  ASSERT_EQ(model_[Key(5)], value);
+  CheckModel();
+  Reopen(options);
+  CheckModel();
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
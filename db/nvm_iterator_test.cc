@@ -0,0 +1,249 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/nvmtable.h"
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+#include "leveldb/comparator.h"
+#include "util/arena.h"
+#include "util/coding.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static const size_t kChunkSize = 1 << 20;
+static const int kNumChunks = 4;
+
+static int comparisons = 0;
+
+class CountingComparator : public Comparator {
+ public:
+  virtual const char* Name() const { return "CountingComparator"; }
+  virtual int Compare(const Slice& a, const Slice& b) const {
+    comparisons++;
+    return BytewiseComparator()->Compare(a, b);
+  }
+  virtual void FindShortestSeparator(std::string* start,
+                                     const Slice& limit) const {
+    BytewiseComparator()->FindShortestSeparator(start, limit);
+  }
+  virtual void FindShortSuccessor(std::string* key) const {
+    BytewiseComparator()->FindShortSuccessor(key);
+  }
+};
+
+class NVMIteratorTest {
+ public:
+  NVMIteratorTest() : icmp_(&ucmp_), seq_(0) {
+    std::vector<ArenaNVM*> arenas;
+    for (int i = 0; i < 2 * kNumChunks; i++) {
+      fnames_.push_back(ChunkName(i));
+      unlink(fnames_[i].c_str());
+    }
+    for (int i = 0; i < kNumChunks; i++) {
+      arenas.push_back(new ArenaNVM(&fnames_[i], kChunkSize, false));
+    }
+    nvmtbl_ = new NVMTable(icmp_, arenas, false);
+    nvmtbl_->Ref();
+  }
+
+  ~NVMIteratorTest() {
+    nvmtbl_->Unref();
+    for (size_t i = 0; i < fnames_.size(); i++) unlink(fnames_[i].c_str());
+  }
+
+  static std::string ChunkName(int i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%s/nvm_iterator_test-%d",
+             test::TmpDir().c_str(), i);
+    return buf;
+  }
+
+  static std::string Key(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%06d", i);
+    return buf;
+  }
+
+  // a new version of each key, in the chunk its hash maps to
+  void Write(const std::vector<int>& ids) {
+    std::vector<std::vector<const char*> > batches(kNumChunks);
+    for (size_t i = 0; i < ids.size(); i++) {
+      std::string key = Key(ids[i]);
+      const int index = nvmtbl_->GetChunkTableIndex(key);
+      chunkTable* cktbl = nvmtbl_->cktables_[index];
+      const size_t len = VarintLength(key.size() + 8) + key.size() + 8 +
+                         VarintLength(key.size()) + key.size();
+      char* buf = cktbl->AllocateEntry(len);
+      ASSERT_TRUE(buf != NULL);
+      char* p = EncodeVarint32(buf, key.size() + 8);
+      memcpy(p, key.data(), key.size());
+      p += key.size();
+      EncodeFixed64(p, (++seq_ << 8) | kTypeValue);
+      p += 8;
+      p = EncodeVarint32(p, key.size());
+      memcpy(p, key.data(), key.size());
+      batches[index].push_back(buf);
+      InternalKey ikey(key, seq_, kTypeValue);
+      expected_.push_back(ikey.Encode().ToString());
+    }
+    for (int i = 0; i < kNumChunks; i++) {
+      if (!batches[i].empty()) {
+        ASSERT_OK(nvmtbl_->cktables_[i]->AddBatch(batches[i]));
+      }
+    }
+  }
+
+  // chunk index becomes draining, a fresh chunk takes its place
+  void SwitchOut(int index) {
+    ArenaNVM* arena =
+        new ArenaNVM(&fnames_[kNumChunks + index], kChunkSize, false);
+    nvmtbl_->SwitchChunkTable(index, nvmtbl_->GetNewChunkTable(arena, false));
+  }
+
+  void Sort() {
+    std::sort(expected_.begin(), expected_.end(), Less(&icmp_));
+  }
+
+  struct Less {
+    const InternalKeyComparator* icmp;
+    explicit Less(const InternalKeyComparator* c) : icmp(c) { }
+    bool operator()(const std::string& a, const std::string& b) const {
+      return icmp->Compare(a, b) < 0;
+    }
+  };
+
+  // position of the first expected key >= target
+  int LowerBound(const std::string& target) {
+    return std::lower_bound(expected_.begin(), expected_.end(), target,
+                            Less(&icmp_)) - expected_.begin();
+  }
+
+  void CheckAt(Iterator* iter, int pos) {
+    if (pos < 0 || pos >= static_cast<int>(expected_.size())) {
+      ASSERT_TRUE(!iter->Valid());
+    } else {
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(expected_[pos], iter->key().ToString());
+      ASSERT_EQ(ExtractUserKey(iter->key()).ToString(),
+                iter->value().ToString());
+      ASSERT_EQ(iter->key().ToString(),
+                GetLengthPrefixed(iter->GetNodeKey()));
+    }
+  }
+
+  static std::string GetLengthPrefixed(const char* p) {
+    uint32_t len;
+    p = GetVarint32Ptr(p, p + 5, &len);
+    return std::string(p, len);
+  }
+
+  CountingComparator ucmp_;
+  InternalKeyComparator icmp_;
+  std::vector<std::string> fnames_;
+  NVMTable* nvmtbl_;
+  SequenceNumber seq_;
+  std::vector<std::string> expected_;
+};
+
+TEST(NVMIteratorTest, Empty) {
+  Iterator* iter = nvmtbl_->NewIterator();
+  iter->SeekToFirst();
+  ASSERT_TRUE(!iter->Valid());
+  iter->SeekToLast();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_OK(iter->status());
+  delete iter;
+}
+
+TEST(NVMIteratorTest, ScanAndSeek) {
+  Random rnd(301);
+  std::vector<int> ids;
+  for (int i = 0; i < 2000; i++) ids.push_back(rnd.Uniform(1500));
+  Write(ids);
+  Sort();
+  const int n = expected_.size();
+
+  Iterator* iter = nvmtbl_->NewIterator();
+  int pos = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), pos++) {
+    CheckAt(iter, pos);
+  }
+  ASSERT_EQ(n, pos);
+  pos = n - 1;
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), pos--) {
+    CheckAt(iter, pos);
+  }
+  ASSERT_EQ(-1, pos);
+
+  // random seeks followed by walks that turn around
+  for (int i = 0; i < 200; i++) {
+    InternalKey target(Key(rnd.Uniform(1600)), rnd.Uniform(seq_ + 1),
+                       kValueTypeForSeek);
+    pos = LowerBound(target.Encode().ToString());
+    iter->Seek(target.Encode());
+    CheckAt(iter, pos);
+    for (int step = 0; step < 20 && iter->Valid(); step++) {
+      if (rnd.OneIn(2)) {
+        iter->Next();
+        pos++;
+      } else {
+        iter->Prev();
+        pos--;
+      }
+      CheckAt(iter, pos);
+    }
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+}
+
+TEST(NVMIteratorTest, DrainingChunksAreMerged) {
+  std::vector<int> ids;
+  for (int i = 0; i < 1000; i++) ids.push_back(i);
+  Write(ids);
+  SwitchOut(1);
+  SwitchOut(3);
+  // newer versions of every key, the old ones are still draining
+  Write(ids);
+  Sort();
+
+  Iterator* iter = nvmtbl_->NewIterator();
+  int pos = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), pos++) {
+    CheckAt(iter, pos);
+  }
+  ASSERT_EQ(2000, pos);
+  pos = 1999;
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), pos--) {
+    CheckAt(iter, pos);
+  }
+  ASSERT_EQ(-1, pos);
+  delete iter;
+}
+
+TEST(NVMIteratorTest, NextComparesAlongOnePath) {
+  std::vector<int> ids;
+  for (int i = 0; i < 4000; i++) ids.push_back(i);
+  Write(ids);
+  Iterator* iter = nvmtbl_->NewIterator();
+  iter->SeekToFirst();
+  comparisons = 0;
+  int n = 0;
+  for (; iter->Valid(); iter->Next()) n++;
+  ASSERT_EQ(4000, n);
+  // a linear merge of four chunks compares three times per entry
+  ASSERT_LE(comparisons, 2 * n);
+  delete iter;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
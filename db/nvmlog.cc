@@ -0,0 +1,196 @@
+/*************************************************************************
+	> File Name: nvmlog.cc
+	> Author: Meggie
+	> Mail: 1224642332@qq.com
+	> Created Time: Sat 17 Oct 2026 03:12:40 PM CST
+ ************************************************************************/
+#include "db/nvmlog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "port/cache_flush.h"
+#include "util/debug.h"
+
+namespace leveldb{
+namespace {
+const uint64_t kNVMLogMagic = 0x6e766d6c6f673031ull;   //"nvmlog01"
+//the header takes a cache line of its own, records start after it
+const size_t kHeaderSize = CACHE_LINE_SIZE;
+
+Status NVMLogError(const std::string& context, int error_number){
+    return Status::IOError(context, strerror(error_number));
+}
+
+class NVMLogSequentialFile : public SequentialFile{
+    public:
+        NVMLogSequentialFile(const std::string& fname, int fd, uint64_t tail)
+            : fname_(fname), fd_(fd), tail_(tail), pos_(0){ }
+        virtual ~NVMLogSequentialFile(){ close(fd_); }
+
+        virtual Status Read(size_t n, Slice* result, char* scratch){
+            if(n > tail_ - pos_)
+                n = tail_ - pos_;
+            size_t done = 0;
+            while(done < n){
+                ssize_t r = pread(fd_, scratch + done, n - done,
+                        kHeaderSize + pos_ + done);
+                if(r < 0){
+                    if(errno == EINTR)
+                        continue;
+                    *result = Slice(scratch, 0);
+                    return NVMLogError(fname_, errno);
+                }
+                if(r == 0)
+                    break;
+                done += r;
+            }
+            pos_ += done;
+            *result = Slice(scratch, done);
+            return Status::OK();
+        }
+
+        virtual Status Skip(uint64_t n){
+            pos_ = (n > tail_ - pos_) ? tail_ : pos_ + n;
+            return Status::OK();
+        }
+
+    private:
+        const std::string fname_;
+        int fd_;
+        const uint64_t tail_;
+        uint64_t pos_;
+};
+}
+
+NVMLogFile::NVMLogFile(const std::string& fname, int fd, char* base,
+        size_t mapped)
+    : fname_(fname), fd_(fd), base_(base), mapped_(mapped),
+      size_(0), synced_(0){
+}
+
+NVMLogFile::~NVMLogFile(){
+    Close();
+}
+
+Status NVMLogFile::Open(const std::string& fname, size_t capacity,
+        WritableFile** result){
+    *result = NULL;
+    int fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0664);
+    if(fd < 0)
+        return NVMLogError(fname, errno);
+    const size_t mapped = kHeaderSize + capacity;
+    if(ftruncate(fd, mapped) != 0){
+        Status s = NVMLogError(fname, errno);
+        close(fd);
+        return s;
+    }
+    char* base = reinterpret_cast<char*>(mmap(NULL, mapped,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if(base == MAP_FAILED){
+        Status s = NVMLogError(fname, errno);
+        close(fd);
+        return s;
+    }
+    //the tail is durable before the magic says the file is an NVM log
+    *reinterpret_cast<uint64_t*>(base + sizeof(uint64_t)) = 0;
+    flush_cache(base, kHeaderSize);
+    *reinterpret_cast<uint64_t*>(base) = kNVMLogMagic;
+    flush_cache(base, kHeaderSize);
+    *result = new NVMLogFile(fname, fd, base, mapped);
+    return Status::OK();
+}
+
+Status NVMLogFile::Grow(size_t needed){
+    size_t mapped = mapped_;
+    while(mapped < needed)
+        mapped *= 2;
+    if(ftruncate(fd_, mapped) != 0)
+        return NVMLogError(fname_, errno);
+    void* base = mremap(base_, mapped_, mapped, MREMAP_MAYMOVE);
+    if(base == MAP_FAILED)
+        return NVMLogError(fname_, errno);
+    DEBUG_T("nvm log grows from %zu to %zu\n", mapped_, mapped);
+    base_ = reinterpret_cast<char*>(base);
+    mapped_ = mapped;
+    return Status::OK();
+}
+
+Status NVMLogFile::Append(const Slice& data){
+    if(base_ == NULL)
+        return Status::IOError(fname_, "log already closed");
+    if(kHeaderSize + size_ + data.size() > mapped_){
+        Status s = Grow(kHeaderSize + size_ + data.size());
+        if(!s.ok())
+            return s;
+    }
+    memcpy(base_ + kHeaderSize + size_, data.data(), data.size());
+    size_ += data.size();
+    return Status::OK();
+}
+
+Status NVMLogFile::Flush(){
+    //the records are in the page cache already, a crash of the process
+    //keeps whatever the tail covers
+    if(base_ != NULL)
+        __atomic_store_n(Tail(), size_, __ATOMIC_RELEASE);
+    return Status::OK();
+}
+
+Status NVMLogFile::Sync(){
+    if(base_ == NULL)
+        return Status::IOError(fname_, "log already closed");
+    if(size_ > synced_)
+        flush_cache(base_ + kHeaderSize + synced_, size_ - synced_);
+    __atomic_store_n(Tail(), size_, __ATOMIC_RELEASE);
+    flush_cache(Tail(), sizeof(uint64_t));
+    synced_ = size_;
+    return Status::OK();
+}
+
+Status NVMLogFile::Close(){
+    if(base_ == NULL)
+        return Status::OK();
+    Status s = Sync();
+    munmap(base_, mapped_);
+    close(fd_);
+    base_ = NULL;
+    fd_ = -1;
+    return s;
+}
+
+bool IsNVMLogFile(const std::string& fname){
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    uint64_t magic = 0;
+    bool is_nvm = pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+        magic == kNVMLogMagic;
+    close(fd);
+    return is_nvm;
+}
+
+Status NewNVMLogSequentialFile(const std::string& fname,
+        SequentialFile** result){
+    *result = NULL;
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0)
+        return NVMLogError(fname, errno);
+    uint64_t header[2];
+    struct stat st;
+    if(pread(fd, header, sizeof(header), 0) != sizeof(header) ||
+            header[0] != kNVMLogMagic || fstat(fd, &st) != 0){
+        close(fd);
+        return Status::Corruption(fname, "not an nvm log");
+    }
+    //a torn tail never points past the file
+    uint64_t tail = header[1];
+    if(tail > static_cast<uint64_t>(st.st_size) - kHeaderSize)
+        tail = st.st_size - kHeaderSize;
+    *result = new NVMLogSequentialFile(fname, fd, tail);
+    return Status::OK();
+}
+}
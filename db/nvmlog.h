@@ -0,0 +1,66 @@
+/*************************************************************************
+	> File Name: nvmlog.h
+	> Author: Meggie
+	> Mail: 1224642332@qq.com
+	> Created Time: Sat 17 Oct 2026 03:12:40 PM CST
+ ************************************************************************/
+#ifndef STORAGE_LEVELDB_DB_NVMLOG_H_
+#define STORAGE_LEVELDB_DB_NVMLOG_H_
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include "leveldb/env.h"
+#include "leveldb/status.h"
+
+namespace leveldb{
+//a write-ahead log kept in a mmap'd NVM file. The records log::Writer
+//appends are copied into the mapping and made durable by flushing their
+//cache lines, so a sync write costs no system call. The file starts with
+//a header of its own, log::Reader sees only the records after it.
+//
+//header: magic | tail, bytes of records. Flush() moves the tail, which
+//survives the process. Sync() persists the records and then the tail,
+//a tail that runs past persisted records after a power failure is
+//caught by the record checksums.
+class NVMLogFile : public WritableFile{
+    public:
+        //capacity is what is mapped at first, the file grows beyond it
+        //as records need
+        static Status Open(const std::string& fname, size_t capacity,
+                WritableFile** result);
+        virtual ~NVMLogFile();
+
+        virtual Status Append(const Slice& data);
+        virtual Status Close();
+        virtual Status Flush();
+        virtual Status Sync();
+
+    private:
+        NVMLogFile(const std::string& fname, int fd, char* base,
+                size_t mapped);
+        Status Grow(size_t needed);
+        uint64_t* Tail() const {
+            return reinterpret_cast<uint64_t*>(base_ + sizeof(uint64_t));
+        }
+
+        const std::string fname_;
+        int fd_;
+        char* base_;
+        size_t mapped_;
+        //bytes of records appended, and those already durable
+        size_t size_;
+        size_t synced_;
+
+        NVMLogFile(const NVMLogFile&);
+        void operator=(const NVMLogFile&);
+};
+
+//true if fname holds a log written by NVMLogFile
+bool IsNVMLogFile(const std::string& fname);
+
+//the records of the NVM log fname, up to its tail, for log::Reader
+Status NewNVMLogSequentialFile(const std::string& fname,
+        SequentialFile** result);
+}
+#endif
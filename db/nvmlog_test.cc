@@ -0,0 +1,159 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/nvmlog.h"
+#include <string>
+#include <vector>
+#include "db/log_reader.h"
+#include "db/log_writer.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class NVMLogTest {
+ public:
+  NVMLogTest() {
+    fname_ = test::TmpDir() + "/nvmlog_test.log";
+    Env::Default()->DeleteFile(fname_);
+  }
+
+  ~NVMLogTest() { Env::Default()->DeleteFile(fname_); }
+
+  // the records log::Reader reads back from fname_
+  std::vector<std::string> ReadAll() {
+    std::vector<std::string> records;
+    SequentialFile* file;
+    ASSERT_OK(NewNVMLogSequentialFile(fname_, &file));
+    log::Reader reader(file, nullptr, true, 0);
+    std::string scratch;
+    Slice record;
+    while (reader.ReadRecord(&record, &scratch)) {
+      records.push_back(record.ToString());
+    }
+    delete file;
+    return records;
+  }
+
+  std::string fname_;
+};
+
+static std::string Record(int i, size_t n) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "record%06d:", i);
+  return std::string(buf) + std::string(n, 'a' + i % 26);
+}
+
+TEST(NVMLogTest, ReadBack) {
+  WritableFile* file;
+  ASSERT_OK(NVMLogFile::Open(fname_, 1 << 20, &file));
+  ASSERT_TRUE(IsNVMLogFile(fname_));
+  log::Writer writer(file);
+  Random rnd(301);
+  std::vector<std::string> written;
+  for (int i = 0; i < 200; i++) {
+    written.push_back(Record(i, rnd.Uniform(3 * log::kBlockSize)));
+    ASSERT_OK(writer.AddRecord(written.back()));
+    if (i % 10 == 0) ASSERT_OK(file->Sync());
+  }
+  ASSERT_OK(file->Close());
+  ASSERT_TRUE(ReadAll() == written);
+  delete file;
+}
+
+TEST(NVMLogTest, TailOnlyCoversFlushed) {
+  WritableFile* file;
+  ASSERT_OK(NVMLogFile::Open(fname_, 1 << 20, &file));
+  log::Writer writer(file);
+  ASSERT_OK(writer.AddRecord("first"));
+  ASSERT_OK(writer.AddRecord("second"));
+  ASSERT_TRUE(ReadAll().size() == 2);
+
+  // appended past the tail, a reader stops before it
+  ASSERT_OK(file->Append("not yet a record"));
+  std::vector<std::string> records = ReadAll();
+  ASSERT_EQ(2, records.size());
+  ASSERT_EQ("first", records[0]);
+  ASSERT_EQ("second", records[1]);
+  delete file;
+}
+
+TEST(NVMLogTest, Grow) {
+  WritableFile* file;
+  ASSERT_OK(NVMLogFile::Open(fname_, 4096, &file));
+  log::Writer writer(file);
+  std::vector<std::string> written;
+  for (int i = 0; i < 100; i++) {
+    written.push_back(Record(i, 10000));
+    ASSERT_OK(writer.AddRecord(written.back()));
+  }
+  ASSERT_OK(file->Sync());
+  ASSERT_TRUE(ReadAll() == written);
+  delete file;
+}
+
+TEST(NVMLogTest, NotAnNVMLog) {
+  ASSERT_OK(WriteStringToFile(Env::Default(), "plain log", fname_));
+  ASSERT_TRUE(!IsNVMLogFile(fname_));
+  SequentialFile* file;
+  ASSERT_TRUE(NewNVMLogSequentialFile(fname_, &file).IsCorruption());
+}
+
+// what the log holds after a reopen is read before the older versions
+// that were moved to the NVM chunks
+TEST(NVMLogTest, Reopen) {
+  std::string dbname = test::TmpDir() + "/nvmlog_test_db";
+  std::string nvmname = test::TmpDir() + "/nvmlog_test_db_nvm";
+  for (int nvm_log = 0; nvm_log < 2; nvm_log++) {
+    DestroyDB(dbname, Options(), nvmname);
+    Options options;
+    options.create_if_missing = true;
+    options.write_buffer_size = 64 << 10;
+    options.num_chunk_tables = 4;
+    options.chunk_size = 1 << 20;
+    options.nvm_log = (nvm_log == 1);
+    DB* db;
+    ASSERT_OK(DB::Open(options, dbname, &db, nvmname));
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(db->Put(WriteOptions(), Record(i, 0), "v1"));
+    }
+    for (int i = 0; i < 3000; i++) {
+      ASSERT_OK(db->Put(WriteOptions(), Record(1000 + i, 0),
+                        std::string(100, 'f')));
+    }
+    WriteOptions sync;
+    sync.sync = true;
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(db->Put(sync, Record(i, 0), "v2"));
+    }
+
+    for (int round = 0; round < 2; round++) {
+      delete db;
+      ASSERT_OK(DB::Open(options, dbname, &db, nvmname));
+      std::string value;
+      for (int i = 0; i < 100; i++) {
+        ASSERT_OK(db->Get(ReadOptions(), Record(i, 0), &value));
+        ASSERT_EQ("v2", value);
+      }
+      for (int i = 0; i < 3000; i++) {
+        ASSERT_OK(db->Get(ReadOptions(), Record(1000 + i, 0), &value));
+      }
+      // the next memtable switch moves the recovered records on
+      for (int i = 0; i < 1000; i++) {
+        ASSERT_OK(db->Put(WriteOptions(), Record(5000 + i, 0),
+                          std::string(100, 'g')));
+      }
+    }
+    delete db;
+  }
+  DestroyDB(dbname, Options(), nvmname);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -6,86 +6,722 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <cstdlib>
+#include <algorithm>
 #include "db/nvmtable.h"
 #include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "table/iterator_wrapper.h"
 #include "util/coding.h"
 #include "util/debug.h"
 #include "util/multi_bloomfilter.h"
 #include "port/cache_flush.h"
 
-#define BIT_BLOOM_SIZE 1024 * 1024
+#define BIT_BLOOM_MIN_SIZE (64 * 1024)
 #define BIT_BLOOM_HASH 4
 namespace leveldb{
 
+namespace {
+    //Walks range partitioned chunks in key order. Seek only positions the
+    //chunk that can hold the target, later chunks are opened on demand.
+    class ChunkConcatIterator : public Iterator {
+        public:
+            explicit ChunkConcatIterator(NVMTable* nvmtbl)
+                : nvmtbl_(nvmtbl),
+                  index_(-1),
+                  iter_(nullptr) { }
+            virtual ~ChunkConcatIterator() { delete iter_; }
+            virtual bool Valid() const {
+                return iter_ != nullptr && iter_->Valid();
+            }
+            virtual void SeekToFirst() {
+                SetChunk(0);
+                if(iter_ != nullptr) iter_->SeekToFirst();
+                SkipEmptyChunksForward();
+            }
+            virtual void SeekToLast() {
+                SetChunk(nvmtbl_->NumChunkTables() - 1);
+                if(iter_ != nullptr) iter_->SeekToLast();
+                SkipEmptyChunksBackward();
+            }
+            virtual void Seek(const Slice& target) {
+                SetChunk(nvmtbl_->GetChunkTableIndex(ExtractUserKey(target)));
+                if(iter_ != nullptr) iter_->Seek(target);
+                SkipEmptyChunksForward();
+            }
+            virtual void Next() {
+                assert(Valid());
+                iter_->Next();
+                SkipEmptyChunksForward();
+            }
+            virtual void Prev() {
+                assert(Valid());
+                iter_->Prev();
+                SkipEmptyChunksBackward();
+            }
+            virtual Slice key() const {
+                assert(Valid());
+                return iter_->key();
+            }
+            virtual Slice value() const {
+                assert(Valid());
+                return iter_->value();
+            }
+            virtual Status status() const {
+                return iter_ != nullptr ? iter_->status() : Status::OK();
+            }
+            virtual const char* GetNodeKey() {
+                assert(Valid());
+                return iter_->GetNodeKey();
+            }
+        private:
+            void SetChunk(int index) {
+                delete iter_;
+                iter_ = nullptr;
+                index_ = index;
+                if(index_ >= 0 && index_ < nvmtbl_->NumChunkTables())
+                    iter_ = nvmtbl_->getchunkTableIterator(index_);
+            }
+            void SkipEmptyChunksForward() {
+                while(iter_ != nullptr && !iter_->Valid()){
+                    SetChunk(index_ + 1);
+                    if(iter_ != nullptr) iter_->SeekToFirst();
+                }
+            }
+            void SkipEmptyChunksBackward() {
+                while(iter_ != nullptr && !iter_->Valid()){
+                    SetChunk(index_ - 1);
+                    if(iter_ != nullptr) iter_->SeekToLast();
+                }
+            }
+
+            NVMTable* nvmtbl_;
+            int index_;
+            Iterator* iter_;
+    };
+
+    //Merges the chunks of a hash partitioned table, where every chunk
+    //covers the whole key space. Children are the leaves of a loser tree:
+    //each inner node remembers the loser of the match played there, so
+    //after the winner moves only the matches on its path to the root are
+    //replayed, log2(n) comparisons per Next() instead of n - 1.
+    class ChunkMergingIterator : public Iterator {
+        public:
+            ChunkMergingIterator(const Comparator* comparator, 
+                    Iterator** children, int n)
+                : comparator_(comparator),
+                  children_(new IteratorWrapper[n]),
+                  n_(n),
+                  losers_(n, -1),
+                  winner_(-1),
+                  direction_(kForward) {
+                for(int i = 0; i < n; i++)
+                    children_[i].Set(children[i]);
+            }
+            virtual ~ChunkMergingIterator() { delete[] children_; }
+            virtual bool Valid() const {
+                return winner_ >= 0 && children_[winner_].Valid();
+            }
+            virtual void SeekToFirst() {
+                for(int i = 0; i < n_; i++)
+                    children_[i].SeekToFirst();
+                direction_ = kForward;
+                Rebuild();
+            }
+            virtual void SeekToLast() {
+                for(int i = 0; i < n_; i++)
+                    children_[i].SeekToLast();
+                direction_ = kReverse;
+                Rebuild();
+            }
+            virtual void Seek(const Slice& target) {
+                for(int i = 0; i < n_; i++)
+                    children_[i].Seek(target);
+                direction_ = kForward;
+                Rebuild();
+            }
+            virtual void Next() {
+                assert(Valid());
+                //same as MergingIterator, the other children are moved
+                //past key() before turning around
+                if(direction_ != kForward){
+                    for(int i = 0; i < n_; i++){
+                        IteratorWrapper* child = &children_[i];
+                        if(i != winner_){
+                            child->Seek(key());
+                            if(child->Valid() && 
+                                    comparator_->Compare(key(), child->key()) == 0)
+                                child->Next();
+                        }
+                    }
+                    direction_ = kForward;
+                    children_[winner_].Next();
+                    Rebuild();
+                    return;
+                }
+                children_[winner_].Next();
+                Replay(winner_);
+            }
+            virtual void Prev() {
+                assert(Valid());
+                if(direction_ != kReverse){
+                    for(int i = 0; i < n_; i++){
+                        IteratorWrapper* child = &children_[i];
+                        if(i != winner_){
+                            child->Seek(key());
+                            if(child->Valid())
+                                child->Prev();
+                            else
+                                child->SeekToLast();
+                        }
+                    }
+                    direction_ = kReverse;
+                    children_[winner_].Prev();
+                    Rebuild();
+                    return;
+                }
+                children_[winner_].Prev();
+                Replay(winner_);
+            }
+            virtual Slice key() const {
+                assert(Valid());
+                return children_[winner_].key();
+            }
+            virtual Slice value() const {
+                assert(Valid());
+                return children_[winner_].value();
+            }
+            virtual Status status() const {
+                Status status;
+                for(int i = 0; i < n_; i++){
+                    status = children_[i].status();
+                    if(!status.ok())
+                        break;
+                }
+                return status;
+            }
+            virtual const char* GetNodeKey() {
+                assert(Valid());
+                return children_[winner_].iter()->GetNodeKey();
+            }
+        private:
+            //true if child a goes out before child b, exhausted children
+            //lose every match
+            bool Beats(int a, int b) const {
+                if(!children_[b].Valid())
+                    return true;
+                if(!children_[a].Valid())
+                    return false;
+                int r = comparator_->Compare(children_[a].key(), 
+                        children_[b].key());
+                if(r == 0)
+                    return a < b;
+                return direction_ == kForward ? r < 0 : r > 0;
+            }
+            //leaf i is node n_ + i, inner node j has children 2j and 2j + 1
+            void Rebuild() {
+                std::vector<int> winners(2 * n_);
+                for(int i = 0; i < n_; i++)
+                    winners[n_ + i] = i;
+                for(int j = n_ - 1; j >= 1; j--){
+                    int a = winners[2 * j], b = winners[2 * j + 1];
+                    if(Beats(a, b)){
+                        winners[j] = a;
+                        losers_[j] = b;
+                    }
+                    else{
+                        winners[j] = b;
+                        losers_[j] = a;
+                    }
+                }
+                winner_ = winners[1];
+            }
+            void Replay(int child) {
+                int winner = child;
+                for(int j = (n_ + child) / 2; j >= 1; j /= 2){
+                    if(Beats(losers_[j], winner))
+                        std::swap(losers_[j], winner);
+                }
+                winner_ = winner;
+            }
+
+            const Comparator* comparator_;
+            IteratorWrapper* children_;
+            int n_;
+            std::vector<int> losers_;
+            int winner_;
+            enum Direction {
+                kForward,
+                kReverse
+            };
+            Direction direction_;
+    };
+
+    Iterator* NewChunkMergingIterator(const Comparator* comparator, 
+            std::vector<Iterator*>& list) {
+        if(list.empty())
+            return NewEmptyIterator();
+        if(list.size() == 1)
+            return list[0];
+        return new ChunkMergingIterator(comparator, &list[0], list.size());
+    }
+}  // namespace
+
     Iterator* chunkTable::NewIterator(){
         return table_->NewIterator();
     }
 
+    //a bit per 8 bytes of chunk, about 16 bits for a 128 byte entry
+    static size_t ChunkFilterBits(size_t capacity){
+        return std::max<size_t>(capacity / 8, BIT_BLOOM_MIN_SIZE);
+    }
+
     chunkTable::chunkTable(const InternalKeyComparator& comparator, 
             ArenaNVM* arena, bool recovery)
         :refs_(0),
-        arena_(arena)
-        //bbf_(new BitBloomFilter(BIT_BLOOM_HASH, BIT_BLOOM_SIZE))
+        arena_(arena),
+        bbf_(new BitBloomFilter(BIT_BLOOM_HASH, 
+                    ChunkFilterBits(arena->Capacity()))),
+        filter_ready_(recovery ? nullptr : this),
+        chunk_number_(0),
+        insert_rate_(0)
         {
         table_ = new MemTable(comparator, *arena, recovery);
         table_->isNVMMemtable = true;
         table_->Ref();
     }
     chunkTable::~chunkTable(){
-        //delete bbf_;
+        delete bbf_;
         table_->Unref();
         arena_ = nullptr;
         assert(refs_ == 0);
     }
+
+    void chunkTable::AddToFilter(const char* kvitem){
+        uint32_t key_length;
+        const char* key_ptr = GetVarint32Ptr(kvitem, kvitem + 5, &key_length);
+        bbf_->Add(Slice(key_ptr, key_length - 8));
+    }
+
     void chunkTable::Add(const char* kvitem){
+        AddToFilter(kvitem);
         table_->Add(kvitem);
     }
 
+    Status chunkTable::AddBatch(const std::vector<const char*>& kvitems){
+        if(!arena_->MakeRoom(table_->MaxBatchBytes(kvitems)))
+            return Status::IOError("chunk file cannot grow", arena_->mfile);
+        for(size_t i = 0; i < kvitems.size(); i++)
+            AddToFilter(kvitems[i]);
+        table_->AddBatch(kvitems);
+        return Status::OK();
+    }
+
+    bool chunkTable::MaybeContains(const Slice& user_key){
+        if(!FilterReady())
+            return true;
+        return bbf_->Query(user_key);
+    }
+
+    //runs on the nvm thread, the only one adding to chunks, while readers
+    //keep ignoring the filter until it is marked ready
+    void chunkTable::RebuildFilter(){
+        assert(!FilterReady());
+        bbf_->Reset();
+        Iterator* iter = NewIterator();
+        for(iter->SeekToFirst(); iter->Valid(); iter->Next()){
+            bbf_->Add(ExtractUserKey(iter->key()));
+        }
+        delete iter;
+        filter_ready_.Release_Store(this);
+    }
+
+    //chunk number, commit stamp, filter bytes, then the filter
+    size_t chunkTable::FilterRecordSize(){
+        return 3 * sizeof(uint64_t) + bbf_->bytes_;
+    }
+
+    void chunkTable::SaveBloomFilter(char* start){
+        EncodeFixed64(start, chunk_number_);
+        EncodeFixed64(start + 8, CommitStamp());
+        EncodeFixed64(start + 16, bbf_->bytes_);
+        memcpy(start + 24, bbf_->bits_, bbf_->bytes_);
+    }
+
+    bool chunkTable::RecoverBloomFilter(const char* start){
+        if(DecodeFixed64(start) != chunk_number_ ||
+                DecodeFixed64(start + 8) != CommitStamp() ||
+                DecodeFixed64(start + 16) != bbf_->bytes_)
+            return false;
+        memcpy(bbf_->bits_, start + 24, bbf_->bytes_);
+        filter_ready_.Release_Store(this);
+        return true;
+    }
+
+    char* chunkTable::AllocateEntry(size_t bytes){
+        if(arena_->MemoryUsage() + bytes > arena_->Capacity())
+            return NULL;
+        return arena_->AllocateAlignedNVM(bytes);
+    }
+
     bool chunkTable::Get(const LookupKey& key, std::string* value, Status* s){
         return table_->Get(key, value, s);
     }
+
+    bool chunkTable::Get(const LookupKey& key, std::string* value, Status* s,
+            MemTable::Finger* finger){
+        return table_->Get(key, value, s, finger);
+    }
     NVMTable::NVMTable(const InternalKeyComparator& comparator, 
             std::vector<ArenaNVM*>& arenas,
             bool recovery):
-            refs_(0){
+            refs_(0),
+            range_partitioned_(false),
+            has_range_boundaries_(false){
                 comparator_ = &comparator;
-                assert(arenas.size() == kNumChunkTable);
-                for(int i = 0; i < kNumChunkTable; i++){
+                assert(!arenas.empty());
+                cktables_.resize(arenas.size());
+                draining_.resize(arenas.size(), NULL);
+                for(int i = 0; i < NumChunkTables(); i++){
                     chunkTable* ckTbl = new chunkTable(comparator, arenas[i], recovery);
+                    ckTbl->Ref();
                     cktables_[i] = ckTbl;
                 }
     }
 
-    NVMTable::NVMTable(const InternalKeyComparator& comparator)
-        :refs_(0){
+    NVMTable::NVMTable(const InternalKeyComparator& comparator, 
+            int num_chunk_tables, bool range_partitioned)
+        :refs_(0),
+         range_partitioned_(range_partitioned),
+         has_range_boundaries_(false){
         comparator_ = &comparator;
-        for(int i = 0; i < kNumChunkTable; i++){
-            cktables_[i] = NULL;
-        }
+        assert(num_chunk_tables > 0);
+        cktables_.resize(num_chunk_tables, NULL);
+        draining_.resize(num_chunk_tables, NULL);
     } 
 
     NVMTable::~NVMTable(){ 
-        for(int i = 0; i < kNumChunkTable; i++){
+        for(int i = 0; i < NumChunkTables(); i++){
+            if(cktables_[i])
+                cktables_[i]->Unref();
+            if(draining_[i])
+                draining_[i]->Unref();
+        }
+    }
+
+    NVMTable* NVMTable::Clone() const {
+        NVMTable* nvmtbl = new NVMTable(*comparator_, NumChunkTables(), 
+                range_partitioned_);
+        nvmtbl->has_range_boundaries_ = has_range_boundaries_;
+        nvmtbl->range_boundaries_ = range_boundaries_;
+        nvmtbl->hash_boundaries_ = hash_boundaries_;
+        for(int i = 0; i < NumChunkTables(); i++){
+            nvmtbl->cktables_[i] = cktables_[i];
             if(cktables_[i])
-                delete cktables_[i];
+                cktables_[i]->Ref();
+            nvmtbl->draining_[i] = draining_[i];
+            if(draining_[i])
+                draining_[i]->Ref();
+        }
+        return nvmtbl;
+    }
+
+    void NVMTable::SetChunkTable(int index, chunkTable* cktbl){
+        cktbl->Ref();
+        if(cktables_[index]){
+            //same partition, keep its insert history
+            cktbl->SetInsertRate(cktables_[index]->InsertRate());
+            cktables_[index]->Unref();
+        }
+        cktables_[index] = cktbl;
+    }
+
+    void NVMTable::SwitchChunkTable(int index, chunkTable* cktbl){
+        assert(draining_[index] == NULL);
+        draining_[index] = cktables_[index];
+        cktables_[index] = NULL;
+        SetChunkTable(index, cktbl);
+        cktbl->SetInsertRate(draining_[index]->InsertRate());
+    }
+
+    void NVMTable::SetDrainingChunkTable(int index, chunkTable* cktbl){
+        cktbl->Ref();
+        if(draining_[index])
+            draining_[index]->Unref();
+        draining_[index] = cktbl;
+    }
+
+    void NVMTable::RemoveDrainingChunkTable(chunkTable* cktbl){
+        for(int i = 0; i < NumChunkTables(); i++){
+            if(draining_[i] == cktbl){
+                draining_[i] = NULL;
+                cktbl->Unref();
+            }
+        }
+    }
+
+    bool NVMTable::HasDrainingChunkTables() const {
+        for(int i = 0; i < NumChunkTables(); i++){
+            if(draining_[i])
+                return true;
+        }
+        return false;
+    }
+
+    void NVMTable::GetDrainingChunkTables(std::vector<chunkTable*>* draining) const {
+        draining->clear();
+        for(int i = 0; i < NumChunkTables(); i++){
+            //partitions sharing a draining chunk are adjacent
+            if(draining_[i] && (draining->empty() || draining->back() != draining_[i]))
+                draining->push_back(draining_[i]);
+        }
+    }
+
+    void NVMTable::GetDrainingChunkFiles(std::vector<uint64_t>* chunk_files) const {
+        chunk_files->resize(NumChunkTables());
+        for(int i = 0; i < NumChunkTables(); i++){
+            (*chunk_files)[i] = draining_[i] ? draining_[i]->GetChunkNumber() : 0;
+        }
+    }
+
+    void NVMTable::GetDrainingHashRange(chunkTable* cktbl, 
+            uint32_t* lo, uint32_t* hi) const {
+        bool found = false;
+        for(int i = 0; i < NumChunkTables(); i++){
+            if(draining_[i] != cktbl)
+                continue;
+            uint32_t chunk_lo, chunk_hi;
+            GetChunkHashRange(i, &chunk_lo, &chunk_hi);
+            if(!found)
+                *lo = chunk_lo;
+            *hi = chunk_hi;
+            found = true;
+        }
+        assert(found);
+    }
+
+    bool NVMTable::FullChunkDraining(size_t chunk_thresh) const {
+        for(int i = 0; i < NumChunkTables(); i++){
+            if(draining_[i] && cktables_[i]->ApproximateNVMUsage() >= chunk_thresh)
+                return true;
+        }
+        return false;
+    }
+
+    void NVMTable::GetChunkFiles(std::vector<uint64_t>* chunk_files) const {
+        chunk_files->resize(NumChunkTables());
+        for(int i = 0; i < NumChunkTables(); i++){
+            (*chunk_files)[i] = cktables_[i] ? cktables_[i]->GetChunkNumber() : 0;
         }
     }
 
     void NVMTable::Add(const char* kvitem, const Slice& key){
-       const uint32_t hash = chunkTableHash(key);
-       cktables_[chunkTableIndex(hash)]->Add(kvitem);
+       cktables_[GetChunkTableIndex(key)]->Add(kvitem);
+    }
+
+    char* NVMTable::AllocateEntry(const Slice& key, size_t bytes){
+       chunkTable* cktbl = cktables_[GetChunkTableIndex(key)];
+       return cktbl != NULL ? cktbl->AllocateEntry(bytes) : NULL;
     }
     
-    int NVMTable::GetChunkTableIndex(const Slice& key){
+    int NVMTable::GetChunkTableIndex(const Slice& key) const {
+        if(!range_partitioned_ && hash_boundaries_.empty())
+            return GetChunkTableIndex(key, NumChunkTables());
+        //number of boundaries not greater than key
+        int left = 0, right;
+        if(range_partitioned_){
+            const Comparator* ucmp = comparator_->user_comparator();
+            right = range_boundaries_.size();
+            while(left < right){
+                int mid = (left + right) / 2;
+                if(ucmp->Compare(range_boundaries_[mid], key) <= 0)
+                    left = mid + 1;
+                else
+                    right = mid;
+            }
+        } else {
+            const uint32_t hash = chunkTableHash(key);
+            left = std::upper_bound(hash_boundaries_.begin(), 
+                    hash_boundaries_.end(), hash) - hash_boundaries_.begin();
+        }
+        return left;
+    }
+
+    void NVMTable::SetRangeBoundaries(const std::vector<std::string>& boundaries){
+        assert(range_partitioned_);
+        assert(!HasRangeBoundaries());
+        assert(boundaries.size() < cktables_.size());
+        //with too few distinct keys to learn from the last chunks would
+        //never be routed to, drop them
+        while(cktables_.size() > boundaries.size() + 1){
+            if(cktables_.back())
+                cktables_.back()->Unref();
+            cktables_.pop_back();
+            assert(draining_.back() == NULL);
+            draining_.pop_back();
+        }
+        range_boundaries_ = boundaries;
+        has_range_boundaries_ = true;
+    }
+
+    void NVMTable::LearnRangeBoundaries(Iterator* iter, 
+            const Comparator* ucmp, int num_chunk_tables,
+            std::vector<std::string>* boundaries){
+        std::vector<std::string> user_keys;
+        for(iter->SeekToFirst(); iter->Valid(); iter->Next()){
+            Slice user_key = ExtractUserKey(iter->key());
+            if(user_keys.empty() || 
+                    ucmp->Compare(user_key, user_keys.back()) != 0)
+                user_keys.push_back(user_key.ToString());
+        }
+        boundaries->clear();
+        for(int i = 1; i < num_chunk_tables; i++){
+            size_t pos = user_keys.size() * i / num_chunk_tables;
+            //too few distinct keys, leave the last chunks unused
+            if(pos == 0 || (!boundaries->empty() && 
+                        ucmp->Compare(user_keys[pos], boundaries->back()) <= 0))
+                continue;
+            boundaries->push_back(user_keys[pos]);
+        }
+    }
+
+    void NVMTable::SetHashBoundaries(const std::vector<uint32_t>& hash_boundaries){
+        assert(!range_partitioned_);
+        assert(hash_boundaries.empty() || 
+                hash_boundaries.size() + 1 == cktables_.size());
+        hash_boundaries_ = hash_boundaries;
+    }
+
+    void NVMTable::GetHashBoundaries(std::vector<uint32_t>* hash_boundaries) const {
+        hash_boundaries->clear();
+        if(!hash_boundaries_.empty()){
+            hash_boundaries->assign(hash_boundaries_.begin(), hash_boundaries_.end());
+            return;
+        }
+        for(int i = 1; i < NumChunkTables(); i++){
+            hash_boundaries->push_back(evenHashBoundary(i, NumChunkTables()));
+        }
+    }
+
+    void NVMTable::GetChunkHashRange(int index, uint32_t* lo, uint32_t* hi) const {
+        std::vector<uint32_t> hash_boundaries;
+        GetHashBoundaries(&hash_boundaries);
+        *lo = (index == 0) ? 0 : hash_boundaries[index - 1];
+        *hi = (index == NumChunkTables() - 1) ? 
+            0xffffffffu : hash_boundaries[index] - 1;
+    }
+
+    void NVMTable::RecordInserts(const std::vector<size_t>& inserts){
+        assert(inserts.size() == cktables_.size());
+        for(int i = 0; i < NumChunkTables(); i++){
+            cktables_[i]->SetInsertRate(
+                    cktables_[i]->InsertRate() / 2 + inserts[i]);
+        }
+    }
+
+    double NVMTable::AverageInsertRate() const {
+        double sum = 0;
+        for(int i = 0; i < NumChunkTables(); i++){
+            sum += cktables_[i]->InsertRate();
+        }
+        return sum / NumChunkTables();
+    }
+
+    bool NVMTable::FindSplitBoundary(int index, std::string* boundary) const {
+        if(range_partitioned_ && !has_range_boundaries_)
+            return false;
+        if(!range_partitioned_){
+            //halve the hash range, the boundary is its first hash encoded
+            //with EncodeFixed32
+            uint32_t lo, hi;
+            GetChunkHashRange(index, &lo, &hi);
+            if(hi == lo)
+                return false;
+            char buf[sizeof(uint32_t)];
+            EncodeFixed32(buf, lo + (hi - lo) / 2 + 1);
+            boundary->assign(buf, sizeof(buf));
+            return true;
+        }
+        //the user key of the median entry, which must not be the first key
+        //of the chunk or the left half would be empty
+        const Comparator* ucmp = comparator_->user_comparator();
+        Iterator* iter = cktables_[index]->NewIterator();
+        size_t entries = 0;
+        for(iter->SeekToFirst(); iter->Valid(); iter->Next())
+            entries++;
+        bool found = false;
+        iter->SeekToFirst();
+        if(iter->Valid()){
+            std::string first_user_key = ExtractUserKey(iter->key()).ToString();
+            for(size_t i = 0; iter->Valid(); iter->Next(), i++){
+                if(i < entries / 2)
+                    continue;
+                Slice user_key = ExtractUserKey(iter->key());
+                if(ucmp->Compare(user_key, first_user_key) > 0){
+                    boundary->assign(user_key.data(), user_key.size());
+                    found = true;
+                    break;
+                }
+            }
+        }
+        delete iter;
+        return found;
+    }
+
+    bool NVMTable::RightOfSplit(const Slice& user_key, 
+            const std::string& boundary) const {
+        if(range_partitioned_)
+            return comparator_->user_comparator()->Compare(user_key, 
+                    boundary) >= 0;
+        return chunkTableHash(user_key) >= DecodeFixed32(boundary.data());
+    }
+
+    void NVMTable::SplitChunkTable(int index, const std::string& boundary,
+            chunkTable* right){
+        if(range_partitioned_){
+            range_boundaries_.insert(range_boundaries_.begin() + index, boundary);
+        } else {
+            GetHashBoundaries(&hash_boundaries_);
+            hash_boundaries_.insert(hash_boundaries_.begin() + index, 
+                    DecodeFixed32(boundary.data()));
+        }
+        chunkTable* left = cktables_[index];
+        right->Ref();
+        left->SetInsertRate(left->InsertRate() / 2);
+        right->SetInsertRate(left->InsertRate());
+        cktables_.insert(cktables_.begin() + index + 1, right);
+        if(draining_[index])
+            draining_[index]->Ref();
+        draining_.insert(draining_.begin() + index + 1, draining_[index]);
+    }
+
+    void NVMTable::MergeChunkTables(int index, chunkTable* merged){
+        assert(index + 1 < NumChunkTables());
+        assert(draining_[index] == NULL && draining_[index + 1] == NULL);
+        if(range_partitioned_){
+            range_boundaries_.erase(range_boundaries_.begin() + index);
+        } else {
+            GetHashBoundaries(&hash_boundaries_);
+            hash_boundaries_.erase(hash_boundaries_.begin() + index);
+        }
+        merged->Ref();
+        merged->SetInsertRate(cktables_[index]->InsertRate() + 
+                cktables_[index + 1]->InsertRate());
+        cktables_[index]->Unref();
+        cktables_[index + 1]->Unref();
+        cktables_[index] = merged;
+        cktables_.erase(cktables_.begin() + index + 1);
+        draining_.erase(draining_.begin() + index + 1);
+    }
+
+    int NVMTable::GetChunkTableIndex(const Slice& key, int num_chunk_tables){
        const uint32_t hash = chunkTableHash(key);
-       return chunkTableIndex(hash);
+       return chunkTableIndex(hash, num_chunk_tables);
     }
    
     bool NVMTable::NeedsCompaction(size_t chunk_thresh){
-        for(int i = 0; i < kNumChunkTable; i++){
+        for(int i = 0; i < NumChunkTables(); i++){
             if(cktables_[i] && (cktables_[i]->ApproximateNVMUsage() >= chunk_thresh))
                 return true;   
         }
@@ -97,30 +733,46 @@ namespace leveldb{
        uint32_t key_length;
        const char* key_ptr = GetVarint32Ptr(memkey.data(), memkey.data() + 5, &key_length);
        Slice user_key = Slice(key_ptr, key_length - 8);
-       const uint32_t hash = chunkTableHash(user_key);
        //DEBUG_T("nvmtable get user_key:%s, index:%d\n", user_key.ToString().c_str(), 
-         //      chunkTableIndex(hash));
-       chunkTable* cktbl = cktables_[chunkTableIndex(hash)];
-       /*if(!cktbl->CheckPredictIndex(user_key)){
-           DEBUG_T("not in nvmtable\n");
-           return false;
+         //      GetChunkTableIndex(user_key));
+       const int index = GetChunkTableIndex(user_key);
+       chunkTable* cktbl = cktables_[index];
+       if(cktbl->MaybeContains(user_key) && cktbl->Get(key, value, s))
+           return true;
+       //then the older entries still being flushed
+       chunkTable* draining = draining_[index];
+       return draining != NULL && draining->MaybeContains(user_key) &&
+           draining->Get(key, value, s);
+    }
+
+    bool NVMTable::Get(const LookupKey& key, std::string* value, Status* s,
+            Finger* finger){
+       if(finger->active.empty()){
+           finger->active.resize(NumChunkTables());
+           finger->draining.resize(NumChunkTables());
        }
-       else */
-           return cktbl->Get(key, value, s);
+       Slice user_key = key.user_key();
+       const int index = GetChunkTableIndex(user_key);
+       chunkTable* cktbl = cktables_[index];
+       if(cktbl->MaybeContains(user_key) && 
+               cktbl->Get(key, value, s, &finger->active[index]))
+           return true;
+       chunkTable* draining = draining_[index];
+       return draining != NULL && draining->MaybeContains(user_key) &&
+           draining->Get(key, value, s, &finger->draining[index]);
     }
 
     bool NVMTable::MaybeContains(const Slice& user_key){
-       const uint32_t hash = chunkTableHash(user_key);
-       chunkTable* cktbl = cktables_[chunkTableIndex(hash)];
-       /*if(!cktbl->CheckPredictIndex(user_key))
-           return false;
-       else */
+       const int index = GetChunkTableIndex(user_key);
+       if(cktables_[index]->MaybeContains(user_key))
            return true;
+       return draining_[index] != NULL && 
+           draining_[index]->MaybeContains(user_key);
     }
 
 
     void NVMTable::CheckAndAddToCompactionList(std::map<int, chunkTable*>& toCompactionList, size_t chunk_thresh){
-        for(int i = 0; i < kNumChunkTable; i++){
+        for(int i = 0; i < NumChunkTables(); i++){
             if(cktables_[i] && (cktables_[i]->ApproximateNVMUsage() >= chunk_thresh)){
                 toCompactionList.insert(std::make_pair(i, cktables_[i]));
             }
@@ -130,25 +782,30 @@ namespace leveldb{
     void NVMTable::UpdateChunkTables(std::map<int, chunkTable*>& update_chunks){
         std::map<int, chunkTable*>::iterator iter;
         for(iter = update_chunks.begin(); iter != update_chunks.end(); iter++){
-            int index = iter->first;
-            if(cktables_[index])
-                delete cktables_[index];
-            cktables_[index] = iter->second;
+            SetChunkTable(iter->first, iter->second);
         }
     }
     
     void NVMTable::AddAllToCompactionList(std::map<int, chunkTable*>& toCompactionList){
-        for(int i = 0; i < kNumChunkTable; i++){
+        for(int i = 0; i < NumChunkTables(); i++){
                 toCompactionList.insert(std::make_pair(i, cktables_[i]));
         } 
     }
     
     Iterator* NVMTable::NewIterator(){
+        //a partition's draining chunk overlaps it, merge everything then
+        if(range_partitioned_ && !HasDrainingChunkTables())
+            return new ChunkConcatIterator(this);
         std::vector<Iterator*> list;
-        for(int i = 0; i < kNumChunkTable; i++){
+        for(int i = 0; i < NumChunkTables(); i++){
             list.push_back(cktables_[i]->NewIterator());
         }
-        return NewMergingIterator(comparator_, &list[0], list.size());
+        std::vector<chunkTable*> draining;
+        GetDrainingChunkTables(&draining);
+        for(size_t i = 0; i < draining.size(); i++){
+            list.push_back(draining[i]->NewIterator());
+        }
+        return NewChunkMergingIterator(comparator_, list);
     }
 
     Iterator* NVMTable::GetMergeIterator(std::vector<chunkTable*>& toCompactionList){
@@ -156,7 +813,7 @@ namespace leveldb{
         for(int i = 0; i < toCompactionList.size(); i++){
             list.push_back(toCompactionList[i]->NewIterator());
         }
-        return NewMergingIterator(comparator_, &list[0], list.size());
+        return NewChunkMergingIterator(comparator_, list);
     }
 
     Iterator* NVMTable::getchunkTableIterator(int index){
@@ -165,64 +822,118 @@ namespace leveldb{
 
     void NVMTable::PrintInfo(){
         DEBUG_T("---------------PRINT_NVMTABLE-------------------\n");
-        for(int i = 0; i < kNumChunkTable; i++){
+        for(int i = 0; i < NumChunkTables(); i++){
             DEBUG_T("index:%d, indexUsage:%zu\n", 
                     i, cktables_[i]->ApproximateNVMUsage());
         }
         DEBUG_T("-------------END PRINT_NVMTABLE-----------------\n");
     }
 
+    bool NVMTable::NeedsFilterRebuild() const {
+        std::vector<chunkTable*> chunks;
+        GetChunksWithoutFilter(&chunks);
+        return !chunks.empty();
+    }
+
+    void NVMTable::GetChunksWithoutFilter(
+            std::vector<chunkTable*>* chunks) const {
+        chunks->clear();
+        for(int i = 0; i < NumChunkTables(); i++){
+            chunkTable* cktbls[2] = {cktables_[i], draining_[i]};
+            for(int j = 0; j < 2; j++){
+                if(cktbls[j] && !cktbls[j]->FilterReady() &&
+                        std::find(chunks->begin(), chunks->end(), cktbls[j])
+                        == chunks->end())
+                    chunks->push_back(cktbls[j]);
+            }
+        }
+    }
+
     void NVMTable::SaveMetadata(std::string metfile){
         DEBUG_T("save metafile:%s\n", metfile.c_str());
-        int fd = open(metfile.c_str(), O_RDWR);
+        std::vector<chunkTable*> chunks;
+        for(int i = 0; i < NumChunkTables(); i++){
+            chunkTable* cktbls[2] = {cktables_[i], draining_[i]};
+            for(int j = 0; j < 2; j++){
+                if(cktbls[j] && cktbls[j]->FilterReady() &&
+                        std::find(chunks.begin(), chunks.end(), cktbls[j])
+                        == chunks.end())
+                    chunks.push_back(cktbls[j]);
+            }
+        }
+        size_t metfile_size = sizeof(uint64_t);
+        for(size_t i = 0; i < chunks.size(); i++)
+            metfile_size += chunks[i]->FilterRecordSize();
+
+        int fd = open(metfile.c_str(), O_RDWR | O_CREAT, 0644);
         if(fd == -1){
-            fd = open(metfile.c_str(), O_RDWR | O_CREAT, 0644);
-            if(fd == -1)
-                perror("create_metfile_failed\n");
-        }
-        
-        size_t bytes = ((BIT_BLOOM_SIZE + 7) / 8);
-        size_t metfile_size = (bytes + 1) * kNumChunkTable;  
-        
-        DEBUG_T("BIT_BLOOM_SIZE + 7:%d, bytes:%zu, kNumChunkTable:%d, metfile_size:%zu\n", BIT_BLOOM_SIZE + 7, bytes, kNumChunkTable, metfile_size);
-        
+            perror("create_metfile_failed\n");
+            return;
+        }
         if(ftruncate(fd, metfile_size) != 0){
             perror("ftruncate_failed\n");
+            close(fd);
+            return;
         }
         char* meta_map_start = (char*)mmap(NULL, metfile_size, PROT_READ | PROT_WRITE, 
                         MAP_SHARED, fd, 0);
-
-        for(int i = 0; i < kNumChunkTable; i++){
-            if(!cktables_[i])
-                continue;
-            char* start = meta_map_start + (bytes + 1) * i;
-            //cktables_[i]->SaveBloomFilter(start);
+        close(fd);
+        if(meta_map_start == MAP_FAILED){
+            perror("mmap_metfile_failed\n");
+            return;
+        }
+        char* start = meta_map_start + sizeof(uint64_t);
+        for(size_t i = 0; i < chunks.size(); i++){
+            chunks[i]->SaveBloomFilter(start);
+            start += chunks[i]->FilterRecordSize();
         }
+        //the count goes last, a torn save reads as no filters at all
+        flush_cache(meta_map_start + sizeof(uint64_t), 
+                metfile_size - sizeof(uint64_t));
+        EncodeFixed64(meta_map_start, chunks.size());
+        flush_cache(meta_map_start, sizeof(uint64_t));
         munmap(meta_map_start, metfile_size);
     }
     
-    void NVMTable::RecoverMetadata(std::map<int, chunkTable*> update_chunks, 
-            std::string metafile){
-        //DEBUG_T("recover metafile:%s\n", metafile.c_str());
-        int fd = open(metafile.c_str(), O_RDWR);
-        if(fd == -1){
-            fd = open(metafile.c_str(), O_RDWR | O_CREAT, 0644);
-            if(fd == -1)
-                perror("create_metfile_failed\n");
-        }
-        size_t bytes = ((BIT_BLOOM_SIZE + 7) / 8) ;
-        size_t metfile_size = (bytes + 1) * kNumChunkTable;  
-        if(ftruncate(fd, metfile_size) != 0){
-            perror("ftruncate_failed\n");
+    //chunks whose saved filter is missing or stale stay without one, see
+    //GetChunksWithoutFilter()
+    void NVMTable::RecoverMetadata(std::string metafile){
+        DEBUG_T("recover metafile:%s\n", metafile.c_str());
+        int fd = open(metafile.c_str(), O_RDONLY);
+        if(fd == -1)
+            return;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(uint64_t)){
+            close(fd);
+            return;
         }
-        char* meta_map_start = (char*)mmap(NULL, metfile_size, PROT_READ | PROT_WRITE, 
-                        MAP_SHARED, fd, 0); 
-        //DEBUG_T("BIT_BLOOM_SIZE:%d, bytes:%zu, kNumChunkTable:%d, metfile_size:%zu\n", BIT_BLOOM_SIZE, bytes, kNumChunkTable, metfile_size);
-        for(auto iter = update_chunks.begin(); iter != update_chunks.end(); iter++){
-            //DEBUG_T("iter->first:%d\n", iter->first);
-            char* start = meta_map_start + (bytes + 1) * (iter->first);
-            //iter->second->RecoverBloomFilter(start);
+        const size_t metfile_size = st.st_size;
+        const char* meta_map_start = (const char*)mmap(NULL, metfile_size, 
+                PROT_READ, MAP_SHARED, fd, 0); 
+        close(fd);
+        if(meta_map_start == MAP_FAILED)
+            return;
+        const uint64_t count = DecodeFixed64(meta_map_start);
+        const char* start = meta_map_start + sizeof(uint64_t);
+        const char* limit = meta_map_start + metfile_size;
+        for(uint64_t n = 0; n < count; n++){
+            if(limit - start < 3 * 8)
+                break;
+            const uint64_t number = DecodeFixed64(start);
+            const uint64_t bytes = DecodeFixed64(start + 16);
+            if(bytes > (uint64_t)(limit - start - 3 * 8))
+                break;
+            for(int i = 0; i < NumChunkTables(); i++){
+                chunkTable* cktbls[2] = {cktables_[i], draining_[i]};
+                for(int j = 0; j < 2; j++){
+                    if(cktbls[j] && !cktbls[j]->FilterReady() &&
+                            cktbls[j]->GetChunkNumber() == number)
+                        cktbls[j]->RecoverBloomFilter(start);
+                }
+            }
+            start += 3 * 8 + bytes;
         }
+        munmap((void*)meta_map_start, metfile_size);
     }
     
 }
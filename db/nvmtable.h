@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <vector>
 #include <map>
+#include <unordered_set>
 #include "leveldb/db.h"
 #include "db/dbformat.h"
 #include "util/arena.h"
@@ -19,9 +20,6 @@
 #include "table/merger.h"
 #include "db/memtable.h"
 
-#define kNumChunkTableBits 2
-#define kNumChunkTable (1 << kNumChunkTableBits)
-
 namespace leveldb{
 class InternalKeyComparator;
 class BitBloomFilter;
@@ -31,12 +29,50 @@ class chunkTable{
                 ArenaNVM* arena, bool recovery = false);
         ~chunkTable();
         void Add(const char* kvitem);
+        //add kvitems as one group commit, a crash leaves all or none of
+        //them in the chunk. The chunk file is grown for the whole batch
+        //first, if it can't be nothing is added
+        Status AddBatch(const std::vector<const char*>& kvitems);
+        //space in this chunk for an entry a writer is about to put in a
+        //DRAM memtable, so the move can link it without copying. NULL if
+        //the chunk is too full to take it
+        char* AllocateEntry(size_t bytes);
         bool Get(const LookupKey& key, std::string* value, Status* s);
+        //see MemTable::Finger
+        bool Get(const LookupKey& key, std::string* value, Status* s,
+                MemTable::Finger* finger);
+        //false only if the chunk surely holds no entry for user_key. A
+        //recovered chunk answers true until its filter is loaded or rebuilt
+        bool MaybeContains(const Slice& user_key);
         Iterator* NewIterator();
         size_t ApproximateNVMUsage() {return arena_->MemoryUsage(); };
+
+        //the filter is kept in DRAM and saved to the chunk meta file on a
+        //clean close, it is rebuilt from the chunk when that copy is stale
+        bool FilterReady() const {
+            return filter_ready_.Acquire_Load() != NULL;
+        }
+        void RebuildFilter();
+        size_t FilterRecordSize();
+        void SaveBloomFilter(char* start);
+        //false if the record at start doesn't describe this chunk as it is
+        bool RecoverBloomFilter(const char* start);
         
         void SetChunkNumber(uint64_t chunk_number){chunk_number_ = chunk_number;}
         uint64_t GetChunkNumber(){return chunk_number_;}
+
+        //decayed number of entries added per imm move
+        double InsertRate() const {return insert_rate_;}
+        void SetInsertRate(double insert_rate){insert_rate_ = insert_rate;}
+
+        //entries copied into the chunk that replaced this one, its flush
+        //leaves them out. Set before the chunk starts draining
+        void SetRetained(const std::vector<const char*>& kvitems){
+            retained_.insert(kvitems.begin(), kvitems.end());
+        }
+        bool IsRetained(const char* kvitem) const {
+            return !retained_.empty() && retained_.count(kvitem) != 0;
+        }
         
 
         void Ref(){++refs_;}
@@ -65,10 +101,20 @@ class chunkTable{
         friend class NVMTable;
         MemTable* table_;
         int refs_;
-        //BitBloomFilter* bbf_;
         ArenaNVM* arena_;
+        //user keys of the chunk, set before an entry is linked
+        BitBloomFilter* bbf_;
+        port::AtomicPointer filter_ready_;
+        //header word the skiplist rewrites on every commit, a saved filter
+        //is only good for the chunk contents it was saved with
+        uint64_t CommitStamp() {
+            return *reinterpret_cast<size_t*>(arena_->getMapStart());
+        }
+        void AddToFilter(const char* kvitem);
 
         uint64_t chunk_number_;
+        double insert_rate_;
+        std::unordered_set<const char*> retained_;
 
         chunkTable(const chunkTable&);
         void operator=(const chunkTable&);
@@ -81,9 +127,19 @@ class NVMTable {
         NVMTable(const InternalKeyComparator& comparator, 
             std::vector<ArenaNVM*>& arenas,
             bool recovery);
-        NVMTable(const InternalKeyComparator& comparator); 
+        NVMTable(const InternalKeyComparator& comparator, int num_chunk_tables,
+            bool range_partitioned = false); 
         void Add(const char* kvitem, const Slice& key);
+        //see chunkTable::AllocateEntry, key is a user key
+        char* AllocateEntry(const Slice& key, size_t bytes);
         bool Get(const LookupKey& key, std::string* value, Status* s);
+        //Get() for lookups in ascending key order, with a finger per chunk
+        struct Finger {
+            std::vector<MemTable::Finger> active;
+            std::vector<MemTable::Finger> draining;
+        };
+        bool Get(const LookupKey& key, std::string* value, Status* s,
+                Finger* finger);
         bool MaybeContains(const Slice& user_key);
         void CheckAndAddToCompactionList(std::map<int, chunkTable*>& toCompactionList, size_t chunk_thresh);
         void AddAllToCompactionList(std::map<int, chunkTable*>& toCompactionList);
@@ -97,14 +153,91 @@ class NVMTable {
         void UpdateChunkTables(std::map<int, chunkTable*>& update_chunks);
         void PrintInfo(); 
         
+        //the meta file holds the bloom filters of the active and draining
+        //chunks, keyed by chunk number
         void SaveMetadata(std::string metfile);
-        void RecoverMetadata(std::map<int, chunkTable*> update_chunks, 
-                std::string metafile);
+        void RecoverMetadata(std::string metafile);
+        //distinct active and draining chunks that have no usable filter
+        bool NeedsFilterRebuild() const;
+        void GetChunksWithoutFilter(std::vector<chunkTable*>* chunks) const;
 
-        static int GetChunkTableIndex(const Slice& key);
+        int GetChunkTableIndex(const Slice& key) const;
+        static int GetChunkTableIndex(const Slice& key, int num_chunk_tables);
+        int NumChunkTables() const {return static_cast<int>(cktables_.size());}
         bool NeedsCompaction(size_t chunk_thresh);
+        void GetChunkFiles(std::vector<uint64_t>* chunk_files) const;
+
+        //An installed NVMTable is never reshaped, changes are made on a
+        //Clone() that shares the chunkTables and is then installed in its
+        //place, so readers holding the old table are not disturbed.
+        NVMTable* Clone() const;
+        //set chunk index to cktbl, the replaced chunk is unrefed
+        void SetChunkTable(int index, chunkTable* cktbl);
+
+        //like mem_ to imm_, a full chunk is switched out for cktbl and
+        //stays readable as the draining chunk of its partition until it
+        //has been flushed to level-0
+        void SwitchChunkTable(int index, chunkTable* cktbl);
+        void SetDrainingChunkTable(int index, chunkTable* cktbl);
+        void RemoveDrainingChunkTable(chunkTable* cktbl);
+        bool HasDrainingChunkTables() const;
+        bool IsDraining(int index) const {return draining_[index] != NULL;}
+        //distinct draining chunks, a split partition shares one
+        void GetDrainingChunkTables(std::vector<chunkTable*>* draining) const;
+        //parallel to GetChunkFiles(), 0 where a partition is not draining
+        void GetDrainingChunkFiles(std::vector<uint64_t>* chunk_files) const;
+        //inclusive range of key hashes of the partitions draining cktbl
+        void GetDrainingHashRange(chunkTable* cktbl, 
+                uint32_t* lo, uint32_t* hi) const;
+        //true if a full chunk can't be switched out yet, because its
+        //partition is still draining
+        bool FullChunkDraining(size_t chunk_thresh) const;
+
+        //range partitioning, boundaries[i] is the first user key of chunk i+1.
+        //they are learned once, before any data is routed by them
+        bool IsRangePartitioned() const {return range_partitioned_;}
+        bool HasRangeBoundaries() const {return has_range_boundaries_;}
+        void SetRangeBoundaries(const std::vector<std::string>& boundaries);
+        void GetRangeBoundaries(std::vector<std::string>* boundaries) const {
+            boundaries->assign(range_boundaries_.begin(), range_boundaries_.end());
+        }
+        //pick up to num_chunk_tables - 1 boundaries at the quantiles of the
+        //distinct user keys produced by iter
+        static void LearnRangeBoundaries(Iterator* iter, 
+                const Comparator* ucmp, int num_chunk_tables,
+                std::vector<std::string>* boundaries);
+
+        //hash partitioning, empty hash boundaries mean an even split of the
+        //hash space, otherwise hash_boundaries[i] is the first hash of chunk i+1
+        bool HasHashBoundaries() const {return !hash_boundaries_.empty();}
+        void SetHashBoundaries(const std::vector<uint32_t>& hash_boundaries);
+        void GetHashBoundaries(std::vector<uint32_t>* hash_boundaries) const;
+        //true if user_key goes to the right half of a split at boundary,
+        //see FindSplitBoundary()
+        bool RightOfSplit(const Slice& user_key, 
+                const std::string& boundary) const;
+        //inclusive range of key hashes chunk index owns
+        void GetChunkHashRange(int index, uint32_t* lo, uint32_t* hi) const;
+        static bool HashInRange(const Slice& user_key, uint32_t lo, uint32_t hi){
+            const uint32_t hash = chunkTableHash(user_key);
+            return hash >= lo && hash <= hi;
+        }
+
+        //adaptive partitioning, driven by the per chunk insert rates
+        void RecordInserts(const std::vector<size_t>& inserts);
+        double AverageInsertRate() const;
+        //find where to split chunk index in two, false if it can't be split
+        bool FindSplitBoundary(int index, std::string* boundary) const;
+        //split chunk index at boundary, it keeps the keys below boundary
+        //and right takes the rest. Meant for a chunk just switched in, a
+        //draining chunk is shared by both halves
+        void SplitChunkTable(int index, const std::string& boundary,
+                chunkTable* right);
+        //replace chunks index and index + 1 by merged, which must already
+        //hold the entries of both. Neither may be draining
+        void MergeChunkTables(int index, chunkTable* merged);
         
-        chunkTable* cktables_[kNumChunkTable];
+        std::vector<chunkTable*> cktables_;
         void Ref(){
             ++refs_; 
             DEBUG_T("ref, refs:%d\n", refs_);
@@ -119,14 +252,28 @@ class NVMTable {
         }
     private:
         ~NVMTable();
-        //chunkTable* cktables_[kNumChunkTable];
         const InternalKeyComparator* comparator_;
         int refs_;
+        const bool range_partitioned_;
+        bool has_range_boundaries_;
+        std::vector<std::string> range_boundaries_;
+        std::vector<uint32_t> hash_boundaries_;
+        //parallel to cktables_, NULL where a partition is not draining
+        std::vector<chunkTable*> draining_;
         static inline uint32_t chunkTableHash(const Slice& key){
             return Hash(key.data(), key.size(), 0);
         }
-        static uint32_t chunkTableIndex(uint32_t hash){
-           return hash >> (32 - kNumChunkTableBits);
+        //map the hash onto [0, num_chunk_tables) by its high bits, so a
+        //power-of-two count keeps the old "hash >> (32 - bits)" layout
+        static uint32_t chunkTableIndex(uint32_t hash, int num_chunk_tables){
+           return static_cast<uint32_t>(
+                   (static_cast<uint64_t>(hash) * num_chunk_tables) >> 32);
+        }
+        //first hash of chunk index under an even split
+        static uint32_t evenHashBoundary(int index, int num_chunk_tables){
+           return static_cast<uint32_t>(
+                   ((static_cast<uint64_t>(index) << 32) + num_chunk_tables - 1)
+                   / num_chunk_tables);
         }
         
         
@@ -0,0 +1,197 @@
+/*************************************************************************
+	> File Name: nvmwrite_buffer.cc
+	> Author: Meggie
+	> Mail: 1224642332@qq.com
+	> Created Time: Sat 17 Oct 2026 08:41:26 PM CST
+ ************************************************************************/
+#include "db/nvmwrite_buffer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "port/cache_flush.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/debug.h"
+
+namespace leveldb{
+namespace {
+const uint64_t kWriteBufferMagic = 0x6e766d7762663031ull;   //"nvmwbf01"
+const size_t kHeaderSize = CACHE_LINE_SIZE;
+//checksum and length of a group
+const size_t kGroupHeaderSize = 8;
+
+Status WriteBufferError(const std::string& context, int error_number){
+    return Status::IOError(context, strerror(error_number));
+}
+
+//the end of the memtable entry at p, NULL if it runs past limit
+const char* SkipEntry(const char* p, const char* limit){
+    uint32_t key_length, value_length;
+    p = GetVarint32Ptr(p, limit, &key_length);
+    if(p == NULL || key_length < 8 || key_length > limit - p)
+        return NULL;
+    p = GetVarint32Ptr(p + key_length, limit, &value_length);
+    if(p == NULL || value_length > limit - p)
+        return NULL;
+    return p + value_length;
+}
+}
+
+NVMWriteBuffer::NVMWriteBuffer(const std::string& fname, int fd, char* base,
+        size_t mapped)
+    : fname_(fname), fd_(fd), base_(base), mapped_(mapped),
+      size_(kHeaderSize), group_(kHeaderSize), synced_(kHeaderSize){
+}
+
+NVMWriteBuffer::~NVMWriteBuffer(){
+    munmap(base_, mapped_);
+    close(fd_);
+}
+
+Status NVMWriteBuffer::Create(const std::string& fname, size_t capacity,
+        NVMWriteBuffer** result){
+    *result = NULL;
+    int fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0664);
+    if(fd < 0)
+        return WriteBufferError(fname, errno);
+    const size_t mapped = kHeaderSize + capacity;
+    if(ftruncate(fd, mapped) != 0){
+        Status s = WriteBufferError(fname, errno);
+        close(fd);
+        return s;
+    }
+    char* base = reinterpret_cast<char*>(mmap(NULL, mapped,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if(base == MAP_FAILED){
+        Status s = WriteBufferError(fname, errno);
+        close(fd);
+        return s;
+    }
+    //like NVMLogFile, the tail is durable before the magic
+    *reinterpret_cast<uint64_t*>(base + sizeof(uint64_t)) = 0;
+    flush_cache(base, kHeaderSize);
+    *reinterpret_cast<uint64_t*>(base) = kWriteBufferMagic;
+    flush_cache(base, kHeaderSize);
+    *result = new NVMWriteBuffer(fname, fd, base, mapped);
+    return Status::OK();
+}
+
+Status NVMWriteBuffer::Recover(const std::string& fname,
+        NVMWriteBuffer** result, std::vector<const char*>* entries){
+    *result = NULL;
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0)
+        return WriteBufferError(fname, errno);
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        Status s = WriteBufferError(fname, errno);
+        close(fd);
+        return s;
+    }
+    const size_t mapped = st.st_size;
+    if(mapped < kHeaderSize){
+        close(fd);
+        return Status::Corruption(fname, "not an nvm write buffer");
+    }
+    char* base = reinterpret_cast<char*>(mmap(NULL, mapped, PROT_READ,
+                MAP_SHARED, fd, 0));
+    if(base == MAP_FAILED){
+        Status s = WriteBufferError(fname, errno);
+        close(fd);
+        return s;
+    }
+    NVMWriteBuffer* buffer = new NVMWriteBuffer(fname, fd, base, mapped);
+    if(DecodeFixed64(base) != kWriteBufferMagic){
+        delete buffer;
+        return Status::Corruption(fname, "not an nvm write buffer");
+    }
+    //nothing is allocated from a recovered buffer
+    buffer->size_ = buffer->group_ = buffer->synced_ = mapped;
+
+    uint64_t tail = DecodeFixed64(base + sizeof(uint64_t));
+    if(tail > mapped - kHeaderSize)
+        tail = mapped - kHeaderSize;
+    const char* p = base + kHeaderSize;
+    const char* end = p + tail;
+    size_t groups = 0;
+    while(end - p >= static_cast<ptrdiff_t>(kGroupHeaderSize)){
+        const uint32_t crc = crc32c::Unmask(DecodeFixed32(p));
+        const uint32_t length = DecodeFixed32(p + 4);
+        const char* group = p + kGroupHeaderSize;
+        if(length > end - group || crc32c::Value(group, length) != crc)
+            break;
+        const char* limit = group + length;
+        std::vector<const char*> group_entries;
+        for(const char* q = group; q != NULL && q < limit; ){
+            group_entries.push_back(q);
+            q = SkipEntry(q, limit);
+            if(q == NULL)
+                group_entries.clear();
+        }
+        entries->insert(entries->end(), group_entries.begin(),
+                group_entries.end());
+        p = limit;
+        groups++;
+    }
+    DEBUG_T("nvm write buffer %s, recovered %zu groups\n",
+            fname.c_str(), groups);
+    *result = buffer;
+    return Status::OK();
+}
+
+size_t NVMWriteBuffer::Room() const{
+    const size_t used = size_ + kGroupHeaderSize;
+    return used < mapped_ ? mapped_ - used : 0;
+}
+
+void NVMWriteBuffer::BeginGroup(){
+    assert(size_ == group_);
+    size_ = group_ + kGroupHeaderSize;
+}
+
+char* NVMWriteBuffer::Allocate(size_t bytes){
+    assert(size_ > group_);
+    if(bytes > mapped_ - size_)
+        return NULL;
+    char* result = base_ + size_;
+    size_ += bytes;
+    return result;
+}
+
+Status NVMWriteBuffer::Commit(bool sync){
+    assert(size_ >= group_ + kGroupHeaderSize);
+    const size_t length = size_ - group_ - kGroupHeaderSize;
+    if(length == 0){
+        size_ = group_;
+        return Status::OK();
+    }
+    char* group = base_ + group_;
+    EncodeFixed32(group, crc32c::Mask(
+                crc32c::Value(group + kGroupHeaderSize, length)));
+    EncodeFixed32(group + 4, static_cast<uint32_t>(length));
+    group_ = size_;
+    if(sync){
+        flush_cache(base_ + synced_, size_ - synced_);
+        synced_ = size_;
+    }
+    __atomic_store_n(Tail(), size_ - kHeaderSize, __ATOMIC_RELEASE);
+    if(sync)
+        flush_cache(Tail(), sizeof(uint64_t));
+    return Status::OK();
+}
+
+bool IsNVMWriteBuffer(const std::string& fname){
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    uint64_t magic = 0;
+    bool is_buffer = pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+        magic == kWriteBufferMagic;
+    close(fd);
+    return is_buffer;
+}
+}
@@ -0,0 +1,74 @@
+/*************************************************************************
+	> File Name: nvmwrite_buffer.h
+	> Author: Meggie
+	> Mail: 1224642332@qq.com
+	> Created Time: Sat 17 Oct 2026 08:41:26 PM CST
+ ************************************************************************/
+#ifndef STORAGE_LEVELDB_DB_NVMWRITE_BUFFER_H_
+#define STORAGE_LEVELDB_DB_NVMWRITE_BUFFER_H_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "leveldb/status.h"
+
+namespace leveldb{
+//the entries of a DRAM memtable kept in a mmap'd NVM file instead of its
+//arena, the memtable only indexes them. Entries are written in place in
+//the memtable format, so the buffer doubles as the memtable's log.
+//
+//header: magic | tail, bytes of committed groups
+//group:  checksum | length | entries
+//
+//a write group allocates its entries between BeginGroup() and Commit().
+//Commit() moves the tail past the group, which survives the process, and
+//with sync persists the group first. A group whose checksum doesn't match
+//after a power failure ends recovery.
+class NVMWriteBuffer{
+    public:
+        //capacity is fixed, the entries must not move once indexed
+        static Status Create(const std::string& fname, size_t capacity,
+                NVMWriteBuffer** result);
+        //maps the committed groups of fname read-only and appends their
+        //entries, oldest first, to entries
+        static Status Recover(const std::string& fname,
+                NVMWriteBuffer** result, std::vector<const char*>* entries);
+        ~NVMWriteBuffer();
+
+        //bytes of entries a new group can still take
+        size_t Room() const;
+        void BeginGroup();
+        //NULL if the group has no room left
+        char* Allocate(size_t bytes);
+        Status Commit(bool sync);
+
+        bool Contains(const char* p) const {
+            return p >= base_ && p < base_ + mapped_;
+        }
+
+    private:
+        NVMWriteBuffer(const std::string& fname, int fd, char* base,
+                size_t mapped);
+        uint64_t* Tail() const {
+            return reinterpret_cast<uint64_t*>(base_ + sizeof(uint64_t));
+        }
+
+        const std::string fname_;
+        int fd_;
+        char* base_;
+        const size_t mapped_;
+        //end of the allocated bytes, the start of the open group, and the
+        //end of what has been made durable
+        size_t size_;
+        size_t group_;
+        size_t synced_;
+
+        NVMWriteBuffer(const NVMWriteBuffer&);
+        void operator=(const NVMWriteBuffer&);
+};
+
+//true if fname holds a buffer written by NVMWriteBuffer
+bool IsNVMWriteBuffer(const std::string& fname);
+}
+#endif
@@ -0,0 +1,176 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/nvmwrite_buffer.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/write_batch.h"
+#include "util/coding.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class NVMWriteBufferTest {
+ public:
+  NVMWriteBufferTest() {
+    fname_ = test::TmpDir() + "/nvmwrite_buffer_test.log";
+    Env::Default()->DeleteFile(fname_);
+  }
+
+  ~NVMWriteBufferTest() { Env::Default()->DeleteFile(fname_); }
+
+  // a memtable entry for key at seq, placed in buffer
+  static void AddEntry(NVMWriteBuffer* buffer, const std::string& key,
+                       SequenceNumber seq, const std::string& value) {
+    std::string entry;
+    PutVarint32(&entry, key.size() + 8);
+    entry.append(key);
+    PutFixed64(&entry, (seq << 8) | kTypeValue);
+    PutVarint32(&entry, value.size());
+    entry.append(value);
+    char* buf = buffer->Allocate(entry.size());
+    ASSERT_TRUE(buf != nullptr);
+    memcpy(buf, entry.data(), entry.size());
+  }
+
+  static std::string EntryKey(const char* entry) {
+    uint32_t key_length;
+    const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
+    return std::string(key_ptr, key_length - 8);
+  }
+
+  std::vector<std::string> Recover() {
+    NVMWriteBuffer* buffer;
+    std::vector<const char*> entries;
+    ASSERT_OK(NVMWriteBuffer::Recover(fname_, &buffer, &entries));
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < entries.size(); i++) {
+      keys.push_back(EntryKey(entries[i]));
+    }
+    delete buffer;
+    return keys;
+  }
+
+  std::string fname_;
+};
+
+TEST(NVMWriteBufferTest, CommittedGroups) {
+  NVMWriteBuffer* buffer;
+  ASSERT_OK(NVMWriteBuffer::Create(fname_, 1 << 20, &buffer));
+  ASSERT_TRUE(IsNVMWriteBuffer(fname_));
+  for (int g = 0; g < 10; g++) {
+    buffer->BeginGroup();
+    for (int i = 0; i < 3; i++) {
+      AddEntry(buffer, "key" + NumberToString(g * 3 + i), g * 3 + i,
+               std::string(100, 'v'));
+    }
+    ASSERT_OK(buffer->Commit(g % 2 == 0));
+  }
+  // an empty group leaves nothing behind
+  buffer->BeginGroup();
+  ASSERT_OK(buffer->Commit(true));
+
+  // a group that never commits is not recovered
+  buffer->BeginGroup();
+  AddEntry(buffer, "lost", 100, "v");
+  std::vector<std::string> keys = Recover();
+  ASSERT_EQ(30, keys.size());
+  for (int i = 0; i < 30; i++) {
+    ASSERT_EQ("key" + NumberToString(i), keys[i]);
+  }
+  delete buffer;
+}
+
+TEST(NVMWriteBufferTest, Room) {
+  NVMWriteBuffer* buffer;
+  ASSERT_OK(NVMWriteBuffer::Create(fname_, 4096, &buffer));
+  const size_t room = buffer->Room();
+  ASSERT_LT(room, 4096);
+  buffer->BeginGroup();
+  ASSERT_TRUE(buffer->Allocate(room + 1) == nullptr);
+  ASSERT_TRUE(buffer->Allocate(room) != nullptr);
+  delete buffer;
+}
+
+TEST(NVMWriteBufferTest, CorruptGroupEndsRecovery) {
+  NVMWriteBuffer* buffer;
+  ASSERT_OK(NVMWriteBuffer::Create(fname_, 1 << 20, &buffer));
+  for (int g = 0; g < 3; g++) {
+    buffer->BeginGroup();
+    AddEntry(buffer, "key" + NumberToString(g), g, std::string(200, 'v'));
+    ASSERT_OK(buffer->Commit(true));
+  }
+  delete buffer;
+
+  // a byte of the second group's value
+  std::string contents;
+  ASSERT_OK(ReadFileToString(Env::Default(), fname_, &contents));
+  size_t pos = contents.find("key1");
+  ASSERT_TRUE(pos != std::string::npos);
+  contents[pos + 50] ^= 0x1;
+  ASSERT_OK(WriteStringToFile(Env::Default(), contents, fname_));
+
+  std::vector<std::string> keys = Recover();
+  ASSERT_EQ(1, keys.size());
+  ASSERT_EQ("key0", keys[0]);
+}
+
+// the memtables of a reopened db index what the buffers hold
+TEST(NVMWriteBufferTest, Reopen) {
+  std::string dbname = test::TmpDir() + "/nvmwrite_buffer_test_db";
+  std::string nvmname = test::TmpDir() + "/nvmwrite_buffer_test_db_nvm";
+  DestroyDB(dbname, Options(), nvmname);
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.num_chunk_tables = 4;
+  options.chunk_size = 1 << 20;
+  options.nvm_write_buffer = true;
+  DB* db;
+  ASSERT_OK(DB::Open(options, dbname, &db, nvmname));
+  for (int i = 0; i < 3000; i++) {
+    WriteBatch batch;
+    batch.Put("key" + NumberToString(i), std::string(100, 'a'));
+    batch.Put("key" + NumberToString(i % 100), NumberToString(i));
+    ASSERT_OK(db->Write(WriteOptions(), &batch));
+  }
+  // more than a buffer holds
+  ASSERT_OK(db->Put(WriteOptions(), "big", std::string(200 << 10, 'b')));
+
+  for (int round = 0; round < 2; round++) {
+    delete db;
+    ASSERT_OK(DB::Open(options, dbname, &db, nvmname));
+    std::string value;
+    for (int i = 0; i < 3000; i++) {
+      ASSERT_OK(db->Get(ReadOptions(), "key" + NumberToString(i), &value));
+      if (i < 100) {
+        ASSERT_EQ(NumberToString(2900 + i), value);
+      } else {
+        ASSERT_EQ(std::string(100, 'a'), value);
+      }
+    }
+    ASSERT_OK(db->Get(ReadOptions(), "big", &value));
+    ASSERT_EQ(200 << 10, value.size());
+  }
+  delete db;
+
+  // and a db opened without the buffers recovers them too
+  options.nvm_write_buffer = false;
+  ASSERT_OK(DB::Open(options, dbname, &db, nvmname));
+  std::string value;
+  ASSERT_OK(db->Get(ReadOptions(), "key99", &value));
+  ASSERT_EQ("2999", value);
+  delete db;
+  DestroyDB(dbname, Options(), nvmname);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -67,6 +67,12 @@ class RecoveryTest {
     ASSERT_EQ(1, NumLogs());
   }
 
+  void DestroyAndReopen(Options* options) {
+    Close();
+    DestroyDB(dbname_, Options());
+    Open(options);
+  }
+
   Status Put(const std::string& k, const std::string& v) {
     return db_->Put(WriteOptions(), k, v);
   }
@@ -268,10 +274,25 @@ TEST(RecoveryTest, MultipleMemTables) {
   Options opt;
   opt.reuse_logs = true;
   opt.write_buffer_size = (kNum*100) / 2;
-  Open(&opt);
-  ASSERT_LE(2, NumTables());
-  ASSERT_EQ(1, NumLogs());
-  ASSERT_NE(old_log_file, FirstLogFile()) << "must not reuse log";
+  ASSERT_OK(OpenWithStatus(&opt));
+  // The chunks exist already, so each memtable the replay fills is moved
+  // to them instead of being written to level-0, and the log stays until
+  // the rest is moved
+  ASSERT_EQ(0, NumTables());
+  ASSERT_EQ(old_log_file, FirstLogFile());
+  std::string usage;
+  ASSERT_TRUE(dbfull()->GetProperty("leveldb.approximate-memory-usage",
+                                    &usage));
+  ASSERT_LE(std::stoull(usage), opt.write_buffer_size);
+  for (int i = 0; i < kNum; i++) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%050d", i);
+    ASSERT_EQ(buf, Get(buf));
+  }
+
+  // Replaying the log again skips what is in the chunks already
+  ASSERT_OK(OpenWithStatus(&opt));
+  ASSERT_EQ(0, NumTables());
   for (int i = 0; i < kNum; i++) {
     char buf[100];
     snprintf(buf, sizeof(buf), "%050d", i);
@@ -279,6 +300,46 @@ TEST(RecoveryTest, MultipleMemTables) {
   }
 }
 
+TEST(RecoveryTest, LogLargerThanChunk) {
+  Options opt;
+  opt.create_if_missing = true;
+  opt.write_buffer_size = 64 << 10;
+  opt.chunk_size = 1 << 20;
+  opt.num_chunk_tables = 1;
+  DestroyAndReopen(&opt);
+  ASSERT_OK(Put("foo", "bar"));
+  Close();
+
+  // A log holding three chunks of records, the chunk fills and is drained
+  // to level-0 while it is replayed
+  const int kNum = 3000;
+  const uint64_t lognum = FirstLogFile() + 1;
+  WritableFile* file;
+  ASSERT_OK(env()->NewWritableFile(LogName(lognum), &file));
+  log::Writer writer(file);
+  for (int i = 0; i < kNum; i++) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%08d", i);
+    WriteBatch batch;
+    batch.Put(buf, std::string(1000, 'a' + i % 26));
+    WriteBatchInternal::SetSequence(&batch, 1000 + i);
+    ASSERT_OK(writer.AddRecord(WriteBatchInternal::Contents(&batch)));
+  }
+  ASSERT_OK(file->Flush());
+  delete file;
+
+  for (int reopen = 0; reopen < 2; reopen++) {
+    ASSERT_OK(OpenWithStatus(&opt));
+    ASSERT_GT(NumTables(), 0);
+    ASSERT_EQ("bar", Get("foo"));
+    for (int i = 0; i < kNum; i++) {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "%08d", i);
+      ASSERT_EQ(std::string(1000, 'a' + i % 26), Get(buf));
+    }
+  }
+}
+
 TEST(RecoveryTest, MultipleLogFiles) {
   ASSERT_OK(Put("foo", "bar"));
   Close();
@@ -290,33 +351,32 @@ TEST(RecoveryTest, MultipleLogFiles) {
   MakeLogFile(old_log+2, 1001, "hi", "there");
   MakeLogFile(old_log+3, 1002, "foo", "bar2");
 
-  // Recover and check that all log files were processed.
-  Open();
-  ASSERT_LE(1, NumTables());
-  ASSERT_EQ(1, NumLogs());
-  uint64_t new_log = FirstLogFile();
-  ASSERT_LE(old_log+3, new_log);
+  // Recover and check that all log files were processed.  The chunks
+  // exist already, so the records are kept for them instead of being
+  // written to level-0, and their logs stay until they are moved
+  ASSERT_OK(OpenWithStatus());
+  ASSERT_EQ(0, NumTables());
+  ASSERT_LE(4, NumLogs());
   ASSERT_EQ("bar2", Get("foo"));
   ASSERT_EQ("world", Get("hello"));
   ASSERT_EQ("there", Get("hi"));
 
   // Test that previous recovery produced recoverable state.
-  Open();
-  ASSERT_LE(1, NumTables());
-  ASSERT_EQ(1, NumLogs());
-  if (CanAppend()) {
-    ASSERT_EQ(new_log, FirstLogFile());
-  }
+  ASSERT_OK(OpenWithStatus());
   ASSERT_EQ("bar2", Get("foo"));
   ASSERT_EQ("world", Get("hello"));
   ASSERT_EQ("there", Get("hi"));
 
-  // Check that introducing an older log file does not cause it to be re-read.
+  // Once the records are in the chunks their logs are gone
+  CompactMemTable();
   Close();
+  ASSERT_EQ(1, NumLogs());
+  uint64_t new_log = FirstLogFile();
+  ASSERT_LE(old_log+3, new_log);
+
+  // Check that introducing an older log file does not cause it to be re-read.
   MakeLogFile(old_log+1, 2000, "hello", "stale write");
   Open();
-  ASSERT_LE(1, NumTables());
-  ASSERT_EQ(1, NumLogs());
   if (CanAppend()) {
     ASSERT_EQ(new_log, FirstLogFile());
   }
@@ -29,6 +29,8 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
 #include "port/port.h"
 #include "util/arena.h"
 #include "util/random.h"
@@ -59,11 +61,48 @@ public:
     void Insert(const Key& key);
 #endif
 
+    ////////////meggie
+    // Insert n keys.  In an NVM arena they are persisted as one group
+    // commit instead of flushing every node: the old links the batch
+    // changes go to an undo log first, the nodes are linked without
+    // flushing, and one watermark update commits them.  Recovery rolls
+    // back a batch that did not commit, so it sees all of keys or none.
+    // Sorted keys are found from the position of the key before them,
+    // which appends in linear time to an empty or smaller list, and they
+    // keep the undo log short.
+    // REQUIRES: none of keys is in the list, or equal to another
+    void InsertBatch(const Key* keys, size_t n);
+
+    // The arena bytes InsertBatch() takes for n keys at most, the nodes
+    // and the undo log included
+    static size_t MaxBatchBytes(size_t n);
+
+    // The steps of InsertBatch(), exposed so tests can stop short of the
+    // commit.  PrepareBatch() picks the node heights and persists the undo
+    // log, LinkBatch() links the nodes, CommitBatch() makes them durable.
+    void PrepareBatch(const Key* keys, size_t n, std::vector<int>* heights);
+    void LinkBatch(const Key* keys, size_t n, const std::vector<int>& heights);
+    void CommitBatch();
+
+    // Insert() that may run at the same time as other InsertConcurrently()
+    // calls as well as readers.  Nodes come from the arena's concurrent
+    // allocator and are linked with compare-and-swap, from the bottom
+    // level up.  DRAM arenas only, an NVM insert persists through header
+    // words every writer would share.
+    // REQUIRES: nothing that compares equal to key is in the list, and
+    // no Insert() or InsertBatch() runs at the same time
+    void InsertConcurrently(const Key& key);
+    ////////////meggie
+
     // Returns true iff an entry that compares equal to key is in the list.
     bool Contains(const Key& key) const;
 
     void SetHead(void *ptr);
 
+    ////////////meggie
+    class Finger;
+    ////////////meggie
+
     // Iteration over the contents of a skip list
     class Iterator {
     public:
@@ -94,6 +133,12 @@ public:
         // Advance to the first entry with a key >= target
         void Seek(const Key& target);
 
+        ////////////meggie
+        // Seek() for a run of ascending targets, each search picks up from
+        // where the previous one on finger stopped
+        void Seek(const Key& target, Finger* finger);
+        ////////////meggie
+
         // Position at the first entry in list.
         // Final state of iterator is Valid() iff list is not empty.
         void SeekToFirst();
@@ -134,7 +179,31 @@ private:
     Random rnd_;
 
     Node* NewNode(const Key& key, int height, bool head_alloc);
+    ////////////meggie
+    // Link a new node for key after prev[0..height-1].  With persist set
+    // the node is made durable before it is published, and the links after.
+    Node* LinkNode(const Key& key, int height, Node** prev, bool persist);
+
+    // A link of an existing node as it was before the running batch
+    struct UndoEntry {
+        uint64_t node;      // offset of the node from the map start
+        uint64_t level;
+        uint64_t next;      // raw link value
+    };
+    std::vector<UndoEntry> batch_undo_;
+
+    // Header value for the allocation point, see ArenaNVM::AllocatedBytes()
+    size_t PersistentAllocRem() const;
+    char* MapStart() const {
+        return reinterpret_cast<char*>(arena_->getMapStart());
+    }
+    // Restore the links saved by a batch that crashed before its commit
+    void RollBackBatch();
+    ////////////meggie
     int RandomHeight();
+    ////////////meggie
+    int RandomHeight(Random* rnd);
+    ////////////meggie
     bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
     // Return true if key is greater than the data stored in "n"
@@ -147,6 +216,15 @@ private:
     // node at "level" for every level in [0..max_height_-1].
     Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+    ////////////meggie
+    // FindGreaterOrEqual() that picks up from prev, filled by an earlier
+    // search for a key not after key.  Only the levels whose predecessor
+    // moved are walked, from the bottom up.
+    Node* FindGreaterOrEqualFrom(const Key& key, Node** prev) const;
+    // Fill prev for keys[j] of a batch, reusing prev if keys are sorted
+    Node* FindInBatch(const Key* keys, size_t j, Node** prev) const;
+    ////////////meggie
+
     // Return the latest node with a key < key.
     // Return head_ if there is no such node.
     Node* FindLessThan(const Key& key) const;
@@ -160,11 +238,27 @@ private:
     void operator=(const SkipList&);
 
 public:
+    ////////////meggie
+    // The predecessors of the last target sought with it, at every level
+    class Finger {
+    public:
+        Finger() : started_(false) { }
+    private:
+        friend class SkipList;
+        bool started_;
+        Node* prev_[kMaxHeight];
+    };
+    ////////////meggie
+
     //TODO: NoveLSM Make them private again
     void* head_offset_;   // Head offset from map_start
     Node* head_;
     size_t* alloc_rem;
-    uint64_t *sequence;
+    ////////////meggie
+    // Offset of the undo log of an uncommitted batch, 0 if there is none.
+    // This header word used to hold an unused sequence number.
+    uint64_t *undo_log;
+    ////////////meggie
     int* m_height;
 };
 
@@ -226,6 +320,27 @@ struct SkipList<Key,Comparator>::Node {
 #endif
     }
 
+    ////////////meggie
+    // Link x at level n if the next node there is still expected
+    bool CASNext(int n, Node* expected, Node* x) {
+        assert(n >= 0);
+#if defined(USE_OFFSETS)
+        return next_[n].CompareAndSwap(
+                reinterpret_cast<void*>(expected != NULL ? (intptr_t)this - (intptr_t)expected : 0),
+                reinterpret_cast<void*>(x != NULL ? (intptr_t)this - (intptr_t)x : 0));
+#else
+        return next_[n].CompareAndSwap(expected, x);
+#endif
+    }
+    ////////////meggie
+
+    ////////////meggie
+    // Raw link values, for saving and restoring them as they are stored
+    void* RawNext(int n) { return next_[n].NoBarrier_Load(); }
+    void RestoreNext(int n, void* raw) { next_[n].NoBarrier_Store(raw); }
+    const void* NextAddr(int n) const { return &next_[n]; }
+    ////////////meggie
+
 private:
     // Array of length equal to the node height.  next_[0] is lowest level link.
     port::AtomicPointer next_[1];
@@ -326,6 +441,20 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
         node_ = list_->FindGreaterOrEqual(target, NULL);
     }
 
+    ////////////meggie
+    template<typename Key, class Comparator>
+    inline void SkipList<Key,Comparator>::Iterator::Seek(const Key& target,
+            Finger* finger) {
+        if (!finger->started_) {
+            for (int i = 0; i < kMaxHeight; i++) {
+                finger->prev_[i] = list_->head_;
+            }
+            finger->started_ = true;
+        }
+        node_ = list_->FindGreaterOrEqualFrom(target, finger->prev_);
+    }
+    ////////////meggie
+
     template<typename Key, class Comparator>
     inline void SkipList<Key,Comparator>::Iterator::SeekToFirst() {
         node_ = list_->head_->Next(0);
@@ -341,10 +470,15 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
 
     template<typename Key, class Comparator>
     int SkipList<Key,Comparator>::RandomHeight() {
+        return RandomHeight(&rnd_);
+    }
+
+    template<typename Key, class Comparator>
+    int SkipList<Key,Comparator>::RandomHeight(Random* rnd) {
         // Increase height with probability 1 in kBranching
         static const unsigned int kBranching = 4;
         int height = 1;
-        while (height < kMaxHeight && ((rnd_.Next() % kBranching) == 0)) {
+        while (height < kMaxHeight && ((rnd->Next() % kBranching) == 0)) {
             height++;
         }
         assert(height > 0);
@@ -446,9 +580,12 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                 ArenaNVM *arena_nvm = (ArenaNVM*) arena;
                 head_ = (Node*)((uint8_t*)arena_nvm->getMapStart() + sizeof(size_t) + sizeof(uint64_t) + sizeof(int));
                 alloc_rem = (size_t *)arena_nvm->getMapStart();
-                sequence = (uint64_t *)((uint8_t*)arena_nvm->getMapStart() + sizeof(size_t));
+                undo_log = (uint64_t *)((uint8_t*)arena_nvm->getMapStart() + sizeof(size_t));
                 m_height = (int *)((uint8_t*)arena_nvm->getMapStart() + sizeof(size_t) + sizeof(uint64_t));
                 max_height_.NoBarrier_Store(reinterpret_cast<void*>(*m_height));
+                if (*undo_log != 0) {
+                    RollBackBatch();
+                }
             }
             else
 #endif
@@ -467,12 +604,12 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                 DEBUG_T("ArenaNVM, init alloc_rem, start\n");
                 ArenaNVM *arena_nvm = (ArenaNVM*) arena;
                 alloc_rem = (size_t *)arena_nvm->getMapStart();
-                *alloc_rem = arena_->getAllocRem();
+                *alloc_rem = PersistentAllocRem();
                 flush_cache(alloc_rem, CACHE_LINE_SIZE);
 
-                sequence = (uint64_t *)((uint8_t*)arena_->getMapStart() + sizeof(size_t));
-                *sequence = 0;
-                flush_cache(sequence, CACHE_LINE_SIZE);
+                undo_log = (uint64_t *)((uint8_t*)arena_->getMapStart() + sizeof(size_t));
+                *undo_log = 0;
+                flush_cache(undo_log, CACHE_LINE_SIZE);
 
                 m_height = (int *)((uint8_t*)arena_->getMapStart() + sizeof(size_t) + sizeof(uint64_t));
                 *m_height = GetMaxHeight();
@@ -510,13 +647,6 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                 Node* prev[kMaxHeight];
                 Node* x = FindGreaterOrEqual(key, prev);
 
-                // Update sequence number before updating data
-#ifdef ENABLE_RECOVERY
-                if (arena_->nvmarena_) {
-                    *sequence = s;
-                }
-#endif
-
                 // Our data structure does not allow duplicate insertion
 #if defined(USE_OFFSETS)
                 assert(x == NULL || !Equal(key, reinterpret_cast<Key>((intptr_t)x - (intptr_t)x->key_offset)));
@@ -524,13 +654,67 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                 assert(x == NULL || !Equal(key, x->key));
 #endif
 
-                int height = RandomHeight();
+                LinkNode(key, RandomHeight(), prev, arena_->nvmarena_);
+                /*if(arena_->nvmarena_)
+                    DEBUG_T("SkipList insert, end,key:%p, alloc_rem:%zu\n", key, *alloc_rem);*/
+            }
+
+            ////////////meggie
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::InsertConcurrently(const Key& key) {
+                assert(!arena_->nvmarena_);
+                // rnd_ belongs to the single writer, each thread draws
+                // heights from a generator of its own
+                static thread_local char tls;
+                static thread_local Random rnd(0xdeadbeef ^
+                        static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&tls) >> 4));
+                const int height = RandomHeight(&rnd);
+
+                // A reader may see the new height before the new levels of
+                // head_ are linked, it drops down from the NULL it finds
+                int max_height = GetMaxHeight();
+                while (height > max_height) {
+                    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                reinterpret_cast<void*>(height)))
+                        break;
+                    max_height = GetMaxHeight();
+                }
+
+                Node* prev[kMaxHeight];
+                FindGreaterOrEqual(key, prev);
+                char* mem = arena_->AllocateAlignedConcurrent(
+                        sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+#if defined(USE_OFFSETS)
+                Node* x = new (mem) Node(key, mem);
+#else
+                Node* x = new (mem) Node(key);
+#endif
+                // Bottom up, so a node reachable at a level is in all the
+                // levels below.  A failed swap means another writer linked
+                // a node after prev[i], the search at that level resumes
+                // from prev[i], which still sorts before key.
+                for (int i = 0; i < height; i++) {
+                    while (true) {
+                        Node* next = prev[i]->Next(i);
+                        while (KeyIsAfterNode(key, next)) {
+                            prev[i] = next;
+                            next = next->Next(i);
+                        }
+                        x->NoBarrier_SetNext(i, next);
+                        if (prev[i]->CASNext(i, next, x))
+                            break;
+                    }
+                }
+            }
+
+            template<typename Key, class Comparator>
+            typename SkipList<Key,Comparator>::Node*
+            SkipList<Key,Comparator>::LinkNode(const Key& key, int height,
+                    Node** prev, bool persist) {
                 if (height > GetMaxHeight()) {
                     for (int i = GetMaxHeight(); i < height; i++) {
                         prev[i] = head_;
                     }
-                    //fprintf(stderr, "Change height from %d to %d\n", max_height_, height);
-
                     // It is ok to mutate max_height_ without any synchronization
                     // with concurrent readers.  A concurrent reader that observes
                     // the new value of max_height_ will see either the old value of
@@ -541,29 +725,236 @@ inline void SkipList<Key,Comparator>::Iterator::SetHead(void *ptr) {
                     max_height_.NoBarrier_Store(reinterpret_cast<void*>(height));
                 }
 
-                x = NewNode(key, height, false);
+                Node* x = NewNode(key, height, false);
                 for (int i = 0; i < height; i++) {
                     // NoBarrier_SetNext() suffices since we will add a barrier when
                     // we publish a pointer to "x" in prev[i].
                     x->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
+                }
+                if (persist) {
+                    // The node, and the allocation point past it, must be
+                    // durable before anything durable links to it.
+                    flush_lines(x, sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+#ifdef ENABLE_RECOVERY
+                    *alloc_rem = PersistentAllocRem();
+                    // A stale max_height after a crash would just lead to
+                    // inefficient lookups (O(n) vs O(logn)).
+                    *m_height = GetMaxHeight();
+                    flush_lines(alloc_rem, sizeof(size_t) + sizeof(uint64_t) + sizeof(int));
+#endif
+                    persist_barrier();
+                }
+                for (int i = 0; i < height; i++) {
                     prev[i]->SetNext(i, x);
-                    if (arena_->nvmarena_ == true) {
-                        flush_cache((void *)x, sizeof(Node));
-                        flush_cache((void *)prev[i], sizeof(Node));
+                    if (persist) {
+                        flush_lines(prev[i]->NextAddr(i), sizeof(port::AtomicPointer));
+                    }
+                }
+                if (persist) {
+                    persist_barrier();
+                }
+                return x;
+            }
+
+            template<typename Key, class Comparator>
+            size_t SkipList<Key,Comparator>::MaxBatchBytes(size_t n) {
+                // every allocation may be padded to the arena's alignment
+                const size_t node = sizeof(Node) +
+                    sizeof(port::AtomicPointer) * (kMaxHeight - 1) + 8;
+                const size_t undo = sizeof(uint64_t) +
+                    n * kMaxHeight * sizeof(UndoEntry) + 8;
+                return n * node + undo;
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::InsertBatch(const Key* keys, size_t n) {
+                std::vector<int> heights;
+                if (arena_->nvmarena_) {
+#ifdef ENABLE_RECOVERY
+                    PrepareBatch(keys, n, &heights);
+                    LinkBatch(keys, n, heights);
+                    CommitBatch();
+#else
+                    for (size_t i = 0; i < n; i++) {
+                        Insert(keys[i]);
+                    }
+#endif
+                    return;
+                }
+                heights.resize(n);
+                for (size_t i = 0; i < n; i++) {
+                    heights[i] = RandomHeight();
+                }
+                LinkBatch(keys, n, heights);
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::PrepareBatch(const Key* keys, size_t n,
+                    std::vector<int>* heights) {
+                assert(batch_undo_.empty());
+                heights->resize(n);
+                // A link changed more than once only needs its first value,
+                // with sorted keys repeats come one after another
+                Node* last[kMaxHeight] = { NULL };
+                Node* prev[kMaxHeight];
+                const int old_height = GetMaxHeight();
+                for (size_t j = 0; j < n; j++) {
+                    const int height = RandomHeight();
+                    (*heights)[j] = height;
+                    FindInBatch(keys, j, prev);
+                    for (int i = 0; i < height; i++) {
+                        Node* p = (i < old_height) ? prev[i] : head_;
+                        if (p == last[i])
+                            continue;
+                        last[i] = p;
+                        UndoEntry e;
+                        e.node = reinterpret_cast<char*>(p) - MapStart();
+                        e.level = i;
+                        e.next = reinterpret_cast<uint64_t>(p->RawNext(i));
+                        batch_undo_.push_back(e);
+                    }
+                }
+#ifdef ENABLE_RECOVERY
+                if (!arena_->nvmarena_ || batch_undo_.empty())
+                    return;
+                // the log goes above the committed allocation point, so a
+                // rollback frees it with the nodes
+                const size_t bytes = sizeof(uint64_t) + batch_undo_.size() * sizeof(UndoEntry);
+                char* log = reinterpret_cast<ArenaNVM*>(arena_)->AllocateAlignedNVM(bytes);
+                const uint64_t count = batch_undo_.size();
+                memcpy(log, &count, sizeof(count));
+                memcpy(log + sizeof(count), &batch_undo_[0], count * sizeof(UndoEntry));
+                flush_lines(log, bytes);
+                persist_barrier();
+                *undo_log = log - MapStart();
+                flush_lines(undo_log, sizeof(uint64_t));
+                persist_barrier();
+#endif
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::LinkBatch(const Key* keys, size_t n,
+                    const std::vector<int>& heights) {
+                Node* prev[kMaxHeight];
+                for (size_t j = 0; j < n; j++) {
+                    Node* x = FindInBatch(keys, j, prev);
+#if defined(USE_OFFSETS)
+                    assert(x == NULL || !Equal(keys[j], reinterpret_cast<Key>((intptr_t)x - (intptr_t)x->key_offset)));
+#else
+                    assert(x == NULL || !Equal(keys[j], x->key));
+#endif
+                    x = LinkNode(keys[j], heights[j], prev, false);
+                    // the new node precedes the next key on its levels
+                    for (int i = 0; i < heights[j]; i++) {
+                        prev[i] = x;
                     }
                 }
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::CommitBatch() {
 #ifdef ENABLE_RECOVERY
                 if (arena_->nvmarena_) {
-                    *alloc_rem = arena_->getAllocRem();
-                    // Set max_height after insertion to ensure correctness.
-                    // If NovelSM crashes before updating this, it would just
-                    // lead to inefficient lookups (O(n) vs O(logn)).
+                    // everything allocated since the last commit: the
+                    // nodes, the entries copied for them and the undo log
+                    ArenaNVM* nvm_arena = reinterpret_cast<ArenaNVM*>(arena_);
+                    const size_t committed = nvm_arena->Capacity() - *alloc_rem;
+                    const size_t allocated = nvm_arena->AllocatedBytes();
+                    if (allocated > committed) {
+                        flush_lines(MapStart() + committed, allocated - committed);
+                    }
+                    // and the old links pointing into it
+                    for (size_t i = 0; i < batch_undo_.size(); i++) {
+                        Node* p = reinterpret_cast<Node*>(MapStart() + batch_undo_[i].node);
+                        flush_lines(p->NextAddr(batch_undo_[i].level), sizeof(port::AtomicPointer));
+                    }
+                    persist_barrier();
+                    // the commit point
+                    *alloc_rem = PersistentAllocRem();
                     *m_height = GetMaxHeight();
+                    flush_lines(alloc_rem, sizeof(size_t) + sizeof(uint64_t) + sizeof(int));
+                    persist_barrier();
+                    // a crash before this rolls back links that are already
+                    // durable, which only leaks the batch
+                    *undo_log = 0;
+                    flush_lines(undo_log, sizeof(uint64_t));
+                    persist_barrier();
                 }
 #endif
-                /*if(arena_->nvmarena_)
-                    DEBUG_T("SkipList insert, end,key:%p, alloc_rem:%zu\n", key, *alloc_rem);*/
+                batch_undo_.clear();
+            }
+
+            template<typename Key, class Comparator>
+            typename SkipList<Key,Comparator>::Node*
+            SkipList<Key,Comparator>::FindGreaterOrEqualFrom(const Key& key,
+                    Node** prev) const {
+                // a level whose predecessor stays has none moving above it,
+                // the next node of a higher level is never before that of a
+                // lower one
+                const int top = GetMaxHeight();
+                int level = 0;
+                while (level < top && KeyIsAfterNode(key, prev[level]->Next(level))) {
+                    level++;
+                }
+                // below it, once a level moved past its old predecessor the
+                // lower ones start from the new position
+                bool moved = false;
+                Node* x = NULL;
+                for (int i = level - 1; i >= 0; i--) {
+                    if (!moved) {
+                        x = prev[i];
+                    }
+                    Node* next = x->Next(i);
+                    while (KeyIsAfterNode(key, next)) {
+                        x = next;
+                        next = x->Next(i);
+                        moved = true;
+                    }
+                    prev[i] = x;
+                }
+                return prev[0]->Next(0);
+            }
+
+            template<typename Key, class Comparator>
+            typename SkipList<Key,Comparator>::Node*
+            SkipList<Key,Comparator>::FindInBatch(const Key* keys, size_t j,
+                    Node** prev) const {
+                if (j == 0 || compare_(keys[j - 1], keys[j]) >= 0) {
+                    for (int i = 0; i < kMaxHeight; i++) {
+                        prev[i] = head_;
+                    }
+                }
+                return FindGreaterOrEqualFrom(keys[j], prev);
+            }
+
+            template<typename Key, class Comparator>
+            size_t SkipList<Key,Comparator>::PersistentAllocRem() const {
+                // kept as remaining bytes for older chunk files, it wraps
+                // once the arena grows past its capacity
+                ArenaNVM* nvm_arena = reinterpret_cast<ArenaNVM*>(arena_);
+                return nvm_arena->Capacity() - nvm_arena->AllocatedBytes();
+            }
+
+            template<typename Key, class Comparator>
+            void SkipList<Key,Comparator>::RollBackBatch() {
+#ifdef ENABLE_RECOVERY
+                const char* log = MapStart() + *undo_log;
+                uint64_t count;
+                memcpy(&count, log, sizeof(count));
+                for (uint64_t i = 0; i < count; i++) {
+                    UndoEntry e;
+                    memcpy(&e, log + sizeof(count) + i * sizeof(UndoEntry), sizeof(e));
+                    Node* p = reinterpret_cast<Node*>(MapStart() + e.node);
+                    p->RestoreNext(e.level, reinterpret_cast<void*>(e.next));
+                    flush_lines(p->NextAddr(e.level), sizeof(port::AtomicPointer));
+                }
+                persist_barrier();
+                *undo_log = 0;
+                flush_lines(undo_log, sizeof(uint64_t));
+                persist_barrier();
+#endif
             }
+            ////////////meggie
 
             template<typename Key, class Comparator>
             bool SkipList<Key,Comparator>::Contains(const Key& key) const {
@@ -0,0 +1,230 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/skiplist.h"
+#include <string.h>
+#include <algorithm>
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "util/arena.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static int comparisons = 0;
+
+// Keys are NUL terminated strings kept in the same arena as the nodes, as
+// the memtable entries of a chunk are.
+struct StringComparator {
+  int operator()(const char* a, const char* b) const {
+    comparisons++;
+    return strcmp(a, b);
+  }
+};
+
+typedef SkipList<const char*, StringComparator> NVMList;
+
+static const size_t kArenaSize = 1 << 20;
+
+class SkipListBatchTest {
+ public:
+  SkipListBatchTest() : arena_(NULL), list_(NULL), rnd_(301) {
+    fname_ = test::TmpDir() + "/skiplist_batch_test";
+    unlink(fname_.c_str());
+    arena_ = new ArenaNVM(&fname_, kArenaSize, false);
+    list_ = new NVMList(StringComparator(), arena_, false);
+  }
+
+  ~SkipListBatchTest() {
+    Close();
+    unlink(fname_.c_str());
+  }
+
+  // Drop the list without any further writes.  What the mapping holds is
+  // what a crash would leave, with every store already on media.
+  void Close() {
+    delete list_;
+    delete arena_;
+    list_ = NULL;
+    arena_ = NULL;
+  }
+
+  void Reopen() {
+    Close();
+    arena_ = new ArenaNVM(&fname_, kArenaSize, true);
+    list_ = new NVMList(StringComparator(), arena_, true);
+  }
+
+  // n new keys, sorted, that are not in the list yet
+  std::vector<const char*> NewKeys(int n) {
+    std::set<std::string> fresh;
+    while (fresh.size() < static_cast<size_t>(n)) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "key%010u", rnd_.Next());
+      if (expected_.count(buf) == 0) fresh.insert(buf);
+    }
+    std::vector<const char*> keys;
+    for (std::set<std::string>::iterator it = fresh.begin();
+         it != fresh.end(); ++it) {
+      char* mem = arena_->AllocateAlignedNVM(it->size() + 1);
+      memcpy(mem, it->c_str(), it->size() + 1);
+      keys.push_back(mem);
+    }
+    return keys;
+  }
+
+  void Expect(const std::vector<const char*>& keys) {
+    for (size_t i = 0; i < keys.size(); i++) expected_.insert(keys[i]);
+  }
+
+  // the list holds exactly the expected keys, in order
+  void Check() {
+    NVMList::Iterator iter(list_);
+    std::set<std::string>::iterator it = expected_.begin();
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next(), ++it) {
+      ASSERT_TRUE(it != expected_.end());
+      const char* key = reinterpret_cast<const char*>(
+          (intptr_t)iter.node_ - (intptr_t)iter.key_offset());
+      ASSERT_EQ(*it, std::string(key));
+      ASSERT_TRUE(list_->Contains(key));
+    }
+    ASSERT_TRUE(it == expected_.end());
+  }
+
+  std::string fname_;
+  ArenaNVM* arena_;
+  NVMList* list_;
+  Random rnd_;
+  std::set<std::string> expected_;
+};
+
+TEST(SkipListBatchTest, CommittedBatchesSurviveReopen) {
+  for (int round = 0; round < 5; round++) {
+    std::vector<const char*> keys = NewKeys(500);
+    list_->InsertBatch(&keys[0], keys.size());
+    Expect(keys);
+  }
+  Check();
+  Reopen();
+  Check();
+}
+
+TEST(SkipListBatchTest, UncommittedBatchIsRolledBack) {
+  std::vector<const char*> keys = NewKeys(500);
+  list_->InsertBatch(&keys[0], keys.size());
+  Expect(keys);
+
+  // crash after every link of the next batch went through
+  std::vector<const char*> lost = NewKeys(500);
+  std::vector<int> heights;
+  list_->PrepareBatch(&lost[0], lost.size(), &heights);
+  list_->LinkBatch(&lost[0], lost.size(), heights);
+  Reopen();
+  Check();
+
+  // the space of the lost batch is reused without harm
+  for (int round = 0; round < 3; round++) {
+    keys = NewKeys(300);
+    list_->InsertBatch(&keys[0], keys.size());
+    Expect(keys);
+  }
+  Check();
+  Reopen();
+  Check();
+}
+
+TEST(SkipListBatchTest, CrashBeforeLinking) {
+  std::vector<const char*> keys = NewKeys(200);
+  list_->InsertBatch(&keys[0], keys.size());
+  Expect(keys);
+
+  std::vector<const char*> lost = NewKeys(200);
+  std::vector<int> heights;
+  list_->PrepareBatch(&lost[0], lost.size(), &heights);
+  Reopen();
+  Check();
+}
+
+TEST(SkipListBatchTest, SingleInsertsMixWithBatches) {
+  std::vector<const char*> keys = NewKeys(100);
+  for (size_t i = 0; i < keys.size(); i++) list_->Insert(keys[i]);
+  Expect(keys);
+  keys = NewKeys(400);
+  list_->InsertBatch(&keys[0], keys.size());
+  Expect(keys);
+  keys = NewKeys(100);
+  for (size_t i = 0; i < keys.size(); i++) list_->Insert(keys[i]);
+  Expect(keys);
+  Reopen();
+  Check();
+}
+
+TEST(SkipListBatchTest, UnsortedBatch) {
+  std::vector<const char*> keys = NewKeys(300);
+  list_->InsertBatch(&keys[0], keys.size());
+  Expect(keys);
+  keys = NewKeys(300);
+  std::random_shuffle(keys.begin(), keys.end());
+  list_->InsertBatch(&keys[0], keys.size());
+  Expect(keys);
+  Check();
+  Reopen();
+  Check();
+}
+
+TEST(SkipListBatchTest, SortedBatchSkipsTheSearch) {
+  // into an empty list a sorted batch is an append
+  std::vector<const char*> keys = NewKeys(2000);
+  comparisons = 0;
+  list_->InsertBatch(&keys[0], keys.size());
+  Expect(keys);
+  ASSERT_LE(comparisons, 3 * 2000);
+
+  // merging one into a list of the same size, undo log pass included,
+  // costs less than looking each key up
+  keys = NewKeys(2000);
+  comparisons = 0;
+  list_->InsertBatch(&keys[0], keys.size());
+  Expect(keys);
+  int merged = comparisons;
+  comparisons = 0;
+  for (size_t i = 0; i < keys.size(); i++) list_->Contains(keys[i]);
+  ASSERT_LT(merged, comparisons);
+  Check();
+}
+
+TEST(SkipListBatchTest, DRAMArena) {
+  Arena arena;
+  NVMList list(StringComparator(), &arena);
+  std::vector<std::string> strings;
+  for (int i = 0; i < 1000; i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%06d", i * 7 % 1000);
+    strings.push_back(buf);
+  }
+  std::sort(strings.begin(), strings.begin() + 500);
+  std::vector<const char*> keys;
+  for (size_t i = 0; i < strings.size(); i++) keys.push_back(strings[i].c_str());
+  list.InsertBatch(&keys[0], 500);
+  list.InsertBatch(&keys[500], 500);
+  NVMList::Iterator iter(&list);
+  int n = 0;
+  std::string last;
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next(), n++) {
+    std::string key(reinterpret_cast<const char*>(
+        (intptr_t)iter.node_ - (intptr_t)iter.key_offset()));
+    ASSERT_LT(last, key);
+    last = key;
+  }
+  ASSERT_EQ(1000, n);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -118,6 +118,41 @@ Status TableCache::Get(const ReadOptions& options,
   return s;
 }
 
+///////////meggie
+Status TableCache::MultiGet(const ReadOptions& options,
+                            uint64_t file_number,
+                            uint64_t file_size,
+                            const Slice* keys,
+                            size_t n,
+                            void** args,
+                            void (*saver)(void*, const Slice&, const Slice&)) {
+  Cache::Handle* handle = nullptr;
+  Status s = FindTable(file_number, file_size, &handle);
+  if (s.ok()) {
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    s = t->InternalMultiGet(options, keys, n, args, saver);
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+bool TableCache::Prefetch(const ReadOptions& options,
+                          uint64_t file_number,
+                          uint64_t file_size,
+                          const Slice& k) {
+  Cache::Handle* handle = nullptr;
+  Status s = FindTable(file_number, file_size, &handle);
+  if (!s.ok()) {
+    // Get() reports the error
+    return true;
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  bool may_match = t->InternalPrefetch(options, k);
+  cache_->Release(handle);
+  return may_match;
+}
+///////////meggie
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
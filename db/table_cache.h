@@ -44,6 +44,25 @@ class TableCache {
              void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  ///////////meggie
+  // Get() for keys[0..n-1] of the same file, in ascending order.  The
+  // file is looked up once and each of its blocks read once for them
+  Status MultiGet(const ReadOptions& options,
+                  uint64_t file_number,
+                  uint64_t file_size,
+                  const Slice* keys,
+                  size_t n,
+                  void** args,
+                  void (*handle_result)(void*, const Slice&, const Slice&));
+
+  // Start reading the block a Get() of "k" would read from the specified
+  // file.  Returns false if the file's filter rules "k" out.
+  bool Prefetch(const ReadOptions& options,
+                uint64_t file_number,
+                uint64_t file_size,
+                const Slice& k);
+  ///////////meggie
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
@@ -25,22 +25,39 @@ enum Tag {
   // 8 was used for large value refs
   kPrevLogNumber        = 9,
   /////////////////meggie
-  kUpdatedChunkNumber    = 10,
-  kMetaNumber    = 11
+  kUpdatedChunkNumber    = 10,   // legacy: always kLegacyNumChunkTable files
+  kMetaNumber    = 11,
+  kChunkFiles    = 12,   // count followed by that many chunk file numbers
+  kNewFileHashRange    = 13,   // chunk hash range of the preceding kNewFile
+  kChunkBoundaries    = 14,   // range partition boundaries
+  kChunkPartitionType    = 15,
+  kChunkHashBoundaries    = 16,   // hash partition boundaries
+  kDrainingChunkFiles    = 17    // chunk files still being flushed to L0
   /////////////////meggie
 };
 
+/////////////////meggie
+// Number of chunk files written under kUpdatedChunkNumber, from the time
+// the partition count was fixed at compile time.
+static const int kLegacyNumChunkTable = 4;
+/////////////////meggie
+
 void VersionEdit::Clear() {
   comparator_.clear();
   log_number_ = 0;
   prev_log_number_ = 0;
   //////////////////meggie
-  chunk_files_.resize(kNumChunkTable);
-  for(int i = 0; i < kNumChunkTable; i++){
-      chunk_files_[i] = 0;
-  } 
+  chunk_files_.clear();
   has_updated_chunk_ = false;
   has_meta_number_ = false;
+  chunk_partition_type_ = 0;
+  has_chunk_partition_type_ = false;
+  chunk_boundaries_.clear();
+  has_chunk_boundaries_ = false;
+  chunk_hash_boundaries_.clear();
+  has_chunk_hash_boundaries_ = false;
+  draining_chunk_files_.clear();
+  has_draining_chunk_files_ = false;
   //////////////////meggie
   last_sequence_ = 0;
   next_file_number_ = 0;
@@ -97,14 +114,47 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint64(dst, f.file_size);
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
+    ///////////////////meggie
+    if(f.has_hash_range){
+      PutVarint32(dst, kNewFileHashRange);
+      PutVarint32(dst, f.hash_lo);
+      PutVarint32(dst, f.hash_hi);
+    }
+    ///////////////////meggie
   }
   ///////////////////meggie
   if(has_updated_chunk_){
-      PutVarint32(dst, kUpdatedChunkNumber);
-      for(int i = 0; i < kNumChunkTable; i++){
+      PutVarint32(dst, kChunkFiles);
+      PutVarint32(dst, chunk_files_.size());
+      for(size_t i = 0; i < chunk_files_.size(); i++){
         PutVarint64(dst, chunk_files_[i]);
       }
   }
+  if(has_draining_chunk_files_){
+      PutVarint32(dst, kDrainingChunkFiles);
+      PutVarint32(dst, draining_chunk_files_.size());
+      for(size_t i = 0; i < draining_chunk_files_.size(); i++){
+        PutVarint64(dst, draining_chunk_files_[i]);
+      }
+  }
+  if(has_chunk_partition_type_){
+      PutVarint32(dst, kChunkPartitionType);
+      PutVarint32(dst, chunk_partition_type_);
+  }
+  if(has_chunk_hash_boundaries_){
+      PutVarint32(dst, kChunkHashBoundaries);
+      PutVarint32(dst, chunk_hash_boundaries_.size());
+      for(size_t i = 0; i < chunk_hash_boundaries_.size(); i++){
+        PutVarint32(dst, chunk_hash_boundaries_[i]);
+      }
+  }
+  if(has_chunk_boundaries_){
+      PutVarint32(dst, kChunkBoundaries);
+      PutVarint32(dst, chunk_boundaries_.size());
+      for(size_t i = 0; i < chunk_boundaries_.size(); i++){
+        PutLengthPrefixedSlice(dst, chunk_boundaries_[i]);
+      }
+  }
   if(has_meta_number_){
     DEBUG_T("edit add metafile:%lu\n", chunkmeta_file_);
     PutVarint32(dst, kMetaNumber);
@@ -148,7 +198,7 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   InternalKey key;
   ////////////meggie
   uint64_t chunk_number;
-  int count = 0;
+  uint32_t count = 0;
   ////////////meggie
 
   while (msg == nullptr && GetVarint32(&input, &tag)) {
@@ -226,20 +276,102 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
       ///////////////////////meggie
       case kUpdatedChunkNumber:
         has_updated_chunk_ = true;
+        chunk_files_.clear();
         //DEBUG_T("in decodefrom\n ");
-        for(int i = 0; i < kNumChunkTable; i++){
+        for(int i = 0; i < kLegacyNumChunkTable; i++){
             if(GetVarint64(&input, &chunk_number)){
-                chunk_files_[i] = chunk_number;
-                count++;
+                chunk_files_.push_back(chunk_number);
             }
-            //DEBUG_T("versionset, chunkindex_filenumber:%lu, chunkLogFilenumber:%lu\n",
-              //  chunkindex_files_[i], chunklog_files_[i]);
         }
-        if(!count){
+        if(chunk_files_.empty()){
             msg = "update chunk entry";
         }
         break;
+
+      case kChunkFiles:
+        has_updated_chunk_ = true;
+        chunk_files_.clear();
+        if(GetVarint32(&input, &count) && count > 0){
+            for(uint32_t i = 0; i < count; i++){
+                if(!GetVarint64(&input, &chunk_number)){
+                    msg = "chunk files entry";
+                    break;
+                }
+                chunk_files_.push_back(chunk_number);
+            }
+        } else {
+            msg = "chunk files entry";
+        }
+        break;
+
+      case kDrainingChunkFiles:
+        has_draining_chunk_files_ = true;
+        draining_chunk_files_.clear();
+        if(GetVarint32(&input, &count)){
+            for(uint32_t i = 0; i < count; i++){
+                if(!GetVarint64(&input, &chunk_number)){
+                    msg = "draining chunk files entry";
+                    break;
+                }
+                draining_chunk_files_.push_back(chunk_number);
+            }
+        } else {
+            msg = "draining chunk files entry";
+        }
+        break;
+
+      case kNewFileHashRange:
+        if(!new_files_.empty() &&
+           GetVarint32(&input, &new_files_.back().second.hash_lo) &&
+           GetVarint32(&input, &new_files_.back().second.hash_hi)){
+            new_files_.back().second.has_hash_range = true;
+        } else {
+            msg = "new-file hash range";
+        }
+        break;
+
+      case kChunkPartitionType:
+        if(GetVarint32(&input, &count)){
+            chunk_partition_type_ = static_cast<int>(count);
+            has_chunk_partition_type_ = true;
+        } else {
+            msg = "chunk partition type";
+        }
+        break;
+
+      case kChunkHashBoundaries:
+        has_chunk_hash_boundaries_ = true;
+        chunk_hash_boundaries_.clear();
+        if(GetVarint32(&input, &count)){
+            uint32_t hash_boundary;
+            for(uint32_t i = 0; i < count; i++){
+                if(!GetVarint32(&input, &hash_boundary)){
+                    msg = "chunk hash boundaries entry";
+                    break;
+                }
+                chunk_hash_boundaries_.push_back(hash_boundary);
+            }
+        } else {
+            msg = "chunk hash boundaries entry";
+        }
+        break;
       
+      case kChunkBoundaries:
+        has_chunk_boundaries_ = true;
+        chunk_boundaries_.clear();
+        if(GetVarint32(&input, &count)){
+            for(uint32_t i = 0; i < count; i++){
+                if(!GetLengthPrefixedSlice(&input, &str)){
+                    msg = "chunk boundaries entry";
+                    break;
+                }
+                chunk_boundaries_.push_back(str.ToString());
+            }
+        } else {
+            msg = "chunk boundaries entry";
+        }
+        break;
+
       case kMetaNumber:
         if (GetVarint64(&input, &chunkmeta_file_)) {
           DEBUG_T("edit recover metafile:%lu\n", chunkmeta_file_);
@@ -318,12 +450,39 @@ std::string VersionEdit::DebugString() const {
   }
   /////////////////meggie
   if(has_updated_chunk_){
-      for(int i = 0; i < kNumChunkTable; i++){
-          r.append("\n chunk files: ");
-          r.append("%d, ", i);
+      for(size_t i = 0; i < chunk_files_.size(); i++){
+          r.append("\n  ChunkFile: ");
+          AppendNumberTo(&r, i);
+          r.append(" ");
           AppendNumberTo(&r, chunk_files_[i]);
       }
   }
+  if(has_draining_chunk_files_){
+      for(size_t i = 0; i < draining_chunk_files_.size(); i++){
+          r.append("\n  DrainingChunkFile: ");
+          AppendNumberTo(&r, i);
+          r.append(" ");
+          AppendNumberTo(&r, draining_chunk_files_[i]);
+      }
+  }
+  if(has_chunk_partition_type_){
+      r.append("\n  ChunkPartitionType: ");
+      AppendNumberTo(&r, chunk_partition_type_);
+  }
+  if(has_chunk_hash_boundaries_){
+      r.append("\n  ChunkHashBoundaries:");
+      for(size_t i = 0; i < chunk_hash_boundaries_.size(); i++){
+          r.append(" ");
+          AppendNumberTo(&r, chunk_hash_boundaries_[i]);
+      }
+  }
+  if(has_chunk_boundaries_){
+      r.append("\n  ChunkBoundaries:");
+      for(size_t i = 0; i < chunk_boundaries_.size(); i++){
+          r.append(" ");
+          r.append(EscapeString(chunk_boundaries_[i]));
+      }
+  }
   /////////////////meggie
   r.append("\n}\n");
   return r;
@@ -23,14 +23,20 @@ struct FileMetaData {
   InternalKey largest;        // Largest internal key served by table
 
   ////////meggie
-  int hash;
+  // Inclusive range of key hashes owned by the hash partitioned chunk an
+  // L0 file was flushed from.  Lookups outside it can skip the file.
+  bool has_hash_range;
+  uint32_t hash_lo;
+  uint32_t hash_hi;
   ////////meggie
   FileMetaData() : 
       refs(0), 
       allowed_seeks(1 << 30), 
       file_size(0) ,
       ///////////meggie
-      hash(-1)
+      has_hash_range(false),
+      hash_lo(0),
+      hash_hi(0)
       ///////////meggie
       { }
 };
@@ -72,22 +78,26 @@ class VersionEdit {
   void AddFile(int level, uint64_t file,
                uint64_t file_size,
                const InternalKey& smallest,
-               const InternalKey& largest,
-               /////////////meggie
-               int hash = -1
-               /////////////meggie
-               ) {
+               const InternalKey& largest) {
     FileMetaData f;
     f.number = file;
     f.file_size = file_size;
     f.smallest = smallest;
     f.largest = largest;
-    ////////meggie
-    f.hash = hash;
-    ////////meggie
     new_files_.push_back(std::make_pair(level, f));
   }
 
+  ////////meggie
+  // Add a file together with its chunk hash range, if any.
+  void AddFile(int level, const FileMetaData& meta) {
+    AddFile(level, meta.number, meta.file_size, meta.smallest, meta.largest);
+    FileMetaData& f = new_files_.back().second;
+    f.has_hash_range = meta.has_hash_range;
+    f.hash_lo = meta.hash_lo;
+    f.hash_hi = meta.hash_hi;
+  }
+  ////////meggie
+
   // Delete the specified "file" from the specified "level".
   void DeleteFile(int level, uint64_t file) {
     deleted_files_.insert(std::make_pair(level, file));
@@ -101,14 +111,37 @@ class VersionEdit {
   ///////////////////meggie
   void update_chunkfiles(std::vector<uint64_t>& newest_chunk_files){
       has_updated_chunk_ = true;
-      for(int i = 0; i < newest_chunk_files.size(); i++){
-          chunk_files_[i] = newest_chunk_files[i];
-      }
+      chunk_files_.assign(newest_chunk_files.begin(), 
+                          newest_chunk_files.end());
+  }
+  // Chunk files that were switched out of their partition and are still
+  // being flushed to level-0, parallel to the chunk files.  0 means the
+  // partition has none.
+  void SetDrainingChunkFiles(const std::vector<uint64_t>& draining_chunk_files){
+      has_draining_chunk_files_ = true;
+      draining_chunk_files_ = draining_chunk_files;
   }
   void SetMetaNumber(uint64_t num) {
     has_meta_number_ = true;
     chunkmeta_file_ = num;
   }
+  void SetChunkPartitionType(int type) {
+    has_chunk_partition_type_ = true;
+    chunk_partition_type_ = type;
+  }
+  // Learned boundaries of range partitioned chunks.  boundaries[i] is the
+  // first user key of chunk i+1.
+  void SetChunkBoundaries(const std::vector<std::string>& boundaries) {
+    has_chunk_boundaries_ = true;
+    chunk_boundaries_ = boundaries;
+  }
+  // Boundaries of hash partitioned chunks once they are no longer an even
+  // split of the hash space.  hash_boundaries[i] is the first hash of
+  // chunk i+1.
+  void SetChunkHashBoundaries(const std::vector<uint32_t>& hash_boundaries) {
+    has_chunk_hash_boundaries_ = true;
+    chunk_hash_boundaries_ = hash_boundaries;
+  }
   ///////////////////meggie
 
  private:
@@ -136,6 +169,14 @@ class VersionEdit {
   bool has_updated_chunk_;
   uint64_t chunkmeta_file_;
   bool has_meta_number_;
+  int chunk_partition_type_;
+  bool has_chunk_partition_type_;
+  std::vector<std::string> chunk_boundaries_;
+  bool has_chunk_boundaries_;
+  std::vector<uint32_t> chunk_hash_boundaries_;
+  bool has_chunk_hash_boundaries_;
+  std::vector<uint64_t> draining_chunk_files_;
+  bool has_draining_chunk_files_;
   //////////////////meggie
 };
 
@@ -39,6 +39,46 @@ TEST(VersionEditTest, EncodeDecode) {
   TestEncodeDecode(edit);
 }
 
+TEST(VersionEditTest, ChunkFiles) {
+  VersionEdit edit;
+  std::vector<uint64_t> chunk_files;
+  for (uint64_t i = 0; i < 7; i++) {
+    chunk_files.push_back(100 + i);
+  }
+  edit.update_chunkfiles(chunk_files);
+  edit.SetMetaNumber(99);
+  std::vector<std::string> boundaries;
+  boundaries.push_back("bar");
+  boundaries.push_back("foo");
+  edit.SetChunkBoundaries(boundaries);
+  edit.SetChunkPartitionType(kRangePartition);
+  std::vector<uint32_t> hash_boundaries;
+  hash_boundaries.push_back(1u << 30);
+  hash_boundaries.push_back(1u << 31);
+  edit.SetChunkHashBoundaries(hash_boundaries);
+  FileMetaData meta;
+  meta.number = 200;
+  meta.file_size = 300;
+  meta.smallest = InternalKey("foo", 1, kTypeValue);
+  meta.largest = InternalKey("zoo", 2, kTypeValue);
+  meta.has_hash_range = true;
+  meta.hash_lo = 1u << 30;
+  meta.hash_hi = (1u << 31) - 1;
+  edit.AddFile(0, meta);
+  TestEncodeDecode(edit);
+
+  std::string encoded;
+  edit.EncodeTo(&encoded);
+  VersionEdit parsed;
+  ASSERT_OK(parsed.DecodeFrom(encoded));
+  std::string debug = parsed.DebugString();
+  ASSERT_TRUE(debug.find("ChunkFile: 6 106") != std::string::npos) << debug;
+  ASSERT_TRUE(debug.find("ChunkBoundaries: bar foo") != std::string::npos)
+      << debug;
+  ASSERT_TRUE(debug.find("ChunkHashBoundaries: 1073741824 2147483648") !=
+              std::string::npos) << debug;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -273,6 +273,7 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  SequenceNumber sequence;
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -283,6 +284,7 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
       s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
+      s->sequence = parsed_key.sequence;
       if (s->state == kFound) {
         s->value->assign(v.data(), v.size());
       }
@@ -305,6 +307,12 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key,
   tmp.reserve(files_[0].size());
   for (uint32_t i = 0; i < files_[0].size(); i++) {
     FileMetaData* f = files_[0][i];
+    //////////meggie
+    if (f->has_hash_range &&
+        !NVMTable::HashInRange(user_key, f->hash_lo, f->hash_hi)) {
+      continue;
+    }
+    //////////meggie
     if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
         ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
       tmp.push_back(f);
@@ -371,8 +379,8 @@ Status Version::Get(const ReadOptions& options,
       for (uint32_t i = 0; i < num_files; i++) {
         FileMetaData* f = files[i];
         //////////meggie
-        if(f->hash != -1 && 
-                NVMTable::GetChunkTableIndex(k.user_key()) != f->hash){
+        if(f->has_hash_range && 
+                !NVMTable::HashInRange(k.user_key(), f->hash_lo, f->hash_hi)){
             DEBUG_T("avoid search a file\n");
             continue;
         }
@@ -431,6 +439,7 @@ Status Version::Get(const ReadOptions& options,
         case kNotFound:
           break;      // Keep searching in other files
         case kFound:
+          stats->found_sequence = saver.sequence;
           return s;
         case kDeleted:
           s = Status::NotFound(Slice());  // Use empty error message for speed
@@ -445,18 +454,191 @@ Status Version::Get(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+//////////meggie
+void Version::PrefetchForGet(const ReadOptions& options, const LookupKey& k) {
+  struct State {
+    const ReadOptions* options;
+    Slice ikey;
+    TableCache* table_cache;
+
+    // Get() reads every file until one whose filter lets the key through
+    static bool Match(void* arg, int level, FileMetaData* f) {
+      State* state = reinterpret_cast<State*>(arg);
+      return !state->table_cache->Prefetch(*state->options, f->number,
+                                           f->file_size, state->ikey);
+    }
+  };
+
+  State state;
+  state.options = &options;
+  state.ikey = k.internal_key();
+  state.table_cache = vset_->table_cache_;
+  ForEachOverlapping(k.user_key(), state.ikey, &state, &State::Match);
+}
+
+void Version::MultiGet(const ReadOptions& options, GetRequest* reqs,
+                       size_t n) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  std::vector<Saver> savers(n);
+  std::vector<FileMetaData*> last_file_read(n, nullptr);
+  std::vector<int> last_file_read_level(n, -1);
+  std::vector<size_t> pending;  // requests still searched, in key order
+  for (size_t i = 0; i < n; i++) {
+    if (reqs[i].done) continue;
+    reqs[i].stats.seek_file = nullptr;
+    reqs[i].stats.seek_file_level = -1;
+    savers[i].ucmp = ucmp;
+    savers[i].user_key = reqs[i].key->user_key();
+    savers[i].value = reqs[i].value;
+    pending.push_back(i);
+  }
+
+  // looks batch up in f, like Get() does for one key
+  std::vector<Slice> keys;
+  std::vector<void*> args;
+  auto probe = [&](int level, FileMetaData* f,
+                   const std::vector<size_t>& batch) {
+    keys.clear();
+    args.clear();
+    for (size_t j = 0; j < batch.size(); j++) {
+      const size_t i = batch[j];
+      if (last_file_read[i] != nullptr && reqs[i].stats.seek_file == nullptr) {
+        reqs[i].stats.seek_file = last_file_read[i];
+        reqs[i].stats.seek_file_level = last_file_read_level[i];
+      }
+      last_file_read[i] = f;
+      last_file_read_level[i] = level;
+      savers[i].state = kNotFound;
+      keys.push_back(reqs[i].key->internal_key());
+      args.push_back(&savers[i]);
+    }
+    Status s = vset_->table_cache_->MultiGet(options, f->number, f->file_size,
+                                             &keys[0], keys.size(), &args[0],
+                                             SaveValue);
+    for (size_t j = 0; j < batch.size(); j++) {
+      GetRequest* req = &reqs[batch[j]];
+      const Saver& saver = savers[batch[j]];
+      if (!s.ok()) {
+        req->status = s;
+        req->done = true;
+        continue;
+      }
+      switch (saver.state) {
+        case kNotFound:
+          break;
+        case kFound:
+          req->stats.found_sequence = saver.sequence;
+          req->status = Status::OK();
+          req->done = true;
+          break;
+        case kDeleted:
+          req->status = Status::NotFound(Slice());
+          req->done = true;
+          break;
+        case kCorrupt:
+          req->status = Status::Corruption("corrupted key for ",
+                                           saver.user_key);
+          req->done = true;
+          break;
+      }
+    }
+  };
+
+  std::vector<size_t> batch;
+  std::vector<FileMetaData*> tmp;
+  for (int level = 0; level < config::kNumLevels && !pending.empty();
+       level++) {
+    const std::vector<FileMetaData*>& files = files_[level];
+    if (files.empty()) continue;
+
+    if (level == 0) {
+      // newest first, each file with the keys that fall in it
+      tmp = files;
+      std::sort(tmp.begin(), tmp.end(), NewestFirst);
+      for (size_t i = 0; i < tmp.size(); i++) {
+        FileMetaData* f = tmp[i];
+        batch.clear();
+        for (size_t j = 0; j < pending.size(); j++) {
+          const GetRequest& req = reqs[pending[j]];
+          Slice user_key = req.key->user_key();
+          if (req.done ||
+              ucmp->Compare(user_key, f->smallest.user_key()) < 0 ||
+              (f->has_hash_range &&
+               !NVMTable::HashInRange(user_key, f->hash_lo, f->hash_hi))) {
+            continue;
+          }
+          if (ucmp->Compare(user_key, f->largest.user_key()) > 0) break;
+          batch.push_back(pending[j]);
+        }
+        if (!batch.empty()) probe(level, f, batch);
+      }
+    } else {
+      // sorted keys map to files in order, the ones sharing a file are
+      // looked up in it together
+      size_t j = 0;
+      while (j < pending.size()) {
+        Slice ikey = reqs[pending[j]].key->internal_key();
+        uint32_t index = FindFile(vset_->icmp_, files, ikey);
+        if (index >= files.size()) break;
+        FileMetaData* f = files[index];
+        batch.clear();
+        for (; j < pending.size(); j++) {
+          const GetRequest& req = reqs[pending[j]];
+          if (vset_->icmp_.Compare(req.key->internal_key(),
+                                   f->largest.Encode()) > 0) {
+            break;
+          }
+          if (ucmp->Compare(req.key->user_key(),
+                            f->smallest.user_key()) >= 0) {
+            batch.push_back(pending[j]);
+          }
+        }
+        if (!batch.empty()) probe(level, f, batch);
+      }
+    }
+
+    size_t kept = 0;
+    for (size_t j = 0; j < pending.size(); j++) {
+      if (!reqs[pending[j]].done) pending[kept++] = pending[j];
+    }
+    pending.resize(kept);
+  }
+
+  for (size_t j = 0; j < pending.size(); j++) {
+    reqs[pending[j]].status = Status::NotFound(Slice());
+    reqs[pending[j]].done = true;
+  }
+}
+//////////meggie
+
 bool Version::UpdateStats(const GetStats& stats) {
+  return ChargeSeek(stats) && PickSeekCompaction(stats);
+}
+
+//////////meggie
+bool Version::ChargeSeek(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
-  if (f != nullptr) {
-    f->allowed_seeks--;
-    if (f->allowed_seeks <= 0 && file_to_compact_ == nullptr) {
-      file_to_compact_ = f;
-      file_to_compact_level_ = stats.seek_file_level;
-      return true;
-    }
+  if (f == nullptr) {
+    return false;
+  }
+  // readers charge the file of a version at the same time
+  const int left = __atomic_sub_fetch(&f->allowed_seeks, 1, __ATOMIC_RELAXED);
+  return left <= 0 &&
+         __atomic_load_n(&file_to_compact_, __ATOMIC_RELAXED) == nullptr;
+}
+
+bool Version::PickSeekCompaction(const GetStats& stats) {
+  FileMetaData* f = stats.seek_file;
+  if (f != nullptr &&
+      __atomic_load_n(&f->allowed_seeks, __ATOMIC_RELAXED) <= 0 &&
+      file_to_compact_ == nullptr) {
+    file_to_compact_level_ = stats.seek_file_level;
+    __atomic_store_n(&file_to_compact_, f, __ATOMIC_RELAXED);
+    return true;
   }
   return false;
 }
+//////////meggie
 
 bool Version::RecordReadSample(Slice internal_key) {
   ParsedInternalKey ikey;
@@ -809,13 +991,13 @@ VersionSet::VersionSet(const std::string& dbname,
       dummy_versions_(this),
       current_(nullptr),
       ////////meggie
-      chunkmeta_file_(0)
+      chunkmeta_file_(0),
+      chunk_partition_type_(kHashPartition),
+      has_chunk_boundaries_(false),
+      has_chunk_hash_boundaries_(false)
       ///////meggie 
     {
   AppendVersion(new Version(this));
-  ///////////////meggie
-  chunk_files_.resize(kNumChunkTable);
-  ///////////////meggie
 }
 
 VersionSet::~VersionSet() {
@@ -927,8 +1109,20 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
        //}
     }
 
+    if(edit->has_draining_chunk_files_)
+        draining_chunk_files_ = edit->draining_chunk_files_;
     if(edit->has_meta_number_)
         chunkmeta_file_ = edit->chunkmeta_file_;
+    if(edit->has_chunk_partition_type_)
+        chunk_partition_type_ = edit->chunk_partition_type_;
+    if(edit->has_chunk_boundaries_){
+        chunk_boundaries_ = edit->chunk_boundaries_;
+        has_chunk_boundaries_ = true;
+    }
+    if(edit->has_chunk_hash_boundaries_){
+        chunk_hash_boundaries_ = edit->chunk_hash_boundaries_;
+        has_chunk_hash_boundaries_ = true;
+    }
     ///////////////meggie
   } else {
     delete v;
@@ -982,6 +1176,11 @@ Status VersionSet::Recover(bool *save_manifest) {
   bool have_last_sequence = false;
   /////////////meggie
   std::vector<uint64_t> chunk_files;
+  std::vector<std::string> chunk_boundaries;
+  bool have_chunk_boundaries = false;
+  std::vector<uint32_t> chunk_hash_boundaries;
+  bool have_chunk_hash_boundaries = false;
+  std::vector<uint64_t> draining_chunk_files;
   /////////////meggie
   uint64_t next_file = 0;
   uint64_t last_sequence = 0;
@@ -1044,10 +1243,28 @@ Status VersionSet::Recover(bool *save_manifest) {
           chunk_files.assign(edit.chunk_files_.begin(), 
                   edit.chunk_files_.end());           
       }
+
+      if(edit.has_draining_chunk_files_){
+          draining_chunk_files.swap(edit.draining_chunk_files_);
+      }
       
       if(edit.has_meta_number_){
          chunkmeta_file_ = edit.chunkmeta_file_;
       }
+
+      if(edit.has_chunk_partition_type_){
+         chunk_partition_type_ = edit.chunk_partition_type_;
+      }
+
+      if(edit.has_chunk_boundaries_){
+         chunk_boundaries.swap(edit.chunk_boundaries_);
+         have_chunk_boundaries = true;
+      }
+
+      if(edit.has_chunk_hash_boundaries_){
+         chunk_hash_boundaries.swap(edit.chunk_hash_boundaries_);
+         have_chunk_hash_boundaries = true;
+      }
       /////////////meggie
     }
   }
@@ -1085,6 +1302,11 @@ Status VersionSet::Recover(bool *save_manifest) {
     prev_log_number_ = prev_log_number;
     ////////////////////meggie
     chunk_files_.assign(chunk_files.begin(), chunk_files.end());
+    draining_chunk_files_.swap(draining_chunk_files);
+    chunk_boundaries_.swap(chunk_boundaries);
+    has_chunk_boundaries_ = have_chunk_boundaries;
+    chunk_hash_boundaries_.swap(chunk_hash_boundaries);
+    has_chunk_hash_boundaries_ = have_chunk_hash_boundaries;
     ////////////////////meggie
 
     // See if we can reuse the existing MANIFEST file.
@@ -1193,10 +1415,30 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      edit.AddFile(level, *f);
     }
   }
 
+  ///////////////meggie
+  // Save the chunk files so a fresh MANIFEST still knows the partitions
+  if (!chunk_files_.empty()) {
+    edit.update_chunkfiles(chunk_files_);
+  }
+  if (!draining_chunk_files_.empty()) {
+    edit.SetDrainingChunkFiles(draining_chunk_files_);
+  }
+  if (chunkmeta_file_ != 0) {
+    edit.SetMetaNumber(chunkmeta_file_);
+  }
+  edit.SetChunkPartitionType(chunk_partition_type_);
+  if (has_chunk_boundaries_) {
+    edit.SetChunkBoundaries(chunk_boundaries_);
+  }
+  if (has_chunk_hash_boundaries_) {
+    edit.SetChunkHashBoundaries(chunk_hash_boundaries_);
+  }
+  ///////////////meggie
+
   std::string record;
   edit.EncodeTo(&record);
   return log->AddRecord(record);
@@ -15,6 +15,7 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_SET_H_
 #define STORAGE_LEVELDB_DB_VERSION_SET_H_
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
@@ -68,15 +69,50 @@ class Version {
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
+    // Sequence number of the entry returned, set when OK is returned
+    SequenceNumber found_sequence;
   };
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
 
+  ///////////meggie
+  // One key of a MultiGet(), passed from tier to tier until done
+  struct GetRequest {
+    const LookupKey* key;
+    std::string* value;
+    Status status;
+    bool done;
+    // set for the requests MultiGet() searched
+    GetStats stats;
+  };
+  // Get() for requests sorted by user key, skipping the ones done.  Keys
+  // that fall in the same table are looked up in it together, so the
+  // table is found once and each of its blocks read once for all of them.
+  // Every request is done afterwards.
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, GetRequest* requests, size_t n);
+
+  // Start reading the first table block Get(key) will read, so that the
+  // read overlaps with probing the NVM chunks.
+  // REQUIRES: lock is not held
+  void PrefetchForGet(const ReadOptions&, const LookupKey& key);
+  ///////////meggie
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
   bool UpdateStats(const GetStats& stats);
 
+  ///////////meggie
+  // UpdateStats() in two steps, for readers that do not hold the lock.
+  // ChargeSeek() charges the seek to the file and returns true only when
+  // the file is out of seeks and none is picked yet.  PickSeekCompaction()
+  // then picks it under the lock, and returns true if it did.
+  // REQUIRES: lock is not needed for ChargeSeek(), held for the other
+  bool ChargeSeek(const GetStats& stats);
+  bool PickSeekCompaction(const GetStats& stats);
+  ///////////meggie
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.  Returns true if a new compaction may need to be triggered.
@@ -136,7 +172,8 @@ class Version {
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
-  // Next file to compact based on seek stats.
+  // Next file to compact based on seek stats.  Set under the lock,
+  // ChargeSeek() reads it without.
   FileMetaData* file_to_compact_;
   int file_to_compact_level_;
 
@@ -205,12 +242,15 @@ class VersionSet {
   int64_t NumLevelBytes(int level) const;
 
   // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  // Lock-free, the entries up to it are visible once it is read.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
-    assert(s >= last_sequence_);
-    last_sequence_ = s;
+    assert(s >= last_sequence_.load(std::memory_order_relaxed));
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   // Mark the specified file number as used.
@@ -225,13 +265,35 @@ class VersionSet {
   
   ///////////////////meggie
   void GetChunkFiles(std::vector<uint64_t>& chunk_files) const {
-      for(int i = 0; i < chunk_files_.size(); i++){
-          chunk_files[i] = chunk_files_[i];
-      }
+      chunk_files.assign(chunk_files_.begin(), chunk_files_.end());
   }
 
   void AddChunkFiles(std::vector<uint64_t>* chunk_files, 
         uint64_t* chunkmeta_file);
+
+  void GetDrainingChunkFiles(std::vector<uint64_t>* draining_chunk_files) const {
+      draining_chunk_files->assign(draining_chunk_files_.begin(), 
+                                   draining_chunk_files_.end());
+  }
+
+  // Partitioning mode recorded when the chunks were created
+  // (a ChunkPartitionType).
+  int ChunkPartitionType() const { return chunk_partition_type_; }
+
+  // Returns true iff range boundaries have been learned, and stores them
+  // in *boundaries.
+  bool GetChunkBoundaries(std::vector<std::string>* boundaries) const {
+      boundaries->assign(chunk_boundaries_.begin(), chunk_boundaries_.end());
+      return has_chunk_boundaries_;
+  }
+
+  // Returns true iff the hash partitions are no longer an even split of
+  // the hash space, and stores their boundaries in *hash_boundaries.
+  bool GetChunkHashBoundaries(std::vector<uint32_t>* hash_boundaries) const {
+      hash_boundaries->assign(chunk_hash_boundaries_.begin(), 
+                              chunk_hash_boundaries_.end());
+      return has_chunk_hash_boundaries_;
+  }
   
   void PrintChunkFiles();
   ///////////////////meggie
@@ -313,12 +375,18 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
   ///////////meggie
   std::vector<uint64_t> chunk_files_; 
+  std::vector<uint64_t> draining_chunk_files_; 
   uint64_t chunkmeta_file_; 
+  int chunk_partition_type_;
+  std::vector<std::string> chunk_boundaries_;
+  bool has_chunk_boundaries_;
+  std::vector<uint32_t> chunk_hash_boundaries_;
+  bool has_chunk_hash_boundaries_;
   ///////////meggie
 
   // Opened lazily
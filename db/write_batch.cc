@@ -20,8 +20,9 @@
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
 #include "util/coding.h"
+#include <vector>
 //////////////////meggie
-#include "util/multi_bloomfilter.h"
+#include "util/hotness_estimator.h"
 //////////////////meggie
 
 namespace leveldb {
@@ -125,22 +126,25 @@ class MemTableInserter : public WriteBatch::Handler {
   SequenceNumber sequence_;
   MemTable* mem_;
   ////////////////meggie
-  MultiHotBloomFilter* hot_bf_;
+  HotnessEstimator* hot_bf_;
+  //the keys point into the batch, they are added to hot_bf_ in one go
+  std::vector<Slice> keys_;
+  bool concurrent_;
   ////////////////meggie
 
   virtual void Put(const Slice& key, const Slice& value) {
-    mem_->Add(sequence_, kTypeValue, key, value);
+    mem_->Add(sequence_, kTypeValue, key, value, concurrent_);
     //////////meggie
     if(hot_bf_ != NULL)
-        hot_bf_->AddKey(key);
+        keys_.push_back(key);
     //////////meggie
     sequence_++;
   }
   virtual void Delete(const Slice& key) {
-    mem_->Add(sequence_, kTypeDeletion, key, Slice());
+    mem_->Add(sequence_, kTypeDeletion, key, Slice(), concurrent_);
     //////////meggie
     if(hot_bf_ != NULL)
-        hot_bf_->AddKey(key);
+        keys_.push_back(key);
     //////////meggie
     sequence_++;
   }
@@ -150,16 +154,25 @@ class MemTableInserter : public WriteBatch::Handler {
 ////////////////meggie
 Status WriteBatchInternal::InsertInto(const WriteBatch* b,
                                       MemTable* memtable,
-                                      MultiHotBloomFilter* hot_bf){
+                                      HotnessEstimator* hot_bf,
+                                      bool concurrent){
 ////////////////meggie
   
   MemTableInserter inserter;
   inserter.sequence_ = WriteBatchInternal::Sequence(b);
   /////////////meggie
   inserter.hot_bf_ = hot_bf;
+  if(hot_bf != NULL)
+      inserter.keys_.reserve(WriteBatchInternal::Count(b));
+  inserter.concurrent_ = concurrent;
   /////////////meggie
   inserter.mem_ = memtable;
-  return b->Iterate(&inserter);
+  Status s = b->Iterate(&inserter);
+  /////////////meggie
+  if(hot_bf != NULL && !inserter.keys_.empty())
+      hot_bf->AddKeys(&inserter.keys_[0], inserter.keys_.size());
+  /////////////meggie
+  return s;
 }
 
 void WriteBatchInternal::SetContents(WriteBatch* b, const Slice& contents) {
@@ -12,7 +12,7 @@ namespace leveldb {
 
 class MemTable;
 /////////////meggie
-class MultiHotBloomFilter;
+class HotnessEstimator;
 /////////////meggie
 
 // WriteBatchInternal provides static methods for manipulating a
@@ -43,9 +43,12 @@ class WriteBatchInternal {
   static void SetContents(WriteBatch* batch, const Slice& contents);
  
   ////////////////meggie
+  // With concurrent set, batches of other writers may be inserted into
+  // memtable at the same time, see MemTable::Add()
   static Status InsertInto(const WriteBatch* batch, 
           MemTable* memtable,
-          MultiHotBloomFilter* hot_bf = NULL); 
+          HotnessEstimator* hot_bf = NULL,
+          bool concurrent = false); 
   ////////////////meggie
 
   static void Append(WriteBatch* dst, const WriteBatch* src);
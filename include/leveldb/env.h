@@ -223,6 +223,14 @@ class LEVELDB_EXPORT RandomAccessFile {
   // Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  ///////////meggie
+  // Hint that "offset[0..n-1]" will be Read() soon, so that the data can
+  // be fetched in the background meanwhile.  The default does nothing.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual void Prefetch(uint64_t offset, size_t n) const { }
+  ///////////meggie
 };
 
 // A file abstraction for sequential writing.  The implementation
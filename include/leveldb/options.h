@@ -28,6 +28,28 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+/////////////////meggie
+// How user keys are spread over the chunkTables of the NVM tier.
+enum ChunkPartitionType {
+  // Route keys by hash.  Every chunk covers the whole key space.
+  kHashPartition     = 0x0,
+  // Route keys by range.  Boundaries are learned from the first data moved
+  // to NVM and recorded in the MANIFEST, so each chunk flushes a disjoint
+  // slice of the key space.
+  kRangePartition    = 0x1
+};
+
+// How the write and read hotness of user keys is estimated.
+enum HotnessEstimatorType {
+  // Bloom filters over a few decaying windows, a key is hot when it was
+  // seen in recent enough windows.
+  kMultiBloomHotness = 0x0,
+  // TinyLFU: 4-bit Count-Min counters that are halved periodically, a key
+  // is hot when its estimated count reaches a threshold.
+  kCountMinHotness   = 0x1
+};
+/////////////////meggie
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct LEVELDB_EXPORT Options {
   // -------------------
@@ -85,6 +107,108 @@ struct LEVELDB_EXPORT Options {
 
   /////////////////meggie
   size_t chunk_size;
+
+  // Number of hash partitions (chunkTables) the NVM tier is split into.
+  // Only used when a database is created; an existing database keeps the
+  // partition count recorded in its MANIFEST.
+  //
+  // Default: 4
+  int num_chunk_tables;
+
+  // How keys are partitioned across the chunkTables.  Like
+  // num_chunk_tables, only used when a database is created.
+  //
+  // Default: kHashPartition
+  ChunkPartitionType chunk_partition_type;
+
+  // Upper bound on the number of chunkTables.  A chunkTable taking far more
+  // than its share of the inserts is split in two when it is flushed, and
+  // cold neighbours are merged back.  0 keeps the partitions fixed.
+  //
+  // Default: 0
+  int max_chunk_tables;
+
+  // If true, a write puts its entry straight into the NVM chunk its key
+  // maps to and the memtable only indexes it, so moving the immutable
+  // memtable to NVM links the entries instead of copying them.  Halves
+  // the bytes written to NVM for large values, at the cost of NVM space
+  // held by overwritten entries until their chunk is flushed.  Entries
+  // whose chunk is full or was switched out are still copied.
+  //
+  // Default: false
+  bool zero_copy_nvm_move;
+
+  // When a full chunk is switched out, the newest entries of keys the
+  // write-hotness filter flags as hot are copied into the chunk replacing
+  // it, up to this many bytes, and left out of its flush to level-0.  At
+  // most a quarter of a chunk is kept whatever this is set to.  0 flushes
+  // every key.
+  //
+  // Default: 4MB
+  size_t hot_key_retention_bytes;
+
+  // If true, keys Get keeps finding in the SSTables are copied into their
+  // NVM chunk in the background, under the sequence number they were read
+  // at, so later reads of them stop going to the table files.  Reads are
+  // sampled and the copies are NVM writes of their own.
+  //
+  // Default: false
+  bool promote_hot_reads;
+
+  // Which estimator picks the hot keys that hot_key_retention_bytes and
+  // promote_hot_reads act on.
+  //
+  // Default: kMultiBloomHotness
+  HotnessEstimatorType hotness_estimator;
+
+  // If true, a Get that misses in DRAM but may be in an NVM chunk first
+  // starts reading, in the background, the table block it would read if
+  // the chunk doesn't have the key, then probes the chunk.  A miss in NVM
+  // then waits for the longer of the two instead of their sum.
+  //
+  // Default: false
+  bool parallel_lookup;
+
+  // If true, the writers a write group is made of insert their own
+  // batches into the DRAM memtable in parallel once the group is logged,
+  // instead of the group leader inserting them all one after another.
+  //
+  // Default: false
+  bool concurrent_memtable_write;
+
+  // If true, a write group hands the log on to the next group as soon as
+  // it is logged, so the next log write overlaps its memtable insert.
+  // Groups are inserted, and become visible, in the order they were
+  // logged.
+  //
+  // Default: false
+  bool pipelined_write;
+
+  // If true, the write-ahead log is kept in the NVM directory and
+  // written through a mapping, so a sync write flushes cache lines
+  // instead of calling fsync.  Logs of either kind are recovered.
+  //
+  // Default: false
+  bool nvm_log;
+
+  // If true, a write puts its entries in an NVM write buffer that takes
+  // the place of the memtable's log, and the memtable only indexes them.
+  // Nothing is written to a log and the entries are not copied again
+  // before they are moved to the chunks.  Recovery indexes the buffers
+  // anew.  The writers of a group don't insert in parallel, so
+  // concurrent_memtable_write and pipelined_write have no effect.
+  //
+  // Default: false
+  bool nvm_write_buffer;
+
+  // Number of spare chunk files a background thread keeps allocated and
+  // zeroed in the NVM directory.  A new chunk takes one over by renaming
+  // it instead of creating its file and allocating its blocks, and an
+  // obsolete chunk file is zeroed and kept as a spare instead of being
+  // deleted.  0 creates and deletes chunk files as they are needed.
+  //
+  // Default: 0
+  int spare_chunk_files;
   /////////////////meggie
 
   // Number of open files that can be used by the DB.  You may need to
@@ -74,6 +74,17 @@ class LEVELDB_EXPORT Table {
       const ReadOptions&, const Slice& key,
       void* arg,
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+  ///////////meggie
+  // Starts reading the block InternalGet(key) would read, unless it is
+  // cached.  Returns false if the filter rules key out, so no block would
+  // be read at all.
+  bool InternalPrefetch(const ReadOptions&, const Slice& key);
+  // InternalGet() for keys[0..n-1] in ascending order, with args[i] passed
+  // for keys[i].  Keys in the same block share one read of it
+  Status InternalMultiGet(
+      const ReadOptions&, const Slice* keys, size_t n, void** args,
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+  ///////////meggie
 
 
   void ReadMeta(const Footer& footer);
@@ -137,6 +137,13 @@ class AtomicPointer {
     MemoryBarrier();
     rep_ = v;
   }
+  //////////////meggie
+  // Store v if the value is still expected, with a full barrier.
+  // Returns false and stores nothing otherwise.
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
+  //////////////meggie
 };
 
 // AtomicPointer based on C++11 <atomic>.
@@ -159,6 +166,13 @@ class AtomicPointer {
   inline void NoBarrier_Store(void* v) {
     rep_.store(v, std::memory_order_relaxed);
   }
+  //////////////meggie
+  // Store v if the value is still expected, with a full barrier.
+  // Returns false and stores nothing otherwise.
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return rep_.compare_exchange_strong(expected, v);
+  }
+  //////////////meggie
 };
 
 #endif
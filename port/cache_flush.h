@@ -3,6 +3,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cpuid.h>
+#include <emmintrin.h>
 #include "util/debug.h"
 
 #ifdef _ENABLE_PMEMIO
@@ -14,51 +18,173 @@
 #define CACHE_LINE_SIZE 64
 #define ASMFLUSH(dest) __asm__ __volatile__ ("clflush %0" : : "m"(*(volatile char *)dest))
 
+//copies at least this long bypass the cache with non-temporal stores
+#define NT_COPY_THRESH 256
+
 static inline void clflush(volatile char* __p)
 {
     asm volatile("clflush %0" : "+m" (*__p));
 }
 
+//encoded by hand, so the assembler and -march don't need to know them
+static inline void clflushopt(volatile char* __p)
+{
+    asm volatile(".byte 0x66; clflush %0" : "+m" (*__p));
+}
+
+static inline void clwb(volatile char* __p)
+{
+    asm volatile(".byte 0x66; xsaveopt %0" : "+m" (*__p));
+}
+
 static inline void mfence()
 {
     asm volatile("mfence":::"memory");
     return;
 }
 
+static inline void sfence()
+{
+    asm volatile("sfence":::"memory");
+    return;
+}
+
+//how lines are written back, best the cpu supports
+enum cache_flush_mode {
+    FLUSH_CLFLUSH = 0,
+    FLUSH_CLFLUSHOPT = 1,
+    FLUSH_CLWB = 2
+};
+
+static inline enum cache_flush_mode detect_cache_flush_mode()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return FLUSH_CLFLUSH;
+    if (ebx & (1u << 24))
+        return FLUSH_CLWB;
+    if (ebx & (1u << 23))
+        return FLUSH_CLFLUSHOPT;
+    return FLUSH_CLFLUSH;
+}
+
+static inline enum cache_flush_mode get_cache_flush_mode()
+{
+    static const enum cache_flush_mode mode = detect_cache_flush_mode();
+    return mode;
+}
+
+//start writing back every line overlapping [ptr, ptr + size)
+static inline void flush_lines_mode(enum cache_flush_mode mode,
+        const void *ptr, size_t size)
+{
+  uintptr_t addr = (uintptr_t)ptr & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+  uintptr_t end = (uintptr_t)ptr + size;
+
+  switch (mode) {
+  case FLUSH_CLWB:
+    for (; addr < end; addr += CACHE_LINE_SIZE)
+      clwb((volatile char*)addr);
+    break;
+  case FLUSH_CLFLUSHOPT:
+    for (; addr < end; addr += CACHE_LINE_SIZE)
+      clflushopt((volatile char*)addr);
+    break;
+  default:
+    for (; addr < end; addr += CACHE_LINE_SIZE)
+      clflush((volatile char*)addr);
+    break;
+  }
+}
+
+//write back every line overlapping [ptr, ptr + size) and wait for it.
+//clflush is ordered on its own and needs the fences around it, the
+//weakly ordered clflushopt and clwb only need a trailing sfence
+static inline void flush_cache_mode(enum cache_flush_mode mode,
+        const void *ptr, size_t size)
+{
+  if (mode == FLUSH_CLFLUSH)
+    mfence();
+  flush_lines_mode(mode, ptr, size);
+  if (mode == FLUSH_CLFLUSH)
+    mfence();
+  else
+    sfence();
+}
+
 static inline void flush_cache(const void *ptr, size_t size){
 
 #ifdef _ENABLE_PMEMIO
   pmem_persist(ptr, size);
 #else
-  unsigned int  i=0;
-  uint64_t addr = (uint64_t)ptr;	
+  flush_cache_mode(get_cache_flush_mode(), ptr, size);
+#endif
+}
 
-  mfence();
-  for (i =0; i < size; i=i+CACHE_LINE_SIZE) {
-	clflush((volatile char*)addr);
-	addr += CACHE_LINE_SIZE;
-  }
-  mfence();
+//group commit: flush_lines() any number of ranges, then one
+//persist_barrier() waits for all of them
+static inline void flush_lines(const void *ptr, size_t size){
+
+#ifdef _ENABLE_PMEMIO
+  pmem_flush(ptr, size);
+#else
+  flush_lines_mode(get_cache_flush_mode(), ptr, size);
+#endif
+}
+
+static inline void persist_barrier(){
+
+#ifdef _ENABLE_PMEMIO
+  pmem_drain();
+#else
+  if (get_cache_flush_mode() == FLUSH_CLFLUSH)
+    mfence();
+  else
+    sfence();
 #endif
 }
 
+//copy with streaming stores that go around the cache, only the partial
+//lines at either end are copied normally and flushed
+static inline void memcpy_nt_persist_mode(enum cache_flush_mode mode,
+        void *dest, const void *src, size_t size)
+{
+  char* d = (char*)dest;
+  const char* s = (const char*)src;
+  size_t head = (CACHE_LINE_SIZE - ((uintptr_t)d & (CACHE_LINE_SIZE - 1)))
+                  & (CACHE_LINE_SIZE - 1);
+  if (head > size)
+    head = size;
+  memcpy(d, s, head);
+  if (head > 0)
+    flush_cache_mode(mode, d, head);
+  d += head;
+  s += head;
+  size -= head;
+
+  for (; size >= 16; size -= 16, d += 16, s += 16)
+    _mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+  //the streaming stores must be drained before the caller links the data
+  sfence();
+
+  if (size > 0) {
+    memcpy(d, s, size);
+    flush_cache_mode(mode, d, size);
+  }
+}
+
 static inline void memcpy_persist
                     (void *dest, const void *src, size_t size){
 
 #ifdef _ENABLE_PMEMIO
   pmem_memcpy_persist(dest, src, size);
 #else
-  unsigned int  i=0;
-  uint64_t addr = (uint64_t)dest;
-    
-  memcpy(dest, src, size);
-
-  mfence();
-  for (i =0; i < size; i=i+CACHE_LINE_SIZE) {
-    clflush((volatile char*)addr);
-    addr += CACHE_LINE_SIZE;
+  if (size >= NT_COPY_THRESH) {
+    memcpy_nt_persist_mode(get_cache_flush_mode(), dest, src, size);
+  } else {
+    memcpy(dest, src, size);
+    flush_cache(dest, size);
   }
-  mfence();
 #endif
 
 }
@@ -0,0 +1,91 @@
+#include "port/cache_flush.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+//a shared file mapping like the chunk files, on a DRAM backed
+//filesystem when there is no NVM
+class CacheFlushTest {
+ public:
+  CacheFlushTest() : size_(1 << 20) {
+    fname_ = test::TmpDir() + "/cache_flush_test";
+    fd_ = open(fname_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(fd_ >= 0);
+    ASSERT_EQ(0, ftruncate(fd_, size_));
+    map_ = (char*)mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    ASSERT_TRUE(map_ != MAP_FAILED);
+  }
+  ~CacheFlushTest() {
+    munmap(map_, size_);
+    close(fd_);
+    unlink(fname_.c_str());
+  }
+
+  //the modes this cpu can run, clflush always works
+  int MaxMode() const { return get_cache_flush_mode(); }
+
+  //copy odd sized and misaligned ranges, reading back through the file
+  //so the bytes must have reached the page cache
+  void CheckCopies(int mode, bool nt) {
+    Random rnd(301 + mode);
+    std::string src, back;
+    for (int i = 0; i < 200; i++) {
+      size_t len = rnd.Uniform(i % 2 ? 8192 : 300) + 1;
+      size_t off = rnd.Uniform(size_ - len);
+      src.resize(len);
+      for (size_t j = 0; j < len; j++) src[j] = static_cast<char>(rnd.Next());
+      if (nt) {
+        memcpy_nt_persist_mode((enum cache_flush_mode)mode,
+                               map_ + off, src.data(), len);
+      } else {
+        memcpy(map_ + off, src.data(), len);
+        flush_cache_mode((enum cache_flush_mode)mode, map_ + off, len);
+      }
+      back.resize(len);
+      ASSERT_EQ((ssize_t)len, pread(fd_, &back[0], len, off));
+      ASSERT_TRUE(back == src);
+    }
+  }
+
+  std::string fname_;
+  size_t size_;
+  int fd_;
+  char* map_;
+};
+
+TEST(CacheFlushTest, FlushAllModes) {
+  for (int mode = FLUSH_CLFLUSH; mode <= MaxMode(); mode++) {
+    CheckCopies(mode, false);
+  }
+}
+
+TEST(CacheFlushTest, NonTemporalCopyAllModes) {
+  for (int mode = FLUSH_CLFLUSH; mode <= MaxMode(); mode++) {
+    CheckCopies(mode, true);
+  }
+}
+
+TEST(CacheFlushTest, NonTemporalCopyKeepsNeighbours) {
+  memset(map_, 'x', 4096);
+  std::string src(1000, 'y');
+  for (size_t off = 1; off < 80; off += 7) {
+    memcpy_persist(map_ + off, src.data(), src.size());
+    ASSERT_EQ('x', map_[off - 1]);
+    ASSERT_EQ('y', map_[off]);
+    ASSERT_EQ('y', map_[off + src.size() - 1]);
+    ASSERT_EQ('x', map_[off + src.size()]);
+    memset(map_, 'x', 4096);
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -249,6 +249,80 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
   return s;
 }
 
+///////////meggie
+Status Table::InternalMultiGet(const ReadOptions& options, const Slice* keys,
+                               size_t n, void** args,
+                               void (*saver)(void*, const Slice&,
+                                             const Slice&)) {
+  Status s;
+  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* block_iter = nullptr;
+  std::string block_handle;  // index value of the block block_iter reads
+  for (size_t i = 0; i < n && s.ok(); i++) {
+    iiter->Seek(keys[i]);
+    if (!iiter->Valid()) {
+      // the keys after it are past the table as well
+      break;
+    }
+    Slice handle_value = iiter->value();
+    FilterBlockReader* filter = rep_->filter;
+    BlockHandle handle;
+    Slice input = handle_value;
+    if (filter != nullptr &&
+        handle.DecodeFrom(&input).ok() &&
+        !filter->KeyMayMatch(handle.offset(), keys[i])) {
+      continue;
+    }
+    if (block_iter == nullptr || handle_value != Slice(block_handle)) {
+      delete block_iter;
+      block_iter = BlockReader(this, options, handle_value);
+      block_handle.assign(handle_value.data(), handle_value.size());
+    }
+    block_iter->Seek(keys[i]);
+    if (block_iter->Valid()) {
+      (*saver)(args[i], block_iter->key(), block_iter->value());
+    }
+    s = block_iter->status();
+  }
+  delete block_iter;
+  if (s.ok()) {
+    s = iiter->status();
+  }
+  delete iiter;
+  return s;
+}
+
+bool Table::InternalPrefetch(const ReadOptions& options, const Slice& k) {
+  bool may_match = false;
+  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  iiter->Seek(k);
+  if (iiter->Valid()) {
+    Slice handle_value = iiter->value();
+    FilterBlockReader* filter = rep_->filter;
+    BlockHandle handle;
+    if (handle.DecodeFrom(&handle_value).ok() &&
+        (filter == nullptr || filter->KeyMayMatch(handle.offset(), k))) {
+      may_match = true;
+      Cache* block_cache = rep_->options.block_cache;
+      Cache::Handle* cache_handle = nullptr;
+      if (block_cache != nullptr) {
+        char cache_key_buffer[16];
+        EncodeFixed64(cache_key_buffer, rep_->cache_id);
+        EncodeFixed64(cache_key_buffer+8, handle.offset());
+        cache_handle =
+            block_cache->Lookup(Slice(cache_key_buffer, sizeof(cache_key_buffer)));
+      }
+      if (cache_handle != nullptr) {
+        block_cache->Release(cache_handle);
+      } else {
+        rep_->file->Prefetch(handle.offset(), handle.size() + kBlockTrailerSize);
+      }
+    }
+  }
+  delete iiter;
+  return may_match;
+}
+///////////meggie
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
   Iterator* index_iter =
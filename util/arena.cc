@@ -1,6 +1,7 @@
 // Copyright (c) 2011 The LevelDB Authors. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
+#include <algorithm>
 #include <cstdlib>
 #include "util/arena.h"
 #include <assert.h>
@@ -12,14 +13,22 @@
 #include <fcntl.h>
 //////////////////meggie
 #include "util/debug.h"
+#include "util/mutexlock.h"
 //////////////////meggie
 
 
 static const long kBlockSize = 4096;
+//////////////////meggie
+static const size_t kNVMPageSize = 4096;
+//address space reserved for an arena, in multiples of its capacity. It
+//costs no memory, and a chunk that outgrows it extends it in place
+static const size_t kNVMReserveFactor = 8;
+//////////////////meggie
 
 namespace leveldb {
 Arena::Arena()
-: memory_usage_(0)
+: memory_usage_(0),
+  concurrent_block_(NULL)
 {
     nvmarena_ = false;
     alloc_ptr_ = NULL;  // First allocation will allocate a block
@@ -112,6 +121,36 @@ char* Arena::AllocateAligned(size_t bytes) {
     return result;
 }
 
+///////////meggie
+char* Arena::AllocateAlignedConcurrent(size_t bytes) {
+    const size_t align = (sizeof(void*) > 8) ? sizeof(void*) : 8;
+    bytes = (bytes + align - 1) & ~(align - 1);
+    if (bytes > kBlockSize / 4) {
+        MutexLock l(&concurrent_mutex_);
+        return AllocateNewBlock(bytes);
+    }
+    const size_t header = (sizeof(ConcurrentBlock) + align - 1) & ~(align - 1);
+    while (true) {
+        ConcurrentBlock* block = concurrent_block_.load(std::memory_order_acquire);
+        if (block != NULL) {
+            size_t used = block->used.fetch_add(bytes, std::memory_order_relaxed);
+            if (used + bytes <= block->size)
+                return reinterpret_cast<char*>(block) + used;
+        }
+        //the block is full, the first thread to get here starts the next
+        //one and the others retry in it
+        MutexLock l(&concurrent_mutex_);
+        if (concurrent_block_.load(std::memory_order_relaxed) != block)
+            continue;
+        char* mem = AllocateNewBlock(kBlockSize);
+        ConcurrentBlock* next = new (mem) ConcurrentBlock;
+        next->size = kBlockSize;
+        next->used.store(header, std::memory_order_relaxed);
+        concurrent_block_.store(next, std::memory_order_release);
+    }
+}
+///////////meggie
+
 char* Arena::AllocateNewBlock(size_t block_bytes) {
     char* result = NULL;
     result = new char[block_bytes];
@@ -124,19 +163,33 @@ char* Arena::AllocateNewBlock(size_t block_bytes) {
 
 ArenaNVM::ArenaNVM(std::string *filename, 
         size_t indexfile_size, 
-        bool recovery): kNVMBlockSize(indexfile_size) {
+        bool recovery): kNVMBlockSize(indexfile_size),
+                        reserved_(0), mapped_(0),
+                        release_hook_(NULL), release_arg_(NULL) {
     //: memory_usage_(0)
     fd = -1;
     allocation = false;
     if (recovery) {
         mfile = *filename;
         map_start_ = (void *)AllocateNVMBlock(kNVMBlockSize);
-        alloc_bytes_remaining_ = *((size_t *)map_start_);
+        ///////////meggie
+        //the caller finds getMapStart() NULL and reports the failure
+        if (map_start_ == NULL) {
+            alloc_ptr_ = NULL;
+            alloc_bytes_remaining_ = 0;
+            map_end_ = 0;
+            nvmarena_ = true;
+            return;
+        }
+        //the skiplist header keeps kNVMBlockSize minus the bytes in use,
+        //wrapping around once a chunk grew past its capacity
+        size_t used = kNVMBlockSize - *((size_t *)map_start_);
+        alloc_bytes_remaining_ = used < kNVMBlockSize ? kNVMBlockSize - used : 0;
         nvmarena_ = true;
-        alloc_ptr_ = (char *)map_start_ + (kSize - alloc_bytes_remaining_);
+        alloc_ptr_ = (char *)map_start_ + used;
         map_end_ = 0;
-        memory_usage_.NoBarrier_Store(
-                reinterpret_cast<void *>(kNVMBlockSize - alloc_bytes_remaining_));
+        memory_usage_.NoBarrier_Store(reinterpret_cast<void *>(used));
+        ///////////meggie
     }
     else {
         //memory_usage_=0;
@@ -174,13 +227,19 @@ void* ArenaNVM::operator new[](size_t size) {
 }
 
 ArenaNVM::~ArenaNVM() {
-    for (size_t i = 0; i < blocks_.size(); i++) {
-        assert(i <= 1);
-        munmap(blocks_[i], kSize);
-        //blocks_[i] = nullptr;
-        DEBUG_T("have delete_ArenaNVM in ~ArenaNVM\n");
-    }
-    close(fd);
+    ///////////meggie
+    //one munmap covers the reservation and every extent mapped into it,
+    //~Arena finds nothing left to release
+    if (map_start_ != NULL)
+        munmap(map_start_, reserved_);
+    DEBUG_T("have delete_ArenaNVM in ~ArenaNVM\n");
+    blocks_.clear();
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+    if (release_hook_ != NULL)
+        (*release_hook_)(release_arg_, mfile);
+    ///////////meggie
 }
 
 void ArenaNVM::operator delete(void* ptr)
@@ -205,40 +264,127 @@ char* ArenaNVM::AllocateNVMBlock(size_t block_bytes) {
             return NULL;
     }
 
-    if(ftruncate(fd, MEM_THRESH * block_bytes) != 0){
-        perror("ftruncate failed \n");
+    ///////////meggie
+    //a recovered chunk maps all of its file, it may have grown past
+    //block_bytes before
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        perror("fstat failed \n");
         return NULL;
     }
-
-    DEBUG_T("mmap:%zu\n", MEM_THRESH * block_bytes);
-    char *result = (char *)mmap(NULL, MEM_THRESH * block_bytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-
-    /*if(result == NULL)
-        DEBUG_T("after mmap, result is null\n");
-    else 
-        DEBUG_T("mmap success\n");*/
-    kSize = MEM_THRESH * block_bytes;
+    const size_t bytes = std::max(static_cast<size_t>(st.st_size), block_bytes);
+    reserved_ = std::max(kNVMReserveFactor * kNVMBlockSize,
+            2 * (bytes + ExtentSize()));
+    char *result = (char *)mmap(NULL, reserved_, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(result == MAP_FAILED){
+        perror("mmap reserve failed \n");
+        reserved_ = 0;
+        return NULL;
+    }
+    map_start_ = result;
+    if(!Grow(bytes)){
+        munmap(result, reserved_);
+        map_start_ = NULL;
+        reserved_ = 0;
+        return NULL;
+    }
+    DEBUG_T("mmap:%zu, reserved:%zu\n", mapped_, reserved_);
+    ///////////meggie
 
     allocation = true;
     blocks_.push_back(result);
-    assert(blocks_.size() <= 1);
     return result;
 }
 
+///////////meggie
+size_t ArenaNVM::ExtentSize() const {
+    const size_t extent = (kNVMBlockSize / 4 + kNVMPageSize - 1) & ~(kNVMPageSize - 1);
+    return extent > 0 ? extent : kNVMPageSize;
+}
+
+//extends the reservation in place to at least bytes, at least doubling
+//it. Fails only if the address range behind it is taken
+bool ArenaNVM::Reserve(size_t bytes) {
+    const size_t more = std::max(bytes - reserved_, reserved_);
+    char* addr = reinterpret_cast<char*>(map_start_) + reserved_;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    void* result = mmap(addr, more, PROT_NONE, flags, -1, 0);
+    if(result == MAP_FAILED)
+        return false;
+    //older kernels take the address as a hint only
+    if(result != addr){
+        munmap(result, more);
+        return false;
+    }
+    reserved_ += more;
+    return true;
+}
+
+//maps the file up to at least bytes from its start, in whole extents
+//right behind what is mapped already
+bool ArenaNVM::Grow(size_t bytes) {
+    const size_t extent = ExtentSize();
+    const size_t target = (bytes + extent - 1) / extent * extent;
+    if(target <= mapped_)
+        return true;
+    if(target > reserved_ && !Reserve(target)){
+        DEBUG_T("arena %s out of reserved space, %zu > %zu\n",
+                mfile.c_str(), target, reserved_);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        perror("fstat failed \n");
+        return false;
+    }
+    if(static_cast<size_t>(st.st_size) < target && ftruncate(fd, target) != 0){
+        perror("ftruncate failed \n");
+        return false;
+    }
+    char* addr = reinterpret_cast<char*>(map_start_) + mapped_;
+    if(mmap(addr, target - mapped_, PROT_READ|PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, mapped_) == MAP_FAILED){
+        perror("mmap extent failed \n");
+        return false;
+    }
+    mapped_ = target;
+    return true;
+}
+///////////meggie
+
 char* ArenaNVM::AllocateFallbackNVM(size_t bytes) {
-    alloc_ptr_ = AllocateNVMBlock(kNVMBlockSize);
-    map_start_ = (void *)alloc_ptr_;
+    ///////////meggie
+    if(allocation){
+        //past the capacity the file is mapped further, nothing moves
+        const size_t used = alloc_ptr_ - reinterpret_cast<char*>(map_start_);
+        if(!Grow(used + bytes))
+            return NULL;
+        alloc_bytes_remaining_ = 0;
+        char* result = alloc_ptr_;
+        alloc_ptr_ += bytes;
+        memory_usage_.NoBarrier_Store(
+                reinterpret_cast<void*>(MemoryUsage() + bytes));
+        return result;
+    }
+    alloc_ptr_ = AllocateNVMBlock(std::max(bytes, kNVMBlockSize));
+    if(alloc_ptr_ == NULL)
+        return NULL;
+    ///////////meggie
     memory_usage_.NoBarrier_Store(
             reinterpret_cast<void*>(MemoryUsage() + bytes));
-    alloc_bytes_remaining_ = kNVMBlockSize;
+    alloc_bytes_remaining_ = bytes < kNVMBlockSize ? kNVMBlockSize - bytes : 0;
 
     char* result = alloc_ptr_;
     alloc_ptr_ += bytes;
-    alloc_bytes_remaining_ -= bytes;
     return result;
 }
 
 char* ArenaNVM::AllocateAlignedNVM(size_t bytes) {
+    MutexLock l(&mutex_);
 
     const int align = (sizeof(void*) > 8) ? sizeof(void*) : 8;
     assert((align & (align-1)) == 0);   // Pointer size should be a power of 2
@@ -253,22 +399,41 @@ char* ArenaNVM::AllocateAlignedNVM(size_t bytes) {
         alloc_bytes_remaining_ -= needed;
         memory_usage_.NoBarrier_Store(
                 reinterpret_cast<void*>(MemoryUsage() + needed));
-    } else {
-        if(allocation){
-            alloc_bytes_remaining_ = 0;
-            result = alloc_ptr_ + slop;
-            alloc_ptr_ += needed;
-            memory_usage_.NoBarrier_Store(
-                    reinterpret_cast<void*>(MemoryUsage() + needed));
-        }
-        else{
-            result = this->AllocateFallbackNVM(bytes);
-        }
+    } else if(allocation){
+        result = this->AllocateFallbackNVM(needed);
+        if(result != NULL)
+            result += slop;
+    } else{
+        result = this->AllocateFallbackNVM(bytes);
     }
     assert((reinterpret_cast<uintptr_t>(result) & (align-1)) == 0);
     return result;
 }
 
+///////////meggie
+bool ArenaNVM::MakeRoom(size_t bytes) {
+    MutexLock l(&mutex_);
+    if(map_start_ == NULL){
+        //what the first allocation would map
+        char* start = AllocateNVMBlock(kNVMBlockSize);
+        if(start == NULL)
+            return false;
+        alloc_ptr_ = start;
+        alloc_bytes_remaining_ = kNVMBlockSize;
+    }
+    //writers may still place entries up to the capacity in the meantime
+    const size_t used = alloc_ptr_ - reinterpret_cast<char*>(map_start_);
+    return Grow(std::max(used, kNVMBlockSize) + bytes);
+}
+
+size_t ArenaNVM::AllocatedBytes() {
+    MutexLock l(&mutex_);
+    if (map_start_ == NULL)
+        return 0;
+    return alloc_ptr_ - reinterpret_cast<char*>(map_start_);
+}
+///////////meggie
+
 //TODO: This method just implements virtual function
 char* ArenaNVM::AllocateAligned(size_t bytes) {
     return NULL;
@@ -5,6 +5,7 @@
 #ifndef STORAGE_LEVELDB_UTIL_ARENA_H_
 #define STORAGE_LEVELDB_UTIL_ARENA_H_
 
+#include <atomic>
 #include <vector>
 #include <assert.h>
 #include <stddef.h>
@@ -13,13 +14,13 @@
 
 namespace leveldb {
 
-//Overprovision
-#define MEM_THRESH 1.5
-
 class Arena {
 public:
     Arena();
-    ~Arena();
+    //////////meggie
+    //virtual, MemTable frees the arena of a chunk through an Arena*
+    virtual ~Arena();
+    //////////meggie
 
     // Return a pointer to a newly allocated memory block of "bytes" bytes.
     char* Allocate(size_t bytes);
@@ -27,6 +28,14 @@ public:
     // Allocate memory with the normal alignment guarantees provided by malloc
     virtual char* AllocateAligned(size_t bytes);
 
+    ///////////meggie
+    // AllocateAligned() that may be called by several threads at once.
+    // Space is claimed from a block of its own with an atomic add, only
+    // starting a new block takes a lock.  It must not run alongside the
+    // other Allocate calls, which keep using their own block.
+    char* AllocateAlignedConcurrent(size_t bytes);
+    ///////////meggie
+
     // Returns an estimate of the total memory usage of data allocated
     // by the arena.
     size_t MemoryUsage() const {
@@ -62,6 +71,18 @@ protected:
     // Total memory usage of the arena.
     port::AtomicPointer memory_usage_;
 
+    ///////////meggie
+    // The block AllocateAlignedConcurrent() hands out space from, the
+    // header sits at the start of the block
+    struct ConcurrentBlock {
+        size_t size;
+        std::atomic<size_t> used;
+    };
+    std::atomic<ConcurrentBlock*> concurrent_block_;
+    // Held while a new block is started for AllocateAlignedConcurrent()
+    port::Mutex concurrent_mutex_;
+    ///////////meggie
+
     // No copying allowed
     //Arena(const Arena&);
 };
@@ -97,6 +118,35 @@ public:
     char* Allocate(size_t bytes);
     void* CalculateOffset(void* ptr);
     void* getMapStart();
+    ///////////meggie
+    //bytes the arena is sized for, the file is mapped in extents and
+    //grows past it when a chunk overflows
+    size_t Capacity() const { return kNVMBlockSize; }
+    //true if p points into the address range reserved for this arena
+    bool Contains(const char* p) const {
+        const char* start = reinterpret_cast<const char*>(map_start_);
+        return start != NULL && p >= start && p < start + reserved_;
+    }
+    //bytes from the start of the mapping to the allocation point, may run
+    //past Capacity() once the arena grew
+    size_t AllocatedBytes();
+    //bytes of the file mapped so far
+    size_t MappedBytes() const { return mapped_; }
+    //bytes of address space reserved for the mapping
+    size_t ReservedBytes() const { return reserved_; }
+    //maps the file far enough that the next bytes of allocations are
+    //served without growing it. False if the file or the reservation
+    //can't be extended, the arena stays as it was. An allocation the
+    //file can't be grown for returns NULL
+    bool MakeRoom(size_t bytes);
+    //called with arg and the file name once the arena has unmapped and
+    //closed its file, NULL for no call
+    typedef void (*ReleaseHook)(void* arg, const std::string& fname);
+    void SetReleaseHook(ReleaseHook hook, void* arg) {
+        release_hook_ = hook;
+        release_arg_ = arg;
+    }
+    ///////////meggie
 
     // Returns an estimate of the total memory usage of data allocated
     // by the arena.
@@ -106,6 +156,20 @@ public:
     // Total memory usage of the arena.
 private:
     size_t kNVMBlockSize;
+    ///////////meggie
+    //writers place entries in a chunk while the move thread adds to it
+    port::Mutex mutex_;
+    //the address range is reserved up front and only extended in place,
+    //so offsets from map_start_ stay valid, and the file is mapped into
+    //it extent by extent
+    size_t reserved_;
+    size_t mapped_;
+    size_t ExtentSize() const;
+    bool Reserve(size_t bytes);
+    bool Grow(size_t bytes);
+    ReleaseHook release_hook_;
+    void* release_arg_;
+    ///////////meggie
 };
 
 inline char* ArenaNVM::Allocate(size_t bytes) {
@@ -0,0 +1,126 @@
+/*************************************************************************
+	> File Name: util/count_min_sketch.cc
+	> Author: Meggie
+	> Mail: 1224642332@qq.com 
+	> Created Time: Sat 17 Oct 2026 02:26:05 PM CST
+ ************************************************************************/
+#include "util/count_min_sketch.h"
+#include "util/MurmurHash3.h"
+#include "port/cache_flush.h"
+#include <assert.h>
+#include <algorithm>
+#include <new>
+
+namespace leveldb{
+
+    //16 counters of 4 bits in a word, each row owns 2 words of a line
+    static const int kCountersPerRow = 32;
+    static const uint64_t kMaxCount = 15;
+    static const uint64_t kHalfMask = 0x7777777777777777ull;
+
+    CountMinSketch::CountMinSketch(int hot_thresh, size_t sample_size, 
+            size_t counter_num)
+        : hot_thresh_(hot_thresh),
+        sample_size_(sample_size),
+        num_lines_(0),
+        mem_(NULL),
+        lines_(NULL),
+        req_num_(0){
+           assert(sample_size > 0);
+           const size_t counters_per_line = kRows * kCountersPerRow;
+           num_lines_ = std::max<size_t>(1, 
+                   (counter_num + counters_per_line - 1) / counters_per_line);
+           //aligned by hand, posix_memalign would come from libhoard
+           mem_ = new char[num_lines_ * kLineWords * sizeof(uint64_t) 
+               + CACHE_LINE_SIZE];
+           uintptr_t start = (reinterpret_cast<uintptr_t>(mem_) 
+                   + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+           lines_ = reinterpret_cast<std::atomic<uint64_t>*>(start);
+           for(size_t i = 0; i < num_lines_ * kLineWords; i++)
+               new (&lines_[i]) std::atomic<uint64_t>(0);
+    }
+
+    CountMinSketch::~CountMinSketch(){
+        delete[] mem_;
+    }
+
+    void CountMinSketch::MakeProbe(const Slice& user_key, 
+            Probe* probe) const {
+        uint64_t h[2];
+        MurmurHash3_x64_128(user_key.data(), user_key.size(), 0, h);
+        probe->line = lines_ + (h[0] % num_lines_) * kLineWords;
+        for(int r = 0; r < kRows; r++){
+            const int counter = (h[1] >> (r * 8)) % kCountersPerRow;
+            probe->word[r] = r * 2 + counter / 16;
+            probe->shift[r] = (counter % 16) * 4;
+        }
+    }
+
+    int CountMinSketch::Estimate(const Probe& probe) const {
+        uint64_t count = kMaxCount;
+        for(int r = 0; r < kRows; r++){
+            const uint64_t word = 
+                probe.line[probe.word[r]].load(std::memory_order_relaxed);
+            count = std::min(count, (word >> probe.shift[r]) & kMaxCount);
+        }
+        return static_cast<int>(count);
+    }
+
+    void CountMinSketch::Halve(){
+        for(size_t i = 0; i < num_lines_ * kLineWords; i++){
+            const uint64_t word = lines_[i].load(std::memory_order_relaxed);
+            lines_[i].store((word >> 1) & kHalfMask, 
+                    std::memory_order_relaxed);
+        }
+    }
+
+    void CountMinSketch::Add(const Probe& probe, uint64_t req){
+        if(req % sample_size_ == 0)
+            Halve();
+        const uint64_t count = Estimate(probe);
+        if(count == kMaxCount)
+            return;
+        for(int r = 0; r < kRows; r++){
+            std::atomic<uint64_t>& word = probe.line[probe.word[r]];
+            const int shift = probe.shift[r];
+            uint64_t old = word.load(std::memory_order_relaxed);
+            //only the counters holding the minimum, another writer may
+            //have moved it on already
+            while(((old >> shift) & kMaxCount) == count &&
+                    !word.compare_exchange_weak(old, old + (1ull << shift), 
+                        std::memory_order_relaxed)){
+            }
+        }
+    }
+
+    void CountMinSketch::AddKey(const Slice& user_key){
+        Probe probe;
+        MakeProbe(user_key, &probe);
+        Add(probe, req_num_.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+
+    void CountMinSketch::AddKeys(const Slice* user_keys, size_t n){
+        const size_t kBatch = 16;
+        Probe probes[kBatch];
+        for(size_t i = 0; i < n; i += kBatch){
+            const size_t m = std::min(kBatch, n - i);
+            for(size_t j = 0; j < m; j++){
+                MakeProbe(user_keys[i + j], &probes[j]);
+                __builtin_prefetch(probes[j].line, 1);
+            }
+            uint64_t req = req_num_.fetch_add(m, std::memory_order_relaxed);
+            for(size_t j = 0; j < m; j++)
+                Add(probes[j], ++req);
+        }
+    }
+
+    int CountMinSketch::Frequency(const Slice& user_key) const {
+        Probe probe;
+        MakeProbe(user_key, &probe);
+        return Estimate(probe);
+    }
+
+    bool CountMinSketch::CheckHot(const Slice& user_key){
+        return Frequency(user_key) >= hot_thresh_;
+    }
+}
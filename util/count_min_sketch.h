@@ -0,0 +1,59 @@
+/*************************************************************************
+	> File Name: util/count_min_sketch.h
+	> Author: Meggie
+	> Mail: 1224642332@qq.com 
+	> Created Time: Sat 17 Oct 2026 02:26:05 PM CST
+ ************************************************************************/
+#ifndef LEVELDB_COUNT_MIN_SKETCH_H
+#define LEVELDB_COUNT_MIN_SKETCH_H
+
+#include <atomic>
+#include <stdint.h>
+#include "leveldb/slice.h"
+#include "util/hotness_estimator.h"
+
+namespace leveldb{
+
+    //TinyLFU frequency sketch. A key has one 4-bit counter in each of 4
+    //rows, all of them in one 64 byte line, and its count is the smallest
+    //of the four. Only the smallest counters are bumped (conservative
+    //update) and every sample_size keys all counters are halved, so the
+    //count follows recent accesses. Counters are updated with a
+    //compare and swap, halving races with it and may drop an increment.
+    class CountMinSketch : public HotnessEstimator{
+        public:
+            //counter_num is rounded up to a whole number of lines
+            CountMinSketch(int hot_thresh = 4, size_t sample_size = 36864, 
+                    size_t counter_num = 32768);
+            virtual ~CountMinSketch();
+            virtual void AddKey(const Slice& user_key);
+            virtual void AddKeys(const Slice* user_keys, size_t n);
+            virtual bool CheckHot(const Slice& user_key);
+            virtual size_t GetReqNum(){
+                return req_num_.load(std::memory_order_relaxed);
+            }
+            //estimated accesses of user_key, at most 15
+            int Frequency(const Slice& user_key) const;
+            
+        private:
+            enum { kLineWords = 8, kRows = 4 };
+            struct Probe {
+                std::atomic<uint64_t>* line;
+                //word and bit offset of the counter in each row
+                int word[kRows];
+                int shift[kRows];
+            };
+            void MakeProbe(const Slice& user_key, Probe* probe) const;
+            int Estimate(const Probe& probe) const;
+            void Add(const Probe& probe, uint64_t req);
+            void Halve();
+            int hot_thresh_;
+            size_t sample_size_;
+            size_t num_lines_;
+            char* mem_;
+            std::atomic<uint64_t>* lines_;
+            std::atomic<uint64_t> req_num_;
+    };
+}//namespace leveldb
+
+#endif
@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <cstddef>
@@ -191,6 +192,17 @@ class PosixRandomAccessFile final : public RandomAccessFile {
     return status;
   }
 
+  ///////////meggie
+  // The kernel starts the reads and returns, a file without a permanent
+  // fd is not worth opening just for a hint.
+  void Prefetch(uint64_t offset, size_t n) const override {
+    if (has_permanent_fd_) {
+      ::posix_fadvise(fd_, static_cast<off_t>(offset), n,
+                      POSIX_FADV_WILLNEED);
+    }
+  }
+  ///////////meggie
+
  private:
   const bool has_permanent_fd_;  // If false, the file is opened on every read.
   const int fd_;  // -1 if has_permanent_fd_ is false.
@@ -233,6 +245,18 @@ class PosixMmapReadableFile final : public RandomAccessFile {
     return Status::OK();
   }
 
+  ///////////meggie
+  void Prefetch(uint64_t offset, size_t n) const override {
+    if (offset >= length_) return;
+    n = std::min(n, static_cast<size_t>(length_ - offset));
+    const uintptr_t page = static_cast<uintptr_t>(::getpagesize());
+    uintptr_t start = reinterpret_cast<uintptr_t>(mmap_base_ + offset);
+    uintptr_t aligned = start & ~(page - 1);
+    ::madvise(reinterpret_cast<void*>(aligned), n + (start - aligned),
+              MADV_WILLNEED);
+  }
+  ///////////meggie
+
  private:
   char* const mmap_base_;
   const size_t length_;
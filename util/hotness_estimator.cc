@@ -0,0 +1,24 @@
+/*************************************************************************
+	> File Name: util/hotness_estimator.cc
+	> Author: Meggie
+	> Mail: 1224642332@qq.com 
+	> Created Time: Sat 17 Oct 2026 02:10:31 PM CST
+ ************************************************************************/
+#include "util/hotness_estimator.h"
+#include "util/count_min_sketch.h"
+#include "util/multi_bloomfilter.h"
+
+namespace leveldb{
+
+    HotnessEstimator* NewWriteHotnessEstimator(HotnessEstimatorType type){
+        if(type == kCountMinHotness)
+            return new CountMinSketch(4);
+        return new MultiHotBloomFilter();
+    }
+
+    HotnessEstimator* NewReadHotnessEstimator(HotnessEstimatorType type){
+        if(type == kCountMinHotness)
+            return new CountMinSketch(6);
+        return new MultiHotBloomFilter(4, 2, 4);
+    }
+}
@@ -0,0 +1,43 @@
+/*************************************************************************
+	> File Name: util/hotness_estimator.h
+	> Author: Meggie
+	> Mail: 1224642332@qq.com 
+	> Created Time: Sat 17 Oct 2026 02:10:31 PM CST
+ ************************************************************************/
+#ifndef LEVELDB_HOTNESS_ESTIMATOR_H
+#define LEVELDB_HOTNESS_ESTIMATOR_H
+
+#include <stddef.h>
+#include "leveldb/options.h"
+#include "leveldb/slice.h"
+
+namespace leveldb{
+
+    //tells hot keys from cold ones out of the stream of keys accessed.
+    //AddKey() and CheckHot() may be called from any number of threads
+    //without locking
+    class HotnessEstimator{
+        public:
+            HotnessEstimator() { }
+            virtual ~HotnessEstimator() { }
+            virtual void AddKey(const Slice& user_key) = 0;
+            virtual void AddKeys(const Slice* user_keys, size_t n){
+                for(size_t i = 0; i < n; i++)
+                    AddKey(user_keys[i]);
+            }
+            virtual bool CheckHot(const Slice& user_key) = 0;
+            //keys added so far
+            virtual size_t GetReqNum() = 0;
+
+        private:
+            HotnessEstimator(const HotnessEstimator&);
+            void operator=(const HotnessEstimator&);
+    };
+
+    //the estimator for keys written, and the one for keys read from the
+    //sstables, which must see a key more often before calling it hot
+    HotnessEstimator* NewWriteHotnessEstimator(HotnessEstimatorType type);
+    HotnessEstimator* NewReadHotnessEstimator(HotnessEstimatorType type);
+}//namespace leveldb
+
+#endif
@@ -7,7 +7,11 @@
 #include "util/multi_bloomfilter.h"
 #include "util/MurmurHash3.h"
 #include "util/debug.h"
+#include "port/cache_flush.h"
 #include <assert.h>
+#include <algorithm>
+#include <new>
+#include <immintrin.h>
 
 namespace leveldb{
     BitBloomFilter::BitBloomFilter(int hash_num, size_t bit_size)
@@ -103,6 +107,8 @@ namespace leveldb{
         DEBUG_T("\n");
     }
     
+    static const int kLineBits = 512;
+
     MultiHotBloomFilter::MultiHotBloomFilter(int bf_num, double max_weight, 
             double hot_thresh, int decay_window, 
             int hash_num, int bit_size_per_bf)
@@ -110,80 +116,170 @@ namespace leveldb{
         max_weight_(max_weight),
         hot_thresh_(hot_thresh),
         decay_window_(decay_window),
-        current_filter_index_(0),
-        decay_filter_index_(0),
+        hash_num_(hash_num),
+        words_per_bf_(kLineWords / bf_num),
+        num_lines_(0),
+        mem_(NULL),
+        lines_(NULL),
         req_num_(0){
-           bloom_filters_ = new BitBloomFilter* [bf_num_];
-           weights_ = new int[bf_num_];
-           for(int i = 0; i < bf_num_; i++){
-               bloom_filters_[i] = new BitBloomFilter(hash_num, bit_size_per_bf);
-               weights_[i] = i + 1;
-           }
+           assert(bf_num == 1 || bf_num == 2 || bf_num == 4 || bf_num == 8);
+           num_lines_ = (static_cast<size_t>(bf_num) * bit_size_per_bf 
+                   + kLineBits - 1) / kLineBits;
+           if(num_lines_ == 0)
+               num_lines_ = 1;
+           //aligned by hand, posix_memalign would come from libhoard
+           mem_ = new char[num_lines_ * kLineWords * sizeof(uint64_t) 
+               + CACHE_LINE_SIZE];
+           uintptr_t start = (reinterpret_cast<uintptr_t>(mem_) 
+                   + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+           lines_ = reinterpret_cast<std::atomic<uint64_t>*>(start);
+           for(size_t i = 0; i < num_lines_ * kLineWords; i++)
+               new (&lines_[i]) std::atomic<uint64_t>(0);
     }
+
     MultiHotBloomFilter::~MultiHotBloomFilter(){
-        for(int i = 0; i < bf_num_; i++)
-            delete bloom_filters_[i];
-        delete []bloom_filters_;
-        delete []weights_;
-    }
-
-    void MultiHotBloomFilter::DecayBF(){
-        //reset weights
-        for(int i = 0; i < bf_num_; i++){
-            weights_[i] -= 1;
-            if(weights_[i] == 0){
-                assert(decay_filter_index_ == i);
-                weights_[i] = bf_num_;
-            }
+        delete[] mem_;
+    }
+
+    void MultiHotBloomFilter::MakeProbe(const Slice& user_key, 
+            Probe* probe) const {
+        uint64_t h[2];
+        MurmurHash3_x64_128(user_key.data(), user_key.size(), 0, h);
+        probe->line = lines_ + (h[0] % num_lines_) * kLineWords;
+        //the same bits in every generation, like the separate filters
+        //that shared their hash functions
+        const uint64_t bf_bits = words_per_bf_ * 64;
+        uint64_t mask[kLineWords] = {0};
+        const uint64_t delta = (h[1] >> 33) | 1;
+        for(int j = 0; j < hash_num_; j++){
+            const uint64_t bitpos = (h[1] + j * delta) % bf_bits;
+            mask[bitpos / 64] |= 1ull << (bitpos % 64);
+        }
+        for(int w = 0; w < kLineWords; w++)
+            probe->mask[w] = mask[w % words_per_bf_];
+    }
+
+    //bit w of the result is set if word w of the line has all its mask bits
+    static uint32_t MatchWords(const uint64_t* line, const uint64_t* mask){
+        uint32_t matched = 0;
+        for(int w = 0; w < 8; w++){
+            if((line[w] & mask[w]) == mask[w])
+                matched |= 1u << w;
+        }
+        return matched;
+    }
+
+    __attribute__((target("avx2")))
+    static uint32_t MatchWordsAVX2(const uint64_t* line, const uint64_t* mask){
+        const __m256i* l = reinterpret_cast<const __m256i*>(line);
+        const __m256i* m = reinterpret_cast<const __m256i*>(mask);
+        __m256i m0 = _mm256_loadu_si256(m);
+        __m256i m1 = _mm256_loadu_si256(m + 1);
+        __m256i eq0 = _mm256_cmpeq_epi64(
+                _mm256_and_si256(_mm256_load_si256(l), m0), m0);
+        __m256i eq1 = _mm256_cmpeq_epi64(
+                _mm256_and_si256(_mm256_load_si256(l + 1), m1), m1);
+        return _mm256_movemask_pd(_mm256_castsi256_pd(eq0)) |
+            (_mm256_movemask_pd(_mm256_castsi256_pd(eq1)) << 4);
+    }
+
+    static bool HasAVX2(){
+        static const bool has_avx2 = __builtin_cpu_supports("avx2");
+        return has_avx2;
+    }
+
+    uint32_t MultiHotBloomFilter::Generations(const Probe& probe) const {
+        alignas(32) uint64_t line[kLineWords];
+        for(int w = 0; w < kLineWords; w++)
+            line[w] = probe.line[w].load(std::memory_order_relaxed);
+        const uint32_t matched = HasAVX2() ? 
+            MatchWordsAVX2(line, probe.mask) : MatchWords(line, probe.mask);
+        const uint32_t bf_words = (1u << words_per_bf_) - 1;
+        uint32_t generations = 0;
+        for(int g = 0; g < bf_num_; g++){
+            if(((matched >> (g * words_per_bf_)) & bf_words) == bf_words)
+                generations |= 1u << g;
+        }
+        return generations;
+    }
+
+    //every decay_window_ requests the oldest generation is emptied and
+    //becomes the newest. After d decays generation g weighs 
+    //((g - d) mod bf_num) + 1
+    void MultiHotBloomFilter::DecayBF(uint64_t decays){
+        const int g = static_cast<int>((decays - 1) % bf_num_);
+        for(size_t i = 0; i < num_lines_; i++){
+            std::atomic<uint64_t>* line = lines_ + i * kLineWords;
+            for(int w = 0; w < words_per_bf_; w++)
+                line[g * words_per_bf_ + w].store(0, std::memory_order_relaxed);
         }
-        //reset decaybf 
-        bloom_filters_[decay_filter_index_]->Reset();
-        //set next decaybf , circle right move
-        decay_filter_index_ = (decay_filter_index_ + 1 + bf_num_) % bf_num_;
     }
  
-    double MultiHotBloomFilter::CountWeight(const Slice& user_key){
+    double MultiHotBloomFilter::CountWeight(uint32_t generations, 
+            uint64_t decays) const {
         double keyWeight = 0;
-        for(int i = 0; i < bf_num_; i++){
-            if(bloom_filters_[i]->Query(user_key))
-                keyWeight += weights_[i];
+        for(int g = 0; g < bf_num_; g++){
+            if(generations & (1u << g))
+                keyWeight += (g + bf_num_ - decays % bf_num_) % bf_num_ + 1;
         }
-        //DEBUG_T("user_key:%s\n: keyWeight:%f, result_weight:%f\n",
-          //      user_key.ToString().c_str(), keyWeight, (keyWeight * max_weight_) / bf_num_);
         return (keyWeight * max_weight_) / bf_num_;
     }
 
-    void MultiHotBloomFilter::AddKey(const Slice& user_key){
-        req_num_++;
-        if(req_num_ % decay_window_ == 0)
-            DecayBF();
-        if(bloom_filters_[current_filter_index_]->Query(user_key)){
-            //DEBUG_T("after query\n");
-            int next_filter_index = (current_filter_index_ + 1 + bf_num_) % bf_num_;
-            while(next_filter_index != current_filter_index_){
-                if(bloom_filters_[next_filter_index]->Query(user_key))
-                    next_filter_index = (next_filter_index + 1 + bf_num_) % bf_num_;
-                else{
-                    //DEBUG_T("to_add_key1\n");
-                    bloom_filters_[next_filter_index]->Add(user_key);
+    //req is the 1-based number of this request. Requests go round the
+    //generations, a key already in the current one goes to the next
+    //generation that doesn't have it yet
+    void MultiHotBloomFilter::Add(const Probe& probe, uint64_t req){
+        if(req % decay_window_ == 0)
+            DecayBF(req / decay_window_);
+        const int current = static_cast<int>((req - 1) % bf_num_);
+        const uint32_t generations = Generations(probe);
+        int target = current;
+        if(generations & (1u << current)){
+            target = -1;
+            for(int i = 1; i < bf_num_; i++){
+                const int g = (current + i) % bf_num_;
+                if(!(generations & (1u << g))){
+                    target = g;
                     break;
-                } 
+                }
             }
+            if(target < 0)
+                return;
+        }
+        for(int w = target * words_per_bf_; 
+                w < (target + 1) * words_per_bf_; w++){
+            if(probe.mask[w] != 0)
+                probe.line[w].fetch_or(probe.mask[w], 
+                        std::memory_order_relaxed);
         }
-        else{ 
-            //DEBUG_T("to_add_key2\n");
-            bloom_filters_[current_filter_index_]->Add(user_key);
+    }
+
+    void MultiHotBloomFilter::AddKey(const Slice& user_key){
+        Probe probe;
+        MakeProbe(user_key, &probe);
+        Add(probe, req_num_.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+
+    void MultiHotBloomFilter::AddKeys(const Slice* user_keys, size_t n){
+        const size_t kBatch = 16;
+        Probe probes[kBatch];
+        for(size_t i = 0; i < n; i += kBatch){
+            const size_t m = std::min(kBatch, n - i);
+            for(size_t j = 0; j < m; j++){
+                MakeProbe(user_keys[i + j], &probes[j]);
+                __builtin_prefetch(probes[j].line, 1);
+            }
+            uint64_t req = req_num_.fetch_add(m, std::memory_order_relaxed);
+            for(size_t j = 0; j < m; j++)
+                Add(probes[j], ++req);
         }
-        current_filter_index_ = (current_filter_index_ + 1 + bf_num_) % bf_num_;
     }
 
     bool MultiHotBloomFilter::CheckHot(const Slice& user_key){
-        //DEBUG_T("user_key:%s,CountWeight:%f\n", user_key.ToString().c_str(),
-          //      CountWeight(user_key));
-        if(CountWeight(user_key) >= hot_thresh_)
-             return true;
-        else 
-             return false; 
+        Probe probe;
+        MakeProbe(user_key, &probe);
+        const uint64_t decays = 
+            req_num_.load(std::memory_order_relaxed) / decay_window_;
+        return CountWeight(Generations(probe), decays) >= hot_thresh_;
     }
 }
-
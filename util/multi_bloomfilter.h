@@ -9,7 +9,10 @@
 
 #include "util/hash.h"
 #include "leveldb/slice.h"
+#include "util/hotness_estimator.h"
 #include <array>
+#include <atomic>
+#include <stdint.h>
 
 namespace leveldb{
 
@@ -35,28 +38,50 @@ namespace leveldb{
             size_t bit_size_;
             size_t bytes_;
     };
-    class MultiHotBloomFilter{
+    //A key's generations share one 64 byte line, generation g owns words
+    //[g * 8 / bf_num, (g + 1) * 8 / bf_num) of it, so telling whether a
+    //key is hot costs one cache miss. Bits are set with an atomic or and
+    //a decayed generation is cleared word by word, writers and readers
+    //may run concurrently and at worst see a slightly stale filter.
+    class MultiHotBloomFilter : public HotnessEstimator{
         public:
+            //bf_num must be 1, 2, 4 or 8
             MultiHotBloomFilter(int bf_num = 4, double max_weight = 2, 
                     double hot_thresh = 2, int decay_window = 9216, 
                     int hash_num = 2, int bit_size_per_bf = 36864);
-            ~MultiHotBloomFilter();
-            void AddKey(const Slice& user_key);
-            bool CheckHot(const Slice& user_key);
-            size_t GetReqNum(){return req_num_;}
+            virtual ~MultiHotBloomFilter();
+            virtual void AddKey(const Slice& user_key);
+            //AddKey() each key in order, the lines of all of them are
+            //fetched before the first is updated
+            virtual void AddKeys(const Slice* user_keys, size_t n);
+            virtual bool CheckHot(const Slice& user_key);
+            virtual size_t GetReqNum(){
+                return req_num_.load(std::memory_order_relaxed);
+            }
             
         private:
-            void DecayBF();
-            double CountWeight(const Slice& user_key);
+            enum { kLineWords = 8 };
+            struct Probe {
+                std::atomic<uint64_t>* line;
+                //bits of the key in every generation's words
+                uint64_t mask[kLineWords];
+            };
+            void MakeProbe(const Slice& user_key, Probe* probe) const;
+            //bit g is set if generation g holds the key
+            uint32_t Generations(const Probe& probe) const;
+            void Add(const Probe& probe, uint64_t req);
+            void DecayBF(uint64_t decays);
+            double CountWeight(uint32_t generations, uint64_t decays) const;
             int bf_num_;
             double max_weight_;
             double hot_thresh_;
             int decay_window_;
-            BitBloomFilter** bloom_filters_;
-            int current_filter_index_;
-            int decay_filter_index_;
-            int* weights_;
-            size_t req_num_;
+            int hash_num_;
+            int words_per_bf_;
+            size_t num_lines_;
+            char* mem_;
+            std::atomic<uint64_t>* lines_;
+            std::atomic<uint64_t> req_num_;
     };
 }//namespace leveldb
 
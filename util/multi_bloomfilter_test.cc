@@ -7,7 +7,18 @@
 #include "util/testharness.h"
 #include <iostream>
 #include <stdio.h>
+#include <string>
+#include <vector>
+#include "port/port.h"
+#include "util/count_min_sketch.h"
+#include "util/hotness_estimator.h"
 #include "util/multi_bloomfilter.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+#include "leveldb/env.h"
+#include <algorithm>
+#include <map>
+#include <math.h>
 
 namespace leveldb{
 
@@ -46,6 +57,206 @@ namespace leveldb{
         }
     }
 
+    static std::string Key(int k){
+        char key[32];
+        snprintf(key, sizeof(key), "key%08d", k);
+        return key;
+    }
+
+    TEST(MultiBloomFilterTest, RepeatedKeysGetHot){
+        MultiHotBloomFilter mbf(4, 2, 2, 1000, 2, 8192);
+        Random rnd(301);
+        for(int i = 0; i < 4000; i++){
+            //key 0 every other write, the rest once each
+            mbf.AddKey(Key(i % 2 == 0 ? 0 : 1 + rnd.Uniform(1000000)));
+        }
+        ASSERT_TRUE(mbf.CheckHot(Key(0)));
+        int hot = 0;
+        for(int i = 1; i <= 1000; i++){
+            if(mbf.CheckHot(Key(2000000 + i)))
+                hot++;
+        }
+        ASSERT_LT(hot, 50);
+
+        //a key left alone cools down once its generations decay
+        for(int i = 0; i < 4000; i++)
+            mbf.AddKey(Key(3000000 + i));
+        ASSERT_TRUE(!mbf.CheckHot(Key(0)));
+        ASSERT_EQ(8000, mbf.GetReqNum());
+    }
+
+    TEST(MultiBloomFilterTest, AddKeysMatchesAddKey){
+        MultiHotBloomFilter one(4, 2, 2, 97, 2, 1024);
+        MultiHotBloomFilter batch(4, 2, 2, 97, 2, 1024);
+        Random rnd(17);
+        std::vector<std::string> keys;
+        for(int i = 0; i < 5000; i++)
+            keys.push_back(Key(rnd.Skewed(10)));
+        for(size_t i = 0; i < keys.size(); i++)
+            one.AddKey(keys[i]);
+        std::vector<Slice> slices(keys.begin(), keys.end());
+        for(size_t i = 0; i < slices.size(); i += 37){
+            size_t n = std::min<size_t>(37, slices.size() - i);
+            batch.AddKeys(&slices[i], n);
+        }
+        ASSERT_EQ(one.GetReqNum(), batch.GetReqNum());
+        for(int k = 0; k < 1024; k++)
+            ASSERT_EQ(one.CheckHot(Key(k)), batch.CheckHot(Key(k)));
+    }
+
+    struct ConcurrentState{
+        MultiHotBloomFilter* mbf;
+        port::Mutex mu;
+        port::CondVar cv;
+        int running;
+        ConcurrentState() : cv(&mu), running(0) { }
+    };
+
+    static void ConcurrentWriter(void* arg){
+        ConcurrentState* state = reinterpret_cast<ConcurrentState*>(arg);
+        std::vector<Slice> batch;
+        std::vector<std::string> keys;
+        for(int i = 0; i < 20000; i++){
+            keys.push_back(Key(i % 3 == 0 ? 0 : i));
+        }
+        for(size_t i = 0; i < keys.size(); i++){
+            if(i % 2 == 0){
+                state->mbf->AddKey(keys[i]);
+            }
+            else{
+                batch.push_back(keys[i]);
+                if(batch.size() == 16){
+                    state->mbf->AddKeys(&batch[0], batch.size());
+                    batch.clear();
+                }
+            }
+            state->mbf->CheckHot(keys[(i * 7) % keys.size()]);
+        }
+        if(!batch.empty())
+            state->mbf->AddKeys(&batch[0], batch.size());
+        MutexLock l(&state->mu);
+        state->running--;
+        state->cv.Signal();
+    }
+
+    TEST(MultiBloomFilterTest, ConcurrentWriters){
+        MultiHotBloomFilter mbf(4, 2, 2, 5000, 2, 8192);
+        ConcurrentState state;
+        state.mbf = &mbf;
+        const int kThreads = 4;
+        state.running = kThreads;
+        for(int i = 0; i < kThreads; i++)
+            Env::Default()->StartThread(ConcurrentWriter, &state);
+        {
+            MutexLock l(&state.mu);
+            while(state.running > 0)
+                state.cv.Wait();
+        }
+        ASSERT_EQ(kThreads * 20000, mbf.GetReqNum());
+        ASSERT_TRUE(mbf.CheckHot(Key(0)));
+    }
+
+    //zipfian key ids like the workloads db_bench replays, the ranks are
+    //scattered over the key space
+    class ZipfGenerator{
+        public:
+            ZipfGenerator(int n, double theta, uint32_t seed)
+                : rnd_(seed), cdf_(n){
+                double sum = 0;
+                for(int i = 0; i < n; i++){
+                    sum += 1.0 / pow(i + 1, theta);
+                    cdf_[i] = sum;
+                }
+                for(int i = 0; i < n; i++)
+                    cdf_[i] /= sum;
+            }
+            int Next(){
+                double u = (rnd_.Next() + 0.5) / 2147483647.0;
+                int rank = std::lower_bound(cdf_.begin(), cdf_.end(), u) 
+                    - cdf_.begin();
+                rank = std::min<int>(rank, cdf_.size() - 1);
+                return static_cast<int>((rank * 2654435761u) % cdf_.size());
+            }
+        private:
+            Random rnd_;
+            std::vector<double> cdf_;
+    };
+
+    struct Accuracy{
+        double precision;
+        double recall;
+    };
+
+    //hot for real: seen at least thresh times in the last window keys
+    static Accuracy Measure(HotnessEstimator* est, double theta){
+        const int kKeys = 100000, kTrace = 200000;
+        const int kWindow = 36864, kThresh = 4;
+        ZipfGenerator gen(kKeys, theta, 301);
+        std::vector<int> trace;
+        for(int i = 0; i < kTrace; i++)
+            trace.push_back(gen.Next());
+        for(int i = 0; i < kTrace; i++)
+            est->AddKey(Key(trace[i]));
+        std::map<int, int> counts;
+        for(int i = kTrace - kWindow; i < kTrace; i++)
+            counts[trace[i]]++;
+        int true_pos = 0, false_pos = 0, false_neg = 0;
+        for(int k = 0; k < kKeys; k++){
+            const bool hot = counts.count(k) > 0 && counts[k] >= kThresh;
+            if(est->CheckHot(Key(k))){
+                if(hot)
+                    true_pos++;
+                else
+                    false_pos++;
+            }
+            else if(hot){
+                false_neg++;
+            }
+        }
+        Accuracy acc;
+        acc.precision = true_pos ? 
+            static_cast<double>(true_pos) / (true_pos + false_pos) : 0;
+        acc.recall = true_pos ? 
+            static_cast<double>(true_pos) / (true_pos + false_neg) : 0;
+        return acc;
+    }
+
+    TEST(MultiBloomFilterTest, CountMinFrequency){
+        CountMinSketch cms(4, 1000, 4096);
+        for(int i = 0; i < 10; i++)
+            cms.AddKey("a");
+        cms.AddKey("b");
+        ASSERT_GE(cms.Frequency("a"), 10);
+        ASSERT_TRUE(cms.CheckHot("a"));
+        ASSERT_TRUE(!cms.CheckHot("b"));
+
+        //counters are halved every sample_size keys
+        for(int i = 0; i < 989; i++)
+            cms.AddKey(Key(i));
+        ASSERT_LE(cms.Frequency("a"), 8);
+        for(int i = 0; i < 1000; i++)
+            cms.AddKey(Key(i));
+        ASSERT_TRUE(!cms.CheckHot("a"));
+    }
+
+    TEST(MultiBloomFilterTest, ZipfPrecisionRecall){
+        const double thetas[] = { 0.99, 1.2 };
+        for(int t = 0; t < 2; t++){
+            HotnessEstimator* bloom = 
+                NewWriteHotnessEstimator(kMultiBloomHotness);
+            HotnessEstimator* cms = NewWriteHotnessEstimator(kCountMinHotness);
+            Accuracy b = Measure(bloom, thetas[t]);
+            Accuracy c = Measure(cms, thetas[t]);
+            fprintf(stderr, "zipf %.2f: bloom precision %.3f recall %.3f, "
+                    "count-min precision %.3f recall %.3f\n", thetas[t], 
+                    b.precision, b.recall, c.precision, c.recall);
+            ASSERT_GT(c.precision, b.precision);
+            ASSERT_GT(c.recall, 0.8);
+            delete bloom;
+            delete cms;
+        }
+    }
+
 }
 int main(int argc, char** argv) {
     return leveldb::test::RunAllTests();
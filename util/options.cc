@@ -19,6 +19,19 @@ Options::Options()
       write_buffer_size(4<<20),
       /////////////meggie
       chunk_size(64<<20),
+      num_chunk_tables(4),
+      chunk_partition_type(kHashPartition),
+      max_chunk_tables(0),
+      zero_copy_nvm_move(false),
+      hot_key_retention_bytes(4<<20),
+      promote_hot_reads(false),
+      hotness_estimator(kMultiBloomHotness),
+      parallel_lookup(false),
+      concurrent_memtable_write(false),
+      pipelined_write(false),
+      nvm_log(false),
+      nvm_write_buffer(false),
+      spare_chunk_files(0),
       /////////////meggie
       max_open_files(1000),
       block_cache(nullptr),
@@ -0,0 +1,117 @@
+/*************************************************************************
+	> File Name: util/thread_local.cc
+	> Author: Meggie
+	> Mail: 1224642332@qq.com 
+	> Created Time: Sat 17 Oct 2026 08:42:15 PM CST
+ ************************************************************************/
+#include "util/thread_local.h"
+#include <algorithm>
+#include "port/port.h"
+#include "util/mutexlock.h"
+#include "util/no_destructor.h"
+
+namespace leveldb{
+
+    namespace{
+        //ids of the live threads, the lowest free one is taken first
+        class ThreadIdPool{
+            public:
+                ThreadIdPool() : next_(0) { }
+                int Acquire(){
+                    MutexLock l(&mu_);
+                    if(free_.empty())
+                        return next_++;
+                    std::vector<int>::iterator it =
+                        std::min_element(free_.begin(), free_.end());
+                    int id = *it;
+                    *it = free_.back();
+                    free_.pop_back();
+                    return id;
+                }
+                void Release(int id){
+                    MutexLock l(&mu_);
+                    free_.push_back(id);
+                }
+            private:
+                port::Mutex mu_;
+                std::vector<int> free_;
+                int next_;
+        };
+
+        ThreadIdPool* IdPool(){
+            static NoDestructor<ThreadIdPool> pool;
+            return pool.get();
+        }
+
+        struct ThreadId{
+            int id;
+            ThreadId() : id(IdPool()->Acquire()) { }
+            ~ThreadId() { IdPool()->Release(id); }
+        };
+
+        int CurrentThreadId(){
+            static thread_local ThreadId tid;
+            return tid.id;
+        }
+    }
+
+    ThreadLocalPtr::ThreadLocalPtr(){
+        for(int i = 0; i < kMaxThreads / kSlotsPerBlock; i++)
+            blocks_[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    ThreadLocalPtr::~ThreadLocalPtr(){
+        for(int i = 0; i < kMaxThreads / kSlotsPerBlock; i++)
+            delete[] blocks_[i].load(std::memory_order_relaxed);
+    }
+
+    std::atomic<void*>* ThreadLocalPtr::GetSlot(){
+        const int id = CurrentThreadId();
+        if(id >= kMaxThreads)
+            return NULL;
+        std::atomic<Slot*>& block = blocks_[id / kSlotsPerBlock];
+        Slot* slots = block.load(std::memory_order_acquire);
+        if(slots == NULL){
+            Slot* fresh = new Slot[kSlotsPerBlock];
+            for(int i = 0; i < kSlotsPerBlock; i++)
+                fresh[i].ptr.store(NULL, std::memory_order_relaxed);
+            if(block.compare_exchange_strong(slots, fresh,
+                        std::memory_order_acq_rel)){
+                slots = fresh;
+            }else{
+                //another thread of the block was first
+                delete[] fresh;
+            }
+        }
+        return &slots[id % kSlotsPerBlock].ptr;
+    }
+
+    void* ThreadLocalPtr::Swap(void* ptr){
+        std::atomic<void*>* slot = GetSlot();
+        if(slot == NULL)
+            return NULL;
+        return slot->exchange(ptr, std::memory_order_acq_rel);
+    }
+
+    bool ThreadLocalPtr::CompareAndSwap(void* ptr, void*& expected){
+        std::atomic<void*>* slot = GetSlot();
+        if(slot == NULL)
+            return false;
+        return slot->compare_exchange_strong(expected, ptr,
+                std::memory_order_acq_rel);
+    }
+
+    void ThreadLocalPtr::Scrape(std::vector<void*>* ptrs, void* replacement){
+        for(int i = 0; i < kMaxThreads / kSlotsPerBlock; i++){
+            Slot* slots = blocks_[i].load(std::memory_order_acquire);
+            if(slots == NULL)
+                continue;
+            for(int j = 0; j < kSlotsPerBlock; j++){
+                void* ptr = slots[j].ptr.exchange(replacement,
+                        std::memory_order_acq_rel);
+                if(ptr != NULL)
+                    ptrs->push_back(ptr);
+            }
+        }
+    }
+}
@@ -0,0 +1,56 @@
+/*************************************************************************
+	> File Name: util/thread_local.h
+	> Author: Meggie
+	> Mail: 1224642332@qq.com 
+	> Created Time: Sat 17 Oct 2026 08:42:15 PM CST
+ ************************************************************************/
+#ifndef LEVELDB_THREAD_LOCAL_H
+#define LEVELDB_THREAD_LOCAL_H
+
+#include <atomic>
+#include <vector>
+
+namespace leveldb{
+
+    //a pointer per thread for each instance. Unlike a thread_local
+    //variable it belongs to an object, whose owner can swap out the
+    //pointers of all threads at once, e.g. to take back what they cache.
+    //The id of an exited thread is handed out again, and the next thread
+    //that gets it finds what the exited one left in the slot.
+    //Threads beyond kMaxThreads have no slot: Swap() gives them NULL and
+    //their CompareAndSwap() fails
+    class ThreadLocalPtr{
+        public:
+            static const int kMaxThreads = 4096;
+
+            ThreadLocalPtr();
+            ~ThreadLocalPtr();
+
+            //the calling thread's pointer, replaced with ptr
+            void* Swap(void* ptr);
+            //sets the calling thread's pointer to ptr if it still is
+            //expected, else loads it into expected
+            bool CompareAndSwap(void* ptr, void*& expected);
+            //the pointer of every thread is replaced with replacement,
+            //the ones that were not NULL are appended to ptrs
+            void Scrape(std::vector<void*>* ptrs, void* replacement);
+
+        private:
+            static const int kSlotsPerBlock = 64;
+            //one line per thread, so the threads don't share lines
+            struct Slot{
+                std::atomic<void*> ptr;
+                char padding[64 - sizeof(std::atomic<void*>)];
+            };
+            //slots are allocated a block at a time, when a thread with an
+            //id in the block first asks for one
+            std::atomic<Slot*> blocks_[kMaxThreads / kSlotsPerBlock];
+
+            std::atomic<void*>* GetSlot();
+
+            ThreadLocalPtr(const ThreadLocalPtr&);
+            void operator=(const ThreadLocalPtr&);
+    };
+}
+
+#endif
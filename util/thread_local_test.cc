@@ -0,0 +1,130 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_local.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class ThreadLocalTest { };
+
+TEST(ThreadLocalTest, SwapAndCompareAndSwap) {
+  ThreadLocalPtr tls;
+  int a, b;
+  ASSERT_TRUE(tls.Swap(&a) == nullptr);
+  ASSERT_TRUE(tls.Swap(&b) == &a);
+  void* expected = &a;
+  ASSERT_TRUE(!tls.CompareAndSwap(nullptr, expected));
+  ASSERT_TRUE(expected == &b);
+  ASSERT_TRUE(tls.CompareAndSwap(&a, expected));
+  ASSERT_TRUE(tls.Swap(nullptr) == &a);
+
+  // each instance has its own slot
+  ThreadLocalPtr other;
+  tls.Swap(&a);
+  ASSERT_TRUE(other.Swap(&b) == nullptr);
+  ASSERT_TRUE(tls.Swap(nullptr) == &a);
+}
+
+TEST(ThreadLocalTest, ThreadsHaveTheirOwnSlots) {
+  ThreadLocalPtr tls;
+  const int kThreads = 16;
+  std::vector<int> values(kThreads);
+  std::atomic<int> ready(0);
+  std::atomic<bool> scraped(false);
+  std::atomic<int> lost(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.push_back(std::thread([&, i]() {
+      tls.Swap(&values[i]);
+      ready++;
+      while (!scraped.load()) std::this_thread::yield();
+      // taken back by Scrape()
+      if (tls.Swap(nullptr) != nullptr) lost++;
+    }));
+  }
+  while (ready.load() < kThreads) std::this_thread::yield();
+
+  std::vector<void*> ptrs;
+  tls.Scrape(&ptrs, nullptr);
+  scraped.store(true);
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  ASSERT_EQ(0, lost.load());
+  ASSERT_EQ(kThreads, static_cast<int>(ptrs.size()));
+  std::sort(ptrs.begin(), ptrs.end());
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT_TRUE(std::binary_search(ptrs.begin(), ptrs.end(),
+                                   static_cast<void*>(&values[i])));
+  }
+}
+
+// Readers cache a reference to the current object, the writer replaces
+// it and takes back the cached references with Scrape(), as DBImpl does
+// with its super versions.  Every reference is dropped exactly once.
+TEST(ThreadLocalTest, CachedReferences) {
+  struct Object {
+    std::atomic<int> refs;
+  };
+  static char in_use;
+  const int kThreads = 8;
+  const int kRounds = 20000;
+  const int kObjects = 200;
+  std::vector<Object> objects(kObjects);
+  for (int i = 0; i < kObjects; i++) objects[i].refs.store(0);
+  std::mutex mu;
+  Object* current = &objects[0];
+  current->refs++;
+
+  ThreadLocalPtr tls;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.push_back(std::thread([&]() {
+      for (int r = 0; r < kRounds; r++) {
+        Object* obj = reinterpret_cast<Object*>(tls.Swap(&in_use));
+        if (obj == nullptr) {
+          std::lock_guard<std::mutex> l(mu);
+          obj = current;
+          obj->refs++;
+        }
+        ASSERT_GT(obj->refs.load(), 0);
+        void* expected = &in_use;
+        if (!tls.CompareAndSwap(obj, expected)) obj->refs--;
+      }
+    }));
+  }
+  for (int i = 1; i < kObjects; i++) {
+    std::lock_guard<std::mutex> l(mu);
+    std::vector<void*> ptrs;
+    tls.Scrape(&ptrs, nullptr);
+    for (size_t j = 0; j < ptrs.size(); j++) {
+      if (ptrs[j] != &in_use) reinterpret_cast<Object*>(ptrs[j])->refs--;
+    }
+    current->refs--;
+    current = &objects[i];
+    current->refs++;
+    std::this_thread::yield();
+  }
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+  std::vector<void*> ptrs;
+  tls.Scrape(&ptrs, nullptr);
+  for (size_t j = 0; j < ptrs.size(); j++) {
+    reinterpret_cast<Object*>(ptrs[j])->refs--;
+  }
+  current->refs--;
+  for (int i = 0; i < kObjects; i++) {
+    ASSERT_EQ(0, objects[i].refs.load());
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
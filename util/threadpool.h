@@ -43,8 +43,13 @@ class ThreadPool {
             DEBUG_T("to handle job\n");
             next_job()();//next_job()函数就是获取想要运行的函数对象，然后执行()表示开始运行
             DEBUG_T("after handle job\n");
-            --jobs_left;//剩下的还未完成的任务数量 
-            wait_var.notify_one();//唤醒正在等待任务完成的线程，表示有一个任务已经完成了
+            {
+                //under wait_mutex, or WaitAll() can miss the last job
+                //finishing between its check and its wait
+                std::lock_guard<std::mutex> guard( wait_mutex );
+                --jobs_left;//剩下的还未完成的任务数量 
+            }
+            wait_var.notify_all();//唤醒正在等待任务完成的线程，表示有一个任务已经完成了
         }
     }
 